@@ -0,0 +1,55 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "SBQueue.h"
+
+namespace esphome {
+namespace sb {
+
+// longer frames are stored truncated, length keeps the original size
+static const size_t SB_CAPTURE_FRAME_SIZE = 32;
+
+enum class SBCaptureDirection : uint8_t { TX = 'T', RX = 'R' };
+
+// raw frame sent to or received from the water heater
+struct SBCaptureRecord {
+  // millis() when the frame was sent or received
+  uint32_t time = 0;
+  uint16_t conn_id = 0;
+  SBCaptureDirection direction = SBCaptureDirection::TX;
+  uint8_t length = 0;
+  uint8_t data[SB_CAPTURE_FRAME_SIZE]{};
+
+  size_t stored_length() const { return this->length < SB_CAPTURE_FRAME_SIZE ? this->length : SB_CAPTURE_FRAME_SIZE; }
+};
+
+/**
+ * Binary capture of the last N frames. Recording copies the frame into the
+ * ring and never formats anything; the oldest record is overwritten when
+ * the ring is full.
+ */
+template<size_t N> class SBCapture {
+ public:
+  void record(SBCaptureDirection direction, uint16_t conn_id, uint32_t time, const uint8_t *data, size_t length) {
+    if (this->records_.full())
+      this->records_.pop();
+    SBCaptureRecord record;
+    record.time = time;
+    record.conn_id = conn_id;
+    record.direction = direction;
+    record.length = length < 255 ? length : 255;
+    memcpy(record.data, data, record.stored_length());
+    this->records_.push(std::move(record));
+  }
+  void clear() { this->records_.clear(); }
+  size_t size() const { return this->records_.size(); }
+  // i-th record counted from the oldest one
+  const SBCaptureRecord &at(size_t i) const { return this->records_.at(i); }
+
+ protected:
+  SBRingQueue<SBCaptureRecord, N> records_;
+};
+
+}  // namespace sb
+}  // namespace esphome
@@ -0,0 +1,138 @@
+#pragma once
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include "esphome/core/defines.h"
+#include "SBProtocol.h"
+
+namespace esphome {
+namespace sb {
+
+#ifdef USE_SMARTBOILER_DIAGNOSTICS
+
+/**
+ * Round-trip times of one packet type in log2 buckets: bucket i counts
+ * replies which took [2^i, 2^(i+1)) ms, the last one all slower replies.
+ */
+struct SBRttHistogram {
+  static const size_t BUCKETS = 12;
+
+  void add(uint32_t rtt) {
+    size_t bucket = 0;
+    for (; rtt > 1 && bucket < BUCKETS - 1; rtt >>= 1)
+      bucket++;
+    if (this->counts[bucket] < UINT16_MAX)
+      this->counts[bucket]++;
+  }
+  uint32_t total() const {
+    uint32_t sum = 0;
+    for (auto count : this->counts)
+      sum += count;
+    return sum;
+  }
+  // upper bound in ms of the bucket which holds the given percentile, 0 when empty
+  uint32_t percentile(uint8_t percent) const {
+    uint32_t total = this->total();
+    if (total == 0)
+      return 0;
+    uint32_t rank = (total * percent + 99) / 100;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+      sum += this->counts[i];
+      if (sum >= rank)
+        return 2u << i;
+    }
+    return 2u << (BUCKETS - 1);
+  }
+
+  SBPacket packet = SBPacket::SBC_PACKET_NONE;
+  std::array<uint16_t, BUCKETS> counts{};
+};
+
+/**
+ * Counters describing the link to one water heater. Memory is fixed:
+ * histograms are kept for the first HISTOGRAMS packet types answered, all
+ * replies also count into one overall histogram.
+ */
+class SBDiagnostics {
+ public:
+  static const size_t HISTOGRAMS = 8;
+  static const size_t STATES = 4;
+
+  void on_reply(SBPacket packet, uint32_t rtt) {
+    this->all_.add(rtt);
+    for (auto &histogram : this->histograms_) {
+      if (histogram.packet == SBPacket::SBC_PACKET_NONE)
+        histogram.packet = packet;
+      if (histogram.packet == packet) {
+        histogram.add(rtt);
+        return;
+      }
+    }
+  }
+  void on_queue_depth(size_t commands, size_t sent) {
+    if (commands > this->command_queue_peak_)
+      this->command_queue_peak_ = commands;
+    if (sent > this->sent_queue_peak_)
+      this->sent_queue_peak_ = sent;
+  }
+  void on_unmatched_confirm() { this->unmatched_confirms_++; }
+  void on_home_error() { this->home_errors_++; }
+  void on_write_failure() { this->write_failures_++; }
+  void on_rollback() { this->rollbacks_++; }
+  void on_connect() { this->connects_++; }
+  void on_state(uint8_t state, uint32_t now) {
+    this->time_in_state_[this->state_] += now - this->state_since_;
+    this->state_ = state < STATES ? state : 0;
+    this->state_since_ = now;
+  }
+
+  const SBRttHistogram &get_all() const { return this->all_; }
+  const std::array<SBRttHistogram, HISTOGRAMS> &get_histograms() const { return this->histograms_; }
+  size_t get_command_queue_peak() const { return this->command_queue_peak_; }
+  size_t get_sent_queue_peak() const { return this->sent_queue_peak_; }
+  uint32_t get_unmatched_confirms() const { return this->unmatched_confirms_; }
+  uint32_t get_home_errors() const { return this->home_errors_; }
+  uint32_t get_write_failures() const { return this->write_failures_; }
+  uint32_t get_rollbacks() const { return this->rollbacks_; }
+  uint32_t get_reconnects() const { return this->connects_ > 0 ? this->connects_ - 1 : 0; }
+  // milliseconds spent in the state, including the current stay
+  uint32_t get_time_in_state(uint8_t state, uint32_t now) const {
+    uint32_t time = this->time_in_state_[state];
+    return state == this->state_ ? time + (now - this->state_since_) : time;
+  }
+
+ protected:
+  SBRttHistogram all_;
+  std::array<SBRttHistogram, HISTOGRAMS> histograms_{};
+  size_t command_queue_peak_ = 0;
+  size_t sent_queue_peak_ = 0;
+  uint32_t unmatched_confirms_ = 0;
+  uint32_t home_errors_ = 0;
+  uint32_t write_failures_ = 0;
+  uint32_t rollbacks_ = 0;
+  uint32_t connects_ = 0;
+  std::array<uint32_t, STATES> time_in_state_{};
+  uint8_t state_ = 0;
+  uint32_t state_since_ = 0;
+};
+
+#else
+
+// instrumentation is compiled out, every call is a no-op
+class SBDiagnostics {
+ public:
+  void on_reply(SBPacket packet, uint32_t rtt) {}
+  void on_queue_depth(size_t commands, size_t sent) {}
+  void on_unmatched_confirm() {}
+  void on_home_error() {}
+  void on_write_failure() {}
+  void on_rollback() {}
+  void on_connect() {}
+  void on_state(uint8_t state, uint32_t now) {}
+};
+
+#endif
+
+}  // namespace sb
+}  // namespace esphome
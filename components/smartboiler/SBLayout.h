@@ -0,0 +1,86 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+namespace esphome {
+namespace sb {
+
+/**
+ * Little endian unsigned integer of Size bytes at Offset of a binary payload.
+ * Fields are types, so offsets and sizes are checked by the compiler and
+ * reading one compiles down to a few loads.
+ */
+template<size_t Offset, size_t Size> struct SBField {
+  static_assert(Size >= 1 && Size <= 4, "fields are 1 to 4 bytes long");
+  using type = std::conditional_t<(Size == 1), uint8_t, std::conditional_t<(Size == 2), uint16_t, uint32_t>>;
+  static constexpr size_t OFFSET = Offset;
+  static constexpr size_t SIZE = Size;
+  // first byte after the field
+  static constexpr size_t END = Offset + Size;
+
+  static constexpr type decode(const uint8_t *data) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < Size; i++)
+      value |= uint32_t(data[Offset + i]) << (8 * i);
+    return type(value);
+  }
+  static constexpr void encode(uint8_t *data, type value) {
+    for (size_t i = 0; i < Size; i++)
+      data[Offset + i] = uint8_t(uint32_t(value) >> (8 * i));
+  }
+};
+template<size_t Offset> using SBU8 = SBField<Offset, 1>;
+template<size_t Offset> using SBU16 = SBField<Offset, 2>;
+template<size_t Offset> using SBU24 = SBField<Offset, 3>;
+template<size_t Offset> using SBU32 = SBField<Offset, 4>;
+
+// Count fields of the same kind following each other, the first one at Offset
+template<size_t Offset, size_t Size, size_t Count> struct SBArray {
+  using type = typename SBField<0, Size>::type;
+  static constexpr size_t OFFSET = Offset;
+  static constexpr size_t COUNT = Count;
+  static constexpr size_t END = Offset + Size * Count;
+
+  // end of the i-th element
+  static constexpr size_t end(size_t i) { return Offset + Size * (i + 1); }
+  static constexpr type decode(const uint8_t *data, size_t i) {
+    return SBField<0, Size>::decode(data + Offset + Size * i);
+  }
+  static constexpr void encode(uint8_t *data, size_t i, type value) {
+    SBField<0, Size>::encode(data + Offset + Size * i, value);
+  }
+};
+
+/**
+ * Bounds-checked access to a received binary payload. Fields which did not
+ * arrive read as 0; has() tells them apart from a real 0.
+ */
+class SBPayload {
+ public:
+  constexpr SBPayload() = default;
+  constexpr SBPayload(const uint8_t *data, size_t length) : data_(data), length_(length) {}
+
+  template<typename F> constexpr bool has() const { return F::END <= this->length_; }
+  template<typename F> constexpr typename F::type get() const { return this->has<F>() ? F::decode(this->data_) : 0; }
+  // number of complete elements of an array which arrived
+  template<typename A> constexpr size_t count() const {
+    size_t count = 0;
+    while (count < A::COUNT && A::end(count) <= this->length_)
+      count++;
+    return count;
+  }
+  template<typename A> constexpr typename A::type get(size_t i) const {
+    return i < A::COUNT && A::end(i) <= this->length_ ? A::decode(this->data_, i) : 0;
+  }
+
+  constexpr const uint8_t *data() const { return this->data_; }
+  constexpr size_t size() const { return this->length_; }
+
+ protected:
+  const uint8_t *data_ = nullptr;
+  size_t length_ = 0;
+};
+
+}  // namespace sb
+}  // namespace esphome
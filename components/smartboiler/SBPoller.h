@@ -0,0 +1,126 @@
+#pragma once
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include "SBProtocol.h"
+
+namespace esphome {
+namespace sb {
+
+// value read periodically from the water heater
+struct SBPollEntry {
+  SBPacket packet = SBPacket::SBC_PACKET_NONE;
+  // 0 means once per connection
+  uint32_t interval = 0;
+  uint32_t next_due = 0;
+  // millis() of the last reply, 0 when not received yet
+  uint32_t last_update = 0;
+  bool pending = false;
+  bool first = true;
+};
+
+/**
+ * Per-value polling deadlines. Each value has its own interval; the phase
+ * shifts the deadlines of one instance against the others, so water heaters
+ * connected to the same node do not poll in bursts.
+ */
+class SBPoller {
+ public:
+  static const size_t MAX_ENTRIES = 24;
+
+  bool add(SBPacket packet, uint32_t interval) {
+    if (this->count_ == MAX_ENTRIES)
+      return false;
+    auto &entry = this->entries_[this->count_++];
+    entry.packet = packet;
+    entry.interval = interval;
+    return true;
+  }
+  // phase as a fraction of each interval, in 1/256 units
+  void set_phase(uint8_t phase) { this->phase_ = phase; }
+
+  // schedule every value for refresh starting at the given time; static
+  // values received less than static_max_age ago are kept as they are
+  void start(uint32_t at, uint32_t static_max_age) {
+    for (size_t i = 0; i < this->count_; i++) {
+      auto &entry = this->entries_[i];
+      if (entry.interval == 0 && entry.last_update != 0 && at - entry.last_update < static_max_age)
+        continue;
+      entry.next_due = at;
+      entry.pending = true;
+      entry.first = true;
+    }
+  }
+  // returns the next value due for polling and schedules its next refresh, SBC_PACKET_NONE if nothing is due
+  SBPacket take_due(uint32_t now) {
+    for (size_t i = 0; i < this->count_; i++) {
+      auto &entry = this->entries_[i];
+      if (!entry.pending || int32_t(now - entry.next_due) < 0)
+        continue;
+      this->take(entry, now);
+      return entry.packet;
+    }
+    return SBPacket::SBC_PACKET_NONE;
+  }
+  // true when every value scheduled by start() was requested at least once
+  bool started_values_requested() const {
+    for (size_t i = 0; i < this->count_; i++) {
+      if (this->entries_[i].pending && this->entries_[i].first)
+        return false;
+    }
+    return true;
+  }
+  // the value arrived without being requested on its own, its next poll is one
+  // interval away, whether it was due already or not
+  void refreshed(SBPacket packet, uint32_t now) {
+    auto entry = this->find(packet);
+    if (entry == nullptr || !entry->pending)
+      return;
+    // same bookkeeping as if the value was polled now
+    this->take(*entry, now);
+  }
+  void make_due(SBPacket packet, uint32_t now) {
+    auto entry = this->find(packet);
+    if (entry != nullptr) {
+      entry->next_due = now;
+      entry->pending = true;
+    }
+  }
+  void mark_updated(SBPacket packet, uint32_t now) {
+    auto entry = this->find(packet);
+    if (entry != nullptr)
+      entry->last_update = now == 0 ? 1 : now;
+  }
+  const SBPollEntry *find(SBPacket packet) const {
+    for (size_t i = 0; i < this->count_; i++) {
+      if (this->entries_[i].packet == packet)
+        return &this->entries_[i];
+    }
+    return nullptr;
+  }
+  SBPollEntry *find(SBPacket packet) {
+    return const_cast<SBPollEntry *>(static_cast<const SBPoller *>(this)->find(packet));
+  }
+
+  size_t size() const { return this->count_; }
+  const SBPollEntry &at(size_t i) const { return this->entries_[i]; }
+
+ protected:
+  void take(SBPollEntry &entry, uint32_t now) {
+    if (entry.interval == 0) {
+      entry.pending = false;
+    } else {
+      entry.next_due = now + entry.interval;
+      if (entry.first)
+        entry.next_due += uint32_t((uint64_t(entry.interval) * this->phase_) >> 8);
+    }
+    entry.first = false;
+  }
+
+  std::array<SBPollEntry, MAX_ENTRIES> entries_{};
+  size_t count_ = 0;
+  uint8_t phase_ = 0;
+};
+
+}  // namespace sb
+}  // namespace esphome
@@ -0,0 +1,86 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace esphome {
+namespace sb {
+
+// energy to heat one liter of water by one degree, in Wh
+static const float SB_WATER_WH_PER_LITER_KELVIN = 1.163f;
+
+/**
+ * Estimates the power drawn by the water heater from samples of its
+ * lifetime energy counter. The counter has 1 Wh resolution, so the rate
+ * over a short interval is coarse; the heating element is resistive, so the
+ * rate measured while it was on all the time is averaged into the rated
+ * power, which stands for the power whenever the element is switched on.
+ */
+class SBPowerEstimator {
+ public:
+  // shorter intervals are merged with the next sample
+  static const uint32_t MIN_INTERVAL_S = 10;
+
+  void set_heating(bool heating, uint32_t now) {
+    if (heating != this->heating_) {
+      this->heating_ = heating;
+      this->transition_at_ = now;
+      this->transitions_++;
+    }
+  }
+  /**
+   * Add a counter sample: energy in Wh, timestamp of the water heater in
+   * seconds and millis(). Returns true when a rate was measured over an
+   * interval without a switch of the heating element.
+   */
+  bool add_sample(uint32_t wh, uint32_t device_time, uint32_t now) {
+    if (!this->has_sample_ || wh < this->wh_) {
+      this->store(wh, device_time, now);
+      return false;
+    }
+    uint32_t local_s = (now - this->now_) / 1000;
+    uint32_t device_s = device_time - this->device_time_;
+    // the device clock is preferred, unless it stands still, runs backwards or was set meanwhile
+    uint32_t interval = device_time > this->device_time_ && device_s <= 2 * local_s + MIN_INTERVAL_S ? device_s : local_s;
+    if (interval < MIN_INTERVAL_S)
+      return false;
+    bool steady = this->transitions_ == this->sample_transitions_;
+    this->rate_ = (wh - this->wh_) * 3600.0f / interval;
+    this->store(wh, device_time, now);
+    if (!steady)
+      return false;
+    if (this->heating_)
+      this->rated_power_ = this->rated_power_ == 0 ? this->rate_ : (3 * this->rated_power_ + this->rate_) / 4;
+    return true;
+  }
+
+  bool is_heating() const { return this->heating_; }
+  // millis() of the last switch of the heating element
+  uint32_t get_transition_at() const { return this->transition_at_; }
+  // average power over the last interval in W
+  float get_rate() const { return this->rate_; }
+  // power of the heating element in W, 0 until measured
+  float get_rated_power() const { return this->rated_power_; }
+
+ protected:
+  void store(uint32_t wh, uint32_t device_time, uint32_t now) {
+    this->has_sample_ = true;
+    this->wh_ = wh;
+    this->device_time_ = device_time;
+    this->now_ = now;
+    this->sample_transitions_ = this->transitions_;
+  }
+
+  bool heating_ = false;
+  uint32_t transition_at_ = 0;
+  uint32_t transitions_ = 0;
+  bool has_sample_ = false;
+  uint32_t wh_ = 0;
+  uint32_t device_time_ = 0;
+  uint32_t now_ = 0;
+  uint32_t sample_transitions_ = 0;
+  float rate_ = 0.0f;
+  float rated_power_ = 0.0f;
+};
+
+}  // namespace sb
+}  // namespace esphome
@@ -1,73 +1,158 @@
 #include "SBProtocol.h"
-#include "esphome/core/log.h"
+#include <array>
+#include <utility>
 
 namespace esphome {
 namespace sb {
 
-void SBProtocolRequest::write_le(uint8_t s) { this->mData.push_back(s); }
-
-// write value in Little Endian
-void SBProtocolRequest::write_le(uint16_t s) {
-  this->mData.push_back((uint8_t) (s & 255));
-  this->mData.push_back((uint8_t) (s >> 8));
+// binary reply formats of all packets, generated from their SBLayout
+struct SBReplyFormat {
+  uint8_t size;
+  uint8_t data_offset;
+};
+template<size_t... I> static constexpr std::array<SBReplyFormat, sizeof...(I)> make_reply_formats(std::index_sequence<I...>) {
+  return {{SBReplyFormat{uint8_t(SBLayout<SBPacket(I)>::REPLY_SIZE), uint8_t(SBLayout<SBPacket(I)>::DATA_OFFSET)}...}};
 }
+static constexpr auto REPLY_FORMATS = make_reply_formats(std::make_index_sequence<SB_PACKET_COUNT>());
 
-// write value in Little Endian
-void SBProtocolRequest::write_le(uint32_t s) {
-  this->mData.push_back((uint8_t) (s & 255));
-  this->mData.push_back((uint8_t) ((s >> 8) & 255));
-  this->mData.push_back((uint8_t) ((s >> 16) & 255));
-  this->mData.push_back((uint8_t) ((s >> 24) & 255));
+SBPacket sb_aggregate_of(SBPacket packet) {
+  for (auto field : SB_HOME_ALL_FIELDS) {
+    if (field == packet)
+      return SBPacket::SBC_PACKET_HOME_ALL;
+  }
+  for (auto field : SB_HDO_ALL_FIELDS) {
+    if (field == packet)
+      return SBPacket::SBC_PACKET_HDO_ALL;
+  }
+  return SBPacket::SBC_PACKET_NONE;
 }
 
 void SBProtocolRequest::writeString(const std::string &s) {
-  for (size_t i = 0; i < s.size(); i++) {
-    this->mData.push_back(s[i]);
+  for (char c : s) {
+    this->write_le(uint8_t(c));
+  }
+}
+
+bool SBProtocolRequest::is_coalescable() const {
+  switch (this->mRqType) {
+    case SBPacket::SBC_PACKET_HOME_SETNORMALTEMPERATURE:
+    case SBPacket::SBC_PACKET_HOME_SETMODE:
+    case SBPacket::SBC_PACKET_HOME_SETNORMALMODE:
+    case SBPacket::SBC_PACKET_HOME_SETTEMPNIGHT:
+    case SBPacket::SBC_PACKET_HOME_SETTEMPNIGHTLOW:
+    case SBPacket::SBC_PACKET_HOME_SETBOILERNAME:
+    case SBPacket::SBC_PACKET_HOME_SETCAPACITY:
+    case SBPacket::SBC_PACKET_HDO_SET_ONOFF:
+    case SBPacket::SBC_PACKET_HDO_SET_FREQUENCY:
+    case SBPacket::SBC_PACKET_HDO_SET_SELECTION_A:
+    case SBPacket::SBC_PACKET_HDO_SET_SELECTION_B:
+    case SBPacket::SBC_PACKET_HDO_SET_SELECTION_DP:
+    case SBPacket::SBC_PACKET_GLOBAL_PAIRPIN:
+      return true;
+    default:
+      return false;
   }
 }
 
-uint32_t SBProtocolResult::load_uint32_le(size_t position) {
-  uint32_t number;
-  number = this->mByteData[position];
-  number |= uint32_t(this->mByteData[position + 1]) << 8;
-  number |= uint32_t(this->mByteData[position + 2]) << 16;
-  number |= uint32_t(this->mByteData[position + 3]) << 24;
-  return number;
+bool SBProtocolRequest::is_query() const {
+  switch (this->mRqType) {
+    case SBPacket::SBC_PACKET_STATISTICS_GETALL:
+    case SBPacket::SBC_PACKET_STATISTICS_WEEK:
+    case SBPacket::SBC_PACKET_STATISTICS_YEAR:
+      return true;
+    case SBPacket::SBC_PACKET_GLOBAL_FIRSTLOG:
+    case SBPacket::SBC_PACKET_GLOBAL_NEXTLOG:
+      // every request returns another entry
+      return false;
+    default:
+      return this->is_read();
+  }
 }
 
-uint16_t SBProtocolResult::load_uint16_le(size_t position) {
-  uint16_t number;
-  number = this->mRawData[position];
-  number |= uint32_t(this->mRawData[position + 1]) << 8;
-  return number;
+bool SBProtocolRequest::same_payload(const SBProtocolRequest &other) const {
+  // skip packet type and UID
+  if (this->mRqType != other.mRqType || this->mSize != other.mSize)
+    return false;
+  for (uint8_t i = SB_REQUEST_HEADER_SIZE; i < this->mSize; i++) {
+    if (this->mData[i] != other.mData[i])
+      return false;
+  }
+  return true;
+}
+
+bool SBProtocolResult::parse_fixed(std::string_view text, uint8_t decimals, int32_t &value) {
+  size_t i = 0;
+  bool negative = false;
+  if (i < text.size() && (text[i] == '-' || text[i] == '+')) {
+    negative = text[i] == '-';
+    i++;
+  }
+  // wider than the result, so overflow can be detected before it happens
+  int64_t number = 0;
+  bool digits = false;
+  for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; i++) {
+    number = number * 10 + (text[i] - '0');
+    if (number > INT32_MAX)
+      return false;
+    digits = true;
+  }
+  uint8_t fraction = 0;
+  if (i < text.size() && text[i] == '.') {
+    for (i++; i < text.size() && text[i] >= '0' && text[i] <= '9'; i++) {
+      // extra digits are truncated
+      if (fraction < decimals) {
+        number = number * 10 + (text[i] - '0');
+        if (number > INT32_MAX)
+          return false;
+        fraction++;
+      }
+      digits = true;
+    }
+  }
+  // tolerate padding after the number
+  for (; i < text.size(); i++) {
+    if (text[i] != ' ' && text[i] != '\0')
+      return false;
+  }
+  if (!digits)
+    return false;
+  for (; fraction < decimals; fraction++) {
+    number *= 10;
+    if (number > INT32_MAX)
+      return false;
+  }
+  value = int32_t(negative ? -number : number);
+  return true;
 }
 
 SBProtocolResult::SBProtocolResult(const uint8_t *value, uint16_t value_len) {
+  this->mRawData = value;
+  this->mRawLength = value_len;
   // First two bytes contain a decimal value from SbcPacket as a string
+  if (value_len < SB_REPLY_ID_SIZE || value[0] < '0' || value[0] > '9' || value[1] < '0' || value[1] > '9')
+    return;
   SBPacket cmd = static_cast<SBPacket>((value[0] - '0') * 10 + (value[1] - '0'));
   this->mRqType = cmd;
-  this->mRawData = value;
-  int i = 0;
-  if (cmd == SBPacket::SBC_PACKET_NIGHT_GETDAYS) {
-    // copy next 12 bytes
-  } else if (cmd == SBPacket::SBC_PACKET_NIGHT_GETDAYS2) {
-    // copy next 9 bytes
-  } else if (cmd == SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID) {
-    // confirmation packet includes UID of original request
-    this->mUid = this->load_uint16_le(2);
-    while (i < 16) {
-      this->mByteData.push_back(value[i + 4]);
-      i++;
+  auto format = cmd < SB_PACKET_COUNT ? REPLY_FORMATS[cmd] : SBReplyFormat{0, 0};
+  SBPayload reply(value + SB_REPLY_ID_SIZE, value_len - SB_REPLY_ID_SIZE);
+  if (cmd == SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID) {
+    // without the UID it cannot be matched to a request
+    if (!reply.has<SBLayout<SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID>::Uid>()) {
+      this->mRqType = SBPacket::SBC_PACKET_NONE;
+      return;
     }
-  } else if (cmd == SBPacket::SBC_PACKET_HOLIDAY_GET || cmd == SBPacket::SBC_PACKET_GLOBAL_FIRSTLOG ||
-             cmd == SBPacket::SBC_PACKET_GLOBAL_NEXTLOG) {
-    // two uint32 located at index 2 and 10
-  } else {
-    // the rest is a string
-    std::string text(value + 2, value + value_len - 2);
-    this->mString = text;
+    this->mUid = reply.get<SBLayout<SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID>::Uid>();
+  }
+  if (format.size > 0) {
+    // longer replies are cut to the layout, shorter ones read as 0 past their end
+    size_t length = reply.size() < format.size ? reply.size() : format.size;
+    if (length > format.data_offset)
+      this->mPayload = SBPayload(reply.data() + format.data_offset, length - format.data_offset);
+  } else if (value_len > 4) {
+    // the rest is a string, without the two trailing bytes
+    this->mString = std::string_view(reinterpret_cast<const char *>(value + 2), value_len - 4);
   }
 }
 
 }  // namespace sb
-}  // namespace esphome
\ No newline at end of file
+}  // namespace esphome
@@ -2,6 +2,8 @@
 #include <vector>
 #include <stdint.h>
 #include <string>
+#include <string_view>
+#include "SBLayout.h"
 
 namespace esphome {
 namespace sb {
@@ -92,6 +94,25 @@ enum SBPacket : uint16_t {
   SBC_PACKET_STATISTICS_YEAR = 91,
 };
 
+// packet IDs are below this value
+static const uint16_t SB_PACKET_COUNT = 96;
+
+/**
+ * Aggregate replies carry the values of several packets as text separated by
+ * ';', in the order listed here. Firmware which does not know the aggregate
+ * packets is detected at runtime and read field by field instead.
+ */
+static const SBPacket SB_HOME_ALL_FIELDS[] = {
+    SBPacket::SBC_PACKET_HOME_MODE,    SBPacket::SBC_PACKET_HOME_HSRCSTATE,   SBPacket::SBC_PACKET_HOME_SENSOR1,
+    SBPacket::SBC_PACKET_HOME_SENSOR2, SBPacket::SBC_PACKET_HOME_TEMPERATURE,
+};
+static const SBPacket SB_HDO_ALL_FIELDS[] = {
+    SBPacket::SBC_PACKET_HDO_ONOFF,        SBPacket::SBC_PACKET_HDO_SELECTION_A, SBPacket::SBC_PACKET_HDO_SELECTION_B,
+    SBPacket::SBC_PACKET_HDO_SELECTION_DP, SBPacket::SBC_PACKET_HDO_FREQUENCY,   SBPacket::SBC_PACKET_HDO_SETTING,
+};
+// aggregate packet which includes the given value, SBC_PACKET_NONE if there is none
+SBPacket sb_aggregate_of(SBPacket packet);
+
 enum Mode: uint8_t {
   STOP = 0,
   // MANUAL/HDO is selected based on HDO setting in water heater
@@ -104,41 +125,211 @@ enum Mode: uint8_t {
   PROG = 6,
 };
 
+// Default ATT MTU is 23 bytes, 3 of them are taken by the write request header
+static const uint8_t SB_MAX_FRAME_SIZE = 20;
+// packet type and UID in front of the data of every request
+static const uint8_t SB_REQUEST_HEADER_SIZE = 4;
+// packet ID in front of the data of every reply, two decimal digits
+static const uint8_t SB_REPLY_ID_SIZE = 2;
+
+/**
+ * Binary replies of a packet: up to REPLY_SIZE bytes after the packet ID,
+ * their data starting at DATA_OFFSET. Packets answered with text have
+ * REPLY_SIZE 0.
+ */
+template<size_t Size, size_t DataOffset = 0> struct SBBinaryReply {
+  static_assert(DataOffset <= Size, "data must lie within the reply");
+  static constexpr size_t REPLY_SIZE = Size;
+  static constexpr size_t DATA_OFFSET = DataOffset;
+};
+using SBTextReply = SBBinaryReply<0>;
+
+/**
+ * Wire layout of a packet. Fields of replies count from the first byte of
+ * their data, fields of requests from the first byte after the request
+ * header. Packets without a specialization carry text.
+ */
+template<SBPacket P> struct SBLayout : SBTextReply {};
+
+// settings which take a single number
+struct SBSettingLayout : SBTextReply {
+  using Value = SBU32<0>;
+};
+template<> struct SBLayout<SBPacket::SBC_PACKET_HOME_SETNORMALTEMPERATURE> : SBSettingLayout {};
+template<> struct SBLayout<SBPacket::SBC_PACKET_HOME_SETMODE> : SBSettingLayout {};
+template<> struct SBLayout<SBPacket::SBC_PACKET_HDO_SET_ONOFF> : SBSettingLayout {};
+template<> struct SBLayout<SBPacket::SBC_PACKET_GLOBAL_PAIRPIN> : SBSettingLayout {};
+
+// UID of the confirmed request, followed by up to 16 bytes of data
+template<> struct SBLayout<SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID> : SBBinaryReply<18, 2> {
+  using Uid = SBU16<0>;
+};
+
+// answered by CONFIRMUID with the lifetime consumption in Wh and the device time of the reading
+template<> struct SBLayout<SBPacket::SBC_PACKET_STATISTICS_GETALL> : SBTextReply {
+  using Consumption = SBU32<0>;
+  using Time = SBU32<4>;
+};
+// request carries the index of a bucket, CONFIRMUID its consumption in Wh
+struct SBStatisticsBucketLayout : SBTextReply {
+  using Index = SBU32<0>;
+  using Consumption = SBU32<0>;
+};
+template<> struct SBLayout<SBPacket::SBC_PACKET_STATISTICS_WEEK> : SBStatisticsBucketLayout {};
+template<> struct SBLayout<SBPacket::SBC_PACKET_STATISTICS_YEAR> : SBStatisticsBucketLayout {};
+
+// entry of the event log: two uint32, assumed to be the time and the code of the event
+struct SBLogEntryLayout : SBBinaryReply<16> {
+  using Time = SBU32<0>;
+  using Code = SBU32<8>;
+};
+template<> struct SBLayout<SBPacket::SBC_PACKET_GLOBAL_FIRSTLOG> : SBLogEntryLayout {};
+template<> struct SBLayout<SBPacket::SBC_PACKET_GLOBAL_NEXTLOG> : SBLogEntryLayout {};
+// two uint32, assumed to be the start and the end of the holiday
+template<> struct SBLayout<SBPacket::SBC_PACKET_HOLIDAY_GET> : SBBinaryReply<16> {
+  using Start = SBU32<0>;
+  using End = SBU32<8>;
+};
+
+// PROG mode schedule, a 24-bit mask of hours per day
+template<> struct SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS> : SBBinaryReply<12> {
+  using Hours = SBArray<0, 3, 4>;
+};
+template<> struct SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS2> : SBBinaryReply<9> {
+  using Hours = SBArray<0, 3, 3>;
+};
+template<> struct SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAY> : SBTextReply {
+  using Day = SBU8<0>;
+  using Hours = SBArray<1, 3, 1>;
+};
+template<> struct SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS> : SBTextReply {
+  using Hours = SBArray<0, 3, 4>;
+};
+template<> struct SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS2> : SBTextReply {
+  using Hours = SBArray<0, 3, 3>;
+};
+
+/**
+ * Outgoing frame with inline storage. Requests are moved through the command
+ * queues, never copied, and building one does not touch the heap.
+ */
 class SBProtocolRequest {
  public:
-  SBProtocolRequest(SBPacket reqType) {
-    this->mRqType = reqType;
+  constexpr SBProtocolRequest() : mRqType(SBPacket::SBC_PACKET_NONE) {}
+  constexpr SBProtocolRequest(SBPacket reqType) : mRqType(reqType) {
     this->write_le(uint16_t(reqType));
     this->write_le(uint16_t(0));
   }
-  SBProtocolRequest(SBPacket reqType, uint16_t uid) {
-    this->mRqType = reqType;
-    this->mUid = uid;
+  constexpr SBProtocolRequest(SBPacket reqType, uint16_t uid) : mRqType(reqType), mUid(uid) {
     this->write_le(uint16_t(reqType));
     this->write_le(uid);
   }
+  SBProtocolRequest(const SBProtocolRequest &) = delete;
+  SBProtocolRequest &operator=(const SBProtocolRequest &) = delete;
+  SBProtocolRequest(SBProtocolRequest &&) = default;
+  SBProtocolRequest &operator=(SBProtocolRequest &&) = default;
 
-  void write_le(uint8_t s);
-  void write_le(uint16_t s);
-  void write_le(uint32_t s);
-  void write_le(uint64_t s);
+  constexpr void write_le(uint8_t s) {
+    if (this->mSize < SB_MAX_FRAME_SIZE)
+      this->mData[this->mSize++] = s;
+    else
+      this->mOverflow = true;
+  }
+  // write value in Little Endian
+  constexpr void write_le(uint16_t s) {
+    this->write_le(uint8_t(s & 255));
+    this->write_le(uint8_t(s >> 8));
+  }
+  // write value in Little Endian
+  constexpr void write_le(uint32_t s) {
+    this->write_le(uint16_t(s & 0xFFFF));
+    this->write_le(uint16_t(s >> 16));
+  }
+  // write value in Little Endian
+  constexpr void write_le(uint64_t s) {
+    this->write_le(uint32_t(s & 0xFFFFFFFF));
+    this->write_le(uint32_t(s >> 32));
+  }
   void writeString(const std::string &s);
+  // store a field of the packet layout, the request grows to cover it
+  template<typename F> constexpr void put(typename F::type value) {
+    static_assert(SB_REQUEST_HEADER_SIZE + F::END <= SB_MAX_FRAME_SIZE, "field does not fit into a frame");
+    F::encode(this->mData + SB_REQUEST_HEADER_SIZE, value);
+    this->cover(SB_REQUEST_HEADER_SIZE + F::END);
+  }
+  template<typename A> constexpr void put(size_t i, typename A::type value) {
+    static_assert(SB_REQUEST_HEADER_SIZE + A::END <= SB_MAX_FRAME_SIZE, "array does not fit into a frame");
+    if (i >= A::COUNT) {
+      this->mOverflow = true;
+      return;
+    }
+    A::encode(this->mData + SB_REQUEST_HEADER_SIZE, i, value);
+    this->cover(SB_REQUEST_HEADER_SIZE + A::end(i));
+  }
+  // data after the header
+  constexpr SBPayload payload() const {
+    return SBPayload(this->mData + SB_REQUEST_HEADER_SIZE,
+                     this->mSize > SB_REQUEST_HEADER_SIZE ? this->mSize - SB_REQUEST_HEADER_SIZE : 0);
+  }
+
+  constexpr const uint8_t *data() const { return this->mData; }
+  constexpr uint8_t size() const { return this->mSize; }
+  // true when more data was written than fits into a single frame
+  constexpr bool overflow() const { return this->mOverflow; }
+
+  // true for plain reads, which are answered by a packet of the same type
+  bool is_read() const { return this->mUid == 0 && this->mRqType != SBPacket::SBC_PACKET_RQ_GLOBAL_MAC; }
+  // true for setting commands where only the most recent value matters
+  bool is_coalescable() const;
+  // true for requests which only query data and have no side effects
+  bool is_query() const;
+  // true for event log reads, each of them moves the read position of the water heater
+  bool is_log_read() const {
+    return this->mRqType == SBPacket::SBC_PACKET_GLOBAL_FIRSTLOG || this->mRqType == SBPacket::SBC_PACKET_GLOBAL_NEXTLOG;
+  }
+  // true when both requests have the same type and the same data after the header
+  bool same_payload(const SBProtocolRequest &other) const;
 
-  std::vector<uint8_t> mData;
+  uint8_t mData[SB_MAX_FRAME_SIZE]{};
+  uint8_t mSize = 0;
+  bool mOverflow = false;
   SBPacket mRqType;
   uint16_t mUid = 0;
+  // millis() when the request entered the command queue, used for latency measurement
+  uint32_t mQueuedAt = 0;
+
+ protected:
+  constexpr void cover(uint8_t size) {
+    if (this->mSize < size)
+      this->mSize = size;
+  }
 };
 
+/**
+ * Decoded notification. The result borrows the notification buffer and must
+ * not outlive it; decoding does not allocate.
+ */
 class SBProtocolResult {
  public:
   SBProtocolResult(const uint8_t *value, uint16_t value_len);
-  SBPacket mRqType;
+  // single text value taken out of an aggregate reply
+  SBProtocolResult(SBPacket type, std::string_view text) : mRqType(type), mRawData(nullptr), mRawLength(0), mString(text) {}
+  SBPacket mRqType = SBPacket::SBC_PACKET_NONE;
   uint16_t mUid = 0;
-  std::vector<uint8_t> mByteData;
-  const uint8_t* mRawData;
-  std::string mString;
-  uint16_t load_uint16_le(size_t position);
-  uint32_t load_uint32_le(size_t position);
+  // data of binary replies, see SBLayout; for CONFIRMUID the data following the UID
+  SBPayload mPayload;
+  const uint8_t *mRawData;
+  uint16_t mRawLength;
+  // text payload of generic packets
+  std::string_view mString;
+  // field of the binary data, 0 when it did not arrive
+  template<typename F> constexpr typename F::type get() const { return this->mPayload.get<F>(); }
+  // parse mString as an integer
+  bool parse_int(int32_t &value) const { return parse_fixed(this->mString, 0, value); }
+  // parse mString as a decimal number scaled by 10^decimals, e.g. "52.5" -> 525
+  bool parse_fixed(uint8_t decimals, int32_t &value) const { return parse_fixed(this->mString, decimals, value); }
+
+  static bool parse_fixed(std::string_view text, uint8_t decimals, int32_t &value);
 };
 
 }  // namespace sb
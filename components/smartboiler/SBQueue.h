@@ -0,0 +1,345 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <functional>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include "SBProtocol.h"
+
+namespace esphome {
+namespace sb {
+
+/**
+ * Bounded FIFO with inline storage. Elements are moved in and out,
+ * push fails when the queue is full.
+ */
+template<typename T, size_t N> class SBRingQueue {
+ public:
+  bool push(T &&item) {
+    if (this->full())
+      return false;
+    this->items_[(this->head_ + this->count_) % N] = std::move(item);
+    this->count_++;
+    return true;
+  }
+  // removes and returns the oldest element, queue must not be empty
+  T pop() {
+    T item = std::move(this->items_[this->head_]);
+    this->head_ = (this->head_ + 1) % N;
+    this->count_--;
+    return item;
+  }
+  T &front() { return this->items_[this->head_]; }
+  // i-th element counted from the oldest one
+  T &at(size_t i) { return this->items_[(this->head_ + i) % N]; }
+  const T &at(size_t i) const { return this->items_[(this->head_ + i) % N]; }
+  void clear() {
+    this->head_ = 0;
+    this->count_ = 0;
+  }
+
+  size_t size() const { return this->count_; }
+  bool empty() const { return this->count_ == 0; }
+  bool full() const { return this->count_ == N; }
+  static constexpr size_t capacity() { return N; }
+
+ protected:
+  std::array<T, N> items_{};
+  size_t head_ = 0;
+  size_t count_ = 0;
+};
+
+// largest notification kept by SBNotifyRing, longer ones are dropped
+static const uint8_t SB_MAX_NOTIFY_SIZE = 32;
+
+// notification as received from the BLE stack, not decoded yet
+struct SBRawFrame {
+  uint16_t length = 0;
+  // connection the frame arrived on, frames of older connections are stale
+  uint8_t epoch = 0;
+  uint8_t data[SB_MAX_NOTIFY_SIZE]{};
+};
+
+/**
+ * Single-producer/single-consumer ring of raw notifications. The BLE
+ * callback only copies the frame in; decoding runs later in loop(). The
+ * producer owns head_ and the consumer tail_, so neither side needs a lock.
+ * Frames which do not fit are counted and dropped.
+ */
+template<size_t N> class SBNotifyRing {
+  static_assert((N & (N - 1)) == 0, "size must be a power of two");
+
+ public:
+  // producer side
+  bool push(const uint8_t *data, uint16_t length, uint8_t epoch) {
+    size_t head = this->head_.load(std::memory_order_relaxed);
+    if (length > SB_MAX_NOTIFY_SIZE || head - this->tail_.load(std::memory_order_acquire) == N) {
+      this->overflows_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    auto &frame = this->frames_[head % N];
+    // an empty notification may come without a buffer
+    if (length > 0)
+      memcpy(frame.data, data, length);
+    frame.length = length;
+    frame.epoch = epoch;
+    this->head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  // consumer side, the frame stays valid until pop()
+  const SBRawFrame *peek() const {
+    size_t tail = this->tail_.load(std::memory_order_relaxed);
+    if (tail == this->head_.load(std::memory_order_acquire))
+      return nullptr;
+    return &this->frames_[tail % N];
+  }
+  void pop() { this->tail_.store(this->tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  size_t size() const {
+    return this->head_.load(std::memory_order_acquire) - this->tail_.load(std::memory_order_acquire);
+  }
+  uint32_t overflows() const { return this->overflows_.load(std::memory_order_relaxed); }
+  static constexpr size_t capacity() { return N; }
+
+ protected:
+  std::array<SBRawFrame, N> frames_{};
+  // free-running counters, the slot is the counter modulo N
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+  std::atomic<uint32_t> overflows_{0};
+};
+
+// how a request ended
+enum class SBCompletion : uint8_t {
+  // a read was answered by a packet of its type
+  REPLIED,
+  // CONFIRMUID arrived, possibly with data
+  CONFIRMED,
+  // the water heater answered HOME_ERROR
+  REJECTED,
+  // no answer after all retransmissions
+  TIMED_OUT,
+  // dropped before completion: queue full, replaced by a newer setting or disconnected
+  CANCELLED,
+};
+
+/**
+ * Called once when a request ends. The result is the decoded reply for
+ * REPLIED, CONFIRMED and REJECTED, nullptr otherwise; it is only valid
+ * during the call.
+ */
+using SBCompletionHandler = std::function<void(SBCompletion status, const SBProtocolResult *result)>;
+
+/**
+ * Handlers of one request, called in the order they were added. A duplicate
+ * query joins the request already queued or in flight; the slots are inline,
+ * so joining does not allocate. Moving leaves the source empty.
+ */
+class SBCompletionHandlers {
+ public:
+  static constexpr size_t SLOTS = 2;
+
+  SBCompletionHandlers() = default;
+  SBCompletionHandlers(SBCompletionHandler &&handler) { this->add(std::move(handler)); }
+  SBCompletionHandlers(SBCompletionHandlers &&other) noexcept { *this = std::move(other); }
+  SBCompletionHandlers &operator=(SBCompletionHandlers &&other) noexcept {
+    if (this != &other) {
+      for (size_t i = 0; i < SLOTS; i++) {
+        this->handlers_[i] = std::move(other.handlers_[i]);
+        other.handlers_[i] = nullptr;
+      }
+      this->count_ = other.count_;
+      other.count_ = 0;
+    }
+    return *this;
+  }
+
+  // false when every slot is taken, the handler is then left untouched; an empty handler needs no slot
+  bool add(SBCompletionHandler &&handler) {
+    if (!handler)
+      return true;
+    if (this->full())
+      return false;
+    this->handlers_[this->count_++] = std::move(handler);
+    return true;
+  }
+  void operator()(SBCompletion status, const SBProtocolResult *result) const {
+    for (size_t i = 0; i < this->count_; i++)
+      this->handlers_[i](status, result);
+  }
+  explicit operator bool() const { return this->count_ > 0; }
+  bool full() const { return this->count_ == SLOTS; }
+  void clear() {
+    for (size_t i = 0; i < this->count_; i++)
+      this->handlers_[i] = nullptr;
+    this->count_ = 0;
+  }
+
+ protected:
+  std::array<SBCompletionHandler, SLOTS> handlers_{};
+  uint8_t count_ = 0;
+};
+
+// request waiting in the command queue
+struct SBCommand {
+  SBProtocolRequest request;
+  SBCompletionHandlers on_done;
+};
+
+// request sent to the water heater which still waits for its confirmation or reply
+struct SBPendingRequest {
+  SBProtocolRequest request;
+  SBCompletionHandlers on_done;
+  // millis() of the last transmission
+  uint32_t sent_at = 0;
+  uint32_t deadline = 0;
+  // number of transmissions so far
+  uint8_t attempts = 0;
+  bool active = false;
+};
+
+/**
+ * Fixed-size table of in-flight requests. Requests with UID are matched by
+ * CONFIRMUID, plain reads by the type of the reply. N is small, so lookups
+ * are a scan over a constant number of slots.
+ */
+template<size_t N> class SBPendingTable {
+ public:
+  SBPendingRequest *insert(SBCommand &&command, uint32_t now, uint32_t timeout) {
+    for (auto &slot : this->slots_) {
+      if (!slot.active) {
+        slot.request = std::move(command.request);
+        slot.on_done = std::move(command.on_done);
+        slot.sent_at = now;
+        slot.deadline = now + timeout;
+        slot.attempts = 1;
+        slot.active = true;
+        this->count_++;
+        return &slot;
+      }
+    }
+    return nullptr;
+  }
+  SBPendingRequest *find_uid(uint16_t uid) {
+    for (auto &slot : this->slots_) {
+      if (slot.active && slot.request.mUid == uid)
+        return &slot;
+    }
+    return nullptr;
+  }
+  SBPendingRequest *find_read(SBPacket type) {
+    for (auto &slot : this->slots_) {
+      if (slot.active && slot.request.is_read() && slot.request.mRqType == type)
+        return &slot;
+    }
+    return nullptr;
+  }
+  // request of the same type carrying the same data
+  SBPendingRequest *find_same(const SBProtocolRequest &request) {
+    for (auto &slot : this->slots_) {
+      if (slot.active && slot.request.same_payload(request))
+        return &slot;
+    }
+    return nullptr;
+  }
+  // setting in flight, nullptr when there is none
+  SBPendingRequest *find_coalescable() {
+    for (auto &slot : this->slots_) {
+      if (slot.active && slot.request.is_coalescable())
+        return &slot;
+    }
+    return nullptr;
+  }
+  // any request in flight, nullptr when there is none
+  SBPendingRequest *find_active() {
+    for (auto &slot : this->slots_) {
+      if (slot.active)
+        return &slot;
+    }
+    return nullptr;
+  }
+  // first request whose deadline has passed
+  SBPendingRequest *find_expired(uint32_t now) {
+    for (auto &slot : this->slots_) {
+      if (slot.active && int32_t(now - slot.deadline) >= 0)
+        return &slot;
+    }
+    return nullptr;
+  }
+  void release(SBPendingRequest *slot) {
+    slot->active = false;
+    slot->on_done.clear();
+    this->count_--;
+  }
+  void clear() {
+    for (auto &slot : this->slots_) {
+      slot.active = false;
+      slot.on_done.clear();
+    }
+    this->count_ = 0;
+  }
+
+  size_t size() const { return this->count_; }
+  bool full() const { return this->count_ == N; }
+
+ protected:
+  std::array<SBPendingRequest, N> slots_{};
+  size_t count_ = 0;
+};
+
+/**
+ * Paces requests sent to the water heater. Up to max_in_flight requests may
+ * wait for their reply at the same time; the gap between two transmissions
+ * follows the smoothed round-trip time and grows after error replies.
+ */
+class SBFlowControl {
+ public:
+  static const uint32_t MIN_GAP = 20;
+  static const uint32_t MAX_GAP = 1000;
+  static const uint32_t INITIAL_GAP = 100;
+
+  void set_max_in_flight(uint8_t max_in_flight) { this->max_in_flight_ = max_in_flight; }
+  uint8_t get_max_in_flight() const { return this->max_in_flight_; }
+
+  bool can_send(uint32_t now, uint32_t last_sent, size_t in_flight) const {
+    return in_flight < this->max_in_flight_ && now - last_sent >= this->gap_;
+  }
+  // a request was answered after rtt milliseconds
+  void on_reply(uint32_t rtt) {
+    this->completed_++;
+    // smoothed RTT with gain 1/8, as in TCP
+    this->srtt_ = this->srtt_ == 0 ? rtt : (7 * this->srtt_ + rtt) / 8;
+    this->gap_ = clamp_gap(this->srtt_ / this->max_in_flight_);
+  }
+  // the water heater rejected a request, slow down
+  void on_error() { this->gap_ = clamp_gap(this->gap_ * 2); }
+  void reset() {
+    this->srtt_ = 0;
+    this->gap_ = INITIAL_GAP;
+  }
+  // completed requests per second since the previous call
+  float take_throughput(uint32_t now) {
+    uint32_t elapsed = now - this->window_start_;
+    float throughput = elapsed ? this->completed_ * 1000.0f / elapsed : 0.0f;
+    this->window_start_ = now;
+    this->completed_ = 0;
+    return throughput;
+  }
+
+  uint32_t get_gap() const { return this->gap_; }
+  uint32_t get_srtt() const { return this->srtt_; }
+
+ protected:
+  static uint32_t clamp_gap(uint32_t gap) { return gap < MIN_GAP ? MIN_GAP : (gap > MAX_GAP ? MAX_GAP : gap); }
+
+  uint8_t max_in_flight_ = 2;
+  uint32_t gap_ = INITIAL_GAP;
+  uint32_t srtt_ = 0;
+  uint32_t completed_ = 0;
+  uint32_t window_start_ = 0;
+};
+
+}  // namespace sb
+}  // namespace esphome
@@ -0,0 +1,182 @@
+#pragma once
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string_view>
+#include "SBProtocol.h"
+
+namespace esphome {
+namespace sb {
+
+static const uint8_t SB_SCHEDULE_DAYS = 7;
+// days carried by NIGHT_GETDAYS/SAVEDAYS, the others by NIGHT_GETDAYS2/SAVEDAYS2
+static const uint8_t SB_SCHEDULE_FIRST_PART_DAYS = 4;
+// each day is a 24-bit mask, bit h set when heating is allowed in hour h
+static const uint32_t SB_SCHEDULE_ALL_HOURS = 0xFFFFFF;
+static_assert(SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS>::Hours::COUNT == SB_SCHEDULE_FIRST_PART_DAYS &&
+                  SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS>::Hours::COUNT == SB_SCHEDULE_FIRST_PART_DAYS,
+              "first part of the schedule does not match the packet layout");
+static_assert(SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS2>::Hours::COUNT ==
+                      SB_SCHEDULE_DAYS - SB_SCHEDULE_FIRST_PART_DAYS &&
+                  SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS2>::Hours::COUNT ==
+                      SB_SCHEDULE_DAYS - SB_SCHEDULE_FIRST_PART_DAYS,
+              "second part of the schedule does not match the packet layout");
+
+// frame which writes one or more days of the schedule
+struct SBScheduleWrite {
+  SBPacket packet = SBPacket::SBC_PACKET_NONE;
+  uint8_t first_day = 0;
+  uint8_t count = 0;
+};
+
+/**
+ * Weekly schedule of PROG mode (day 0 is Monday) as read from the water
+ * heater and as requested by the user. Writes are planned from the
+ * difference of both: a part of the week with two or more changed days is
+ * written by one SAVEDAYS/SAVEDAYS2 frame, a single changed day by SAVEDAY.
+ */
+class SBSchedule {
+ public:
+  // hours of a day read from the water heater
+  void on_read(uint8_t day, uint32_t hours) {
+    if (day >= SB_SCHEDULE_DAYS)
+      return;
+    hours &= SB_SCHEDULE_ALL_HOURS;
+    uint8_t bit = 1 << day;
+    this->device_[day] = hours;
+    this->known_ |= bit;
+    if (this->writing_ & bit) {
+      this->writing_ &= ~bit;
+      // the water heater did not take the value, do not try again
+      if (this->desired_[day] != hours)
+        this->rejected_ = true;
+      this->desired_[day] = hours;
+      this->dirty_ &= ~bit;
+    } else if (!(this->dirty_ & bit)) {
+      this->desired_[day] = hours;
+    } else if (this->desired_[day] == hours) {
+      this->dirty_ &= ~bit;
+    }
+  }
+  // hours of a day requested by the user, false for an invalid day
+  bool set(uint8_t day, uint32_t hours) {
+    if (day >= SB_SCHEDULE_DAYS)
+      return false;
+    hours &= SB_SCHEDULE_ALL_HOURS;
+    uint8_t bit = 1 << day;
+    this->desired_[day] = hours;
+    if ((this->known_ & bit) && this->device_[day] == hours)
+      this->dirty_ &= ~bit;
+    else
+      this->dirty_ |= bit;
+    return true;
+  }
+  // fills writes with the frames needed to apply the changes, returns their count
+  size_t plan(SBScheduleWrite *writes) {
+    size_t count = 0;
+    count += this->plan_part(writes + count, 0, SB_SCHEDULE_FIRST_PART_DAYS, SBPacket::SBC_PACKET_NIGHT_SAVEDAYS);
+    count += this->plan_part(writes + count, SB_SCHEDULE_FIRST_PART_DAYS, SB_SCHEDULE_DAYS - SB_SCHEDULE_FIRST_PART_DAYS,
+                             SBPacket::SBC_PACKET_NIGHT_SAVEDAYS2);
+    this->writing_ |= this->dirty_;
+    this->dirty_ = 0;
+    return count;
+  }
+
+  // writes lost with the connection are repeated
+  void retry_writes() {
+    this->dirty_ |= this->writing_;
+    this->writing_ = 0;
+  }
+  bool has_changes() const { return this->dirty_ != 0; }
+  bool complete() const { return this->known_ == (1 << SB_SCHEDULE_DAYS) - 1; }
+  // true when the last read returned something else than was written
+  bool take_rejected() {
+    bool rejected = this->rejected_;
+    this->rejected_ = false;
+    return rejected;
+  }
+  // requested hours of the day, same as the water heater's when no change is pending
+  uint32_t get(uint8_t day) const { return this->desired_[day]; }
+
+  // parses hours like "0-5,13,22-23", false on a syntax error or an hour above 23
+  static bool parse_hours(std::string_view text, uint32_t &hours) {
+    hours = 0;
+    size_t i = 0;
+    while (i < text.size()) {
+      int first = -1, last;
+      if (!parse_hour(text, i, first))
+        return false;
+      last = first;
+      if (i < text.size() && text[i] == '-') {
+        i++;
+        if (!parse_hour(text, i, last) || last < first)
+          return false;
+      }
+      for (int h = first; h <= last; h++)
+        hours |= 1u << h;
+      if (i == text.size())
+        break;
+      // a comma must be followed by another hour, "0-5," is an error
+      if (text[i] != ',' || ++i == text.size())
+        return false;
+    }
+    return true;
+  }
+  // writes hours in the format accepted by parse_hours, returns the length
+  static size_t format_hours(uint32_t hours, char *buffer, size_t size) {
+    size_t pos = 0;
+    buffer[0] = 0;
+    for (int h = 0; h < 24 && pos < size; h++) {
+      if (!(hours & (1u << h)))
+        continue;
+      int last = h;
+      while (last < 23 && (hours & (1u << (last + 1))))
+        last++;
+      int written = last == h ? snprintf(buffer + pos, size - pos, "%s%d", pos ? "," : "", h)
+                              : snprintf(buffer + pos, size - pos, "%s%d-%d", pos ? "," : "", h, last);
+      pos += written > 0 ? written : 0;
+      h = last;
+    }
+    return pos < size ? pos : size - 1;
+  }
+
+ protected:
+  size_t plan_part(SBScheduleWrite *writes, uint8_t first, uint8_t days, SBPacket whole_part) {
+    uint8_t mask = ((1 << days) - 1) << first;
+    uint8_t changed = this->dirty_ & mask;
+    if (changed == 0)
+      return 0;
+    // a whole part can only be written when the other days of it are known
+    uint8_t changes = __builtin_popcount(changed);
+    if (changes >= 2 && ((this->known_ | changed) & mask) == mask) {
+      writes[0] = {whole_part, first, days};
+      return 1;
+    }
+    size_t count = 0;
+    for (uint8_t day = first; day < first + days; day++) {
+      if (changed & (1 << day))
+        writes[count++] = {SBPacket::SBC_PACKET_NIGHT_SAVEDAY, day, 1};
+    }
+    return count;
+  }
+  static bool parse_hour(std::string_view text, size_t &i, int &hour) {
+    size_t start = i;
+    hour = 0;
+    for (; i < text.size() && text[i] >= '0' && text[i] <= '9' && i - start < 2; i++)
+      hour = hour * 10 + (text[i] - '0');
+    return i > start && hour < 24;
+  }
+
+  std::array<uint32_t, SB_SCHEDULE_DAYS> device_{};
+  std::array<uint32_t, SB_SCHEDULE_DAYS> desired_{};
+  uint8_t known_ = 0;
+  // days changed by the user and not written yet
+  uint8_t dirty_ = 0;
+  // days written and not read back yet
+  uint8_t writing_ = 0;
+  bool rejected_ = false;
+};
+
+}  // namespace sb
+}  // namespace esphome
@@ -0,0 +1,84 @@
+#pragma once
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include "SBProtocol.h"
+
+namespace esphome {
+namespace sb {
+
+// one bucket of STATISTICS_WEEK or STATISTICS_YEAR waiting to be requested
+struct SBHistoryRequest {
+  SBPacket packet = SBPacket::SBC_PACKET_NONE;
+  uint8_t index = 0;
+};
+
+/**
+ * Energy consumed in each period of a cycle (days of a week, months of a
+ * year) in Wh. The water heater adds consumption to the bucket of the
+ * current period and starts over in the next bucket when a new period
+ * begins. Once the current bucket is known, a refresh reads only that one
+ * and the next; a change of the next bucket means a new period has started.
+ * The current bucket is learned as the one that changed between two full
+ * refreshes.
+ */
+template<size_t N> class SBConsumptionHistory {
+  static_assert(N <= 16, "known buckets are tracked in 16 bits");
+
+ public:
+  static const size_t UNKNOWN = N;
+
+  // fills indexes with the buckets to read, returns their count
+  size_t start_refresh(uint8_t *indexes) {
+    // consumption grew, but the last refresh found no change in the buckets it read
+    if (this->current_ != UNKNOWN && this->refreshing_ && !this->changed_)
+      this->current_ = UNKNOWN;
+    this->refreshing_ = true;
+    this->changed_ = false;
+    if (this->current_ == UNKNOWN) {
+      for (size_t i = 0; i < N; i++)
+        indexes[i] = i;
+      return N;
+    }
+    indexes[0] = this->current_;
+    indexes[1] = (this->current_ + 1) % N;
+    return 2;
+  }
+  void update(size_t index, uint32_t wh) {
+    if (index >= N)
+      return;
+    bool changed = this->is_known(index) && this->values_[index] != wh;
+    this->values_[index] = wh;
+    this->known_ |= 1u << index;
+    if (!changed)
+      return;
+    this->changed_ = true;
+    if (this->current_ == UNKNOWN || index == (this->current_ + 1) % N)
+      this->current_ = index;
+  }
+
+  bool is_known(size_t index) const { return this->known_ & (1u << index); }
+  bool complete() const { return this->known_ == (1u << N) - 1; }
+  bool has_current() const { return this->current_ != UNKNOWN; }
+  // consumption of the current period, valid when has_current()
+  uint32_t current() const { return this->values_[this->current_]; }
+  uint32_t get(size_t index) const { return this->values_[index]; }
+  // consumption of the whole cycle, valid when complete()
+  uint32_t total() const {
+    uint32_t sum = 0;
+    for (auto value : this->values_)
+      sum += value;
+    return sum;
+  }
+  static constexpr size_t size() { return N; }
+
+ protected:
+  std::array<uint32_t, N> values_{};
+  uint16_t known_ = 0;
+  size_t current_ = UNKNOWN;
+  bool refreshing_ = false;
+  bool changed_ = false;
+};
+
+}  // namespace sb
+}  // namespace esphome
@@ -0,0 +1,82 @@
+#pragma once
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace esphome {
+namespace sb {
+
+static const uint32_t SB_WEEK_SECONDS = 7 * 24 * 3600;
+static const uint32_t SB_TARIFF_SLOT_SECONDS = 15 * 60;
+static const uint16_t SB_TARIFF_SLOTS = SB_WEEK_SECONDS / SB_TARIFF_SLOT_SECONDS;
+
+/**
+ * Weekly model of the HDO tariff in quarter-hour slots, learned from the
+ * tariff observed by the water heater. HDO switching times repeat every
+ * week, so once each slot was seen twice with the same tariff, the model
+ * predicts the tariff and its edges without asking the water heater.
+ *
+ * Each slot is a 4-bit counter: 0 never observed, 1 high tariff for sure,
+ * 2 probably high, 3 probably low, 4 low tariff for sure.
+ */
+class SBTariffModel {
+ public:
+  // slot of a time given in seconds since Monday 0:00
+  static uint16_t slot_of(uint32_t week_seconds) { return (week_seconds % SB_WEEK_SECONDS) / SB_TARIFF_SLOT_SECONDS; }
+  // number of slots from one to another, going forward through the week
+  static uint16_t distance(uint16_t from, uint16_t to) { return (to + SB_TARIFF_SLOTS - from) % SB_TARIFF_SLOTS; }
+
+  // the tariff was observed in all slots from first to last, inclusive
+  void observe(uint16_t first, uint16_t last, bool low) {
+    for (uint16_t slot = first;; slot = (slot + 1) % SB_TARIFF_SLOTS) {
+      uint8_t counter = this->get(slot);
+      if (counter == 0)
+        counter = low ? 3 : 2;
+      else if (low)
+        counter = counter < 4 ? counter + 1 : 4;
+      else
+        counter = counter > 1 ? counter - 1 : 1;
+      this->set(slot, counter);
+      if (slot == last)
+        break;
+    }
+    this->dirty_ = true;
+  }
+  void clear() {
+    this->slots_.fill(0);
+    this->dirty_ = true;
+  }
+
+  bool is_known(uint16_t slot) const { return this->get(slot) != 0; }
+  bool is_confident(uint16_t slot) const { return this->get(slot) == 1 || this->get(slot) == 4; }
+  bool predict_low(uint16_t slot) const { return this->get(slot) >= 3; }
+  // share of confidently predicted slots, in percent
+  uint8_t coverage() const {
+    uint16_t confident = 0;
+    for (uint16_t slot = 0; slot < SB_TARIFF_SLOTS; slot++)
+      confident += this->is_confident(slot);
+    return confident * 100 / SB_TARIFF_SLOTS;
+  }
+
+  // true once after each change
+  bool take_dirty() {
+    bool dirty = this->dirty_;
+    this->dirty_ = false;
+    return dirty;
+  }
+  // packed counters, for storing in flash
+  std::array<uint8_t, SB_TARIFF_SLOTS / 2> &data() { return this->slots_; }
+
+ protected:
+  uint8_t get(uint16_t slot) const { return (this->slots_[slot / 2] >> ((slot % 2) * 4)) & 0x0F; }
+  void set(uint16_t slot, uint8_t counter) {
+    uint8_t shift = (slot % 2) * 4;
+    this->slots_[slot / 2] = (this->slots_[slot / 2] & ~(0x0F << shift)) | (counter << shift);
+  }
+
+  std::array<uint8_t, SB_TARIFF_SLOTS / 2> slots_{};
+  bool dirty_ = false;
+};
+
+}  // namespace sb
+}  // namespace esphome
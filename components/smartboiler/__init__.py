@@ -1,22 +1,33 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
+import esphome.final_validate as fv
+from esphome import automation
+from esphome.core import CORE
 from esphome.components import (
     ble_client, sensor,
     select, binary_sensor,
     climate, number, text_sensor
 )
 from esphome.const import (
-    CONF_ID,CONF_STATE, CONF_PIN,
+    CONF_ID,CONF_STATE, CONF_PIN, CONF_TRIGGER_ID,
     CONF_VERSION, UNIT_CELSIUS,
     ICON_THERMOMETER, ICON_FLASH,
     ENTITY_CATEGORY_DIAGNOSTIC,
     UNIT_KILOWATT_HOURS,
     STATE_CLASS_TOTAL_INCREASING,
-    DEVICE_CLASS_ENERGY
+    STATE_CLASS_TOTAL,
+    DEVICE_CLASS_ENERGY,
+    UNIT_MILLISECOND,
+    UNIT_WATT,
+    DEVICE_CLASS_POWER,
+    STATE_CLASS_MEASUREMENT
 )
 
 AUTO_LOAD = ["sensor", "binary_sensor", "select", "climate", "esp32_ble_tracker", "number", "text_sensor"]
-MULTI_CONF = 3
+# keep in sync with MAX_INSTANCES in smartboiler.h
+MULTI_CONF = 8
+# BLE connections the ESP32 keeps open unless esp32_ble_tracker says otherwise
+DEFAULT_MAX_CONNECTIONS = 3
 
 CONF_TEMP1 = 'temp1'
 CONF_TEMP2 = 'temp2'
@@ -26,6 +37,39 @@ CONF_HEAT_ON = 'heat_on'
 CONF_THERMOSTAT = 'thermostat'
 CONF_CONSUMPTION = 'consumption'
 CONF_BNAME = "b_name"
+CONF_REQUEST_TIMEOUT = "request_timeout"
+CONF_MAX_RETRIES = "max_retries"
+CONF_MAX_IN_FLIGHT = "max_in_flight"
+CONF_PUBLISH_DEADBAND = "publish_deadband"
+CONF_STATE_POLL_INTERVAL = "state_poll_interval"
+CONF_TEMPERATURE_POLL_INTERVAL = "temperature_poll_interval"
+CONF_SETTINGS_POLL_INTERVAL = "settings_poll_interval"
+CONF_ROTATION = "rotation"
+CONF_BULK_READS = "bulk_reads"
+CONF_ROTATION_BUDGET = "rotation_budget"
+CONF_LAST_EVENT = "last_event"
+CONF_ENERGY_TODAY = "energy_today"
+CONF_ENERGY_WEEK = "energy_week"
+CONF_ENERGY_MONTH = "energy_month"
+CONF_ENERGY_YEAR = "energy_year"
+CONF_POWER = "power"
+CONF_CYCLE_ENERGY = "cycle_energy"
+CONF_HEATING_POLL_INTERVAL = "heating_poll_interval"
+CONF_HDO_CHECK_INTERVAL = "hdo_check_interval"
+CONF_DIAGNOSTICS = "diagnostics"
+CONF_PACKET_CAPTURE = "packet_capture"
+CONF_SCHEDULE = "schedule"
+CONF_DAY = "day"
+CONF_HOURS = "hours"
+CONF_RTT = "rtt"
+CONF_HOME_ERRORS = "home_errors"
+CONF_WRITE_FAILURES = "write_failures"
+CONF_UNMATCHED_CONFIRMS = "unmatched_confirms"
+CONF_RECONNECTS = "reconnects"
+CONF_QUEUE_PEAK = "queue_peak"
+CONF_ROLLBACKS = "rollbacks"
+CONF_ON_LOG_ENTRY = "on_log_entry"
+CONF_MAX_CONNECTIONS = "max_connections"
 
 smartboiler_controller_ns = cg.esphome_ns.namespace('sb')
 
@@ -35,6 +79,32 @@ SmartBoiler = smartboiler_controller_ns.class_(
 SmartBoilerModeSelect = smartboiler_controller_ns.class_('SmartBoilerModeSelect', select.Select)
 SmartBoilerThermostat = smartboiler_controller_ns.class_('SmartBoilerThermostat', climate.Climate)
 SmartBoilerPinInput = smartboiler_controller_ns.class_('SmartBoilerPinInput', number.Number)
+SmartBoilerDumpCaptureAction = smartboiler_controller_ns.class_('SmartBoilerDumpCaptureAction', automation.Action)
+SmartBoilerSetScheduleAction = smartboiler_controller_ns.class_('SmartBoilerSetScheduleAction', automation.Action)
+SmartBoilerLogEntryTrigger = smartboiler_controller_ns.class_(
+    'SmartBoilerLogEntryTrigger', automation.Trigger.template(cg.uint32, cg.uint32))
+
+def diagnostic_counter_schema():
+    return sensor.sensor_schema(
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_TOTAL_INCREASING,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC)
+
+DIAGNOSTICS_SCHEMA = cv.Schema({
+    cv.Optional(CONF_RTT): sensor.sensor_schema(
+        unit_of_measurement=UNIT_MILLISECOND,
+        icon="mdi:timer-outline",
+        accuracy_decimals=0,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+    cv.Optional(CONF_HOME_ERRORS): diagnostic_counter_schema(),
+    cv.Optional(CONF_WRITE_FAILURES): diagnostic_counter_schema(),
+    cv.Optional(CONF_UNMATCHED_CONFIRMS): diagnostic_counter_schema(),
+    cv.Optional(CONF_RECONNECTS): diagnostic_counter_schema(),
+    cv.Optional(CONF_ROLLBACKS): diagnostic_counter_schema(),
+    cv.Optional(CONF_QUEUE_PEAK): sensor.sensor_schema(
+        accuracy_decimals=0,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+})
 
 CONFIG_SCHEMA = cv.polling_component_schema('600s').extend({
     cv.GenerateID(): cv.declare_id(SmartBoiler),
@@ -54,31 +124,185 @@ CONFIG_SCHEMA = cv.polling_component_schema('600s').extend({
     cv.Optional(CONF_STATE, {"name": "State", "icon": "mdi:connection" }): text_sensor.text_sensor_schema().extend(),
     cv.Optional(CONF_VERSION, {"name": "Version", "entity_category": ENTITY_CATEGORY_DIAGNOSTIC }): text_sensor.text_sensor_schema().extend(),
     cv.Optional(CONF_BNAME, {"name": "Name" }): text_sensor.text_sensor_schema().extend(),
+    cv.Optional(CONF_SCHEDULE): text_sensor.text_sensor_schema(icon="mdi:calendar-clock").extend(),
+    cv.Optional(CONF_LAST_EVENT): text_sensor.text_sensor_schema(icon="mdi:history").extend(),
+    cv.Optional(CONF_ON_LOG_ENTRY): automation.validate_automation({
+        cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(SmartBoilerLogEntryTrigger),
+    }),
     cv.Optional(CONF_CONSUMPTION, {"name": "Energy"}): sensor.sensor_schema(
             unit_of_measurement=UNIT_KILOWATT_HOURS,
             icon=ICON_FLASH,
             accuracy_decimals=3,
             state_class=STATE_CLASS_TOTAL_INCREASING,
             device_class=DEVICE_CLASS_ENERGY).extend(),
+    cv.Optional(CONF_ENERGY_TODAY): sensor.sensor_schema(
+            unit_of_measurement=UNIT_KILOWATT_HOURS,
+            icon=ICON_FLASH,
+            accuracy_decimals=3,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            device_class=DEVICE_CLASS_ENERGY).extend(),
+    cv.Optional(CONF_ENERGY_WEEK): sensor.sensor_schema(
+            unit_of_measurement=UNIT_KILOWATT_HOURS,
+            icon=ICON_FLASH,
+            accuracy_decimals=3,
+            state_class=STATE_CLASS_TOTAL,
+            device_class=DEVICE_CLASS_ENERGY).extend(),
+    cv.Optional(CONF_ENERGY_MONTH): sensor.sensor_schema(
+            unit_of_measurement=UNIT_KILOWATT_HOURS,
+            icon=ICON_FLASH,
+            accuracy_decimals=3,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            device_class=DEVICE_CLASS_ENERGY).extend(),
+    cv.Optional(CONF_ENERGY_YEAR): sensor.sensor_schema(
+            unit_of_measurement=UNIT_KILOWATT_HOURS,
+            icon=ICON_FLASH,
+            accuracy_decimals=3,
+            state_class=STATE_CLASS_TOTAL,
+            device_class=DEVICE_CLASS_ENERGY).extend(),
+    cv.Optional(CONF_POWER): sensor.sensor_schema(
+            unit_of_measurement=UNIT_WATT,
+            icon=ICON_FLASH,
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_MEASUREMENT,
+            device_class=DEVICE_CLASS_POWER).extend(),
+    cv.Optional(CONF_CYCLE_ENERGY): sensor.sensor_schema(
+            unit_of_measurement=UNIT_KILOWATT_HOURS,
+            icon=ICON_FLASH,
+            accuracy_decimals=3,
+            device_class=DEVICE_CLASS_ENERGY).extend(),
+    cv.Optional(CONF_HEATING_POLL_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_HDO_CHECK_INTERVAL, default="1h"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_DIAGNOSTICS): DIAGNOSTICS_SCHEMA,
+    cv.Optional(CONF_PACKET_CAPTURE, default=0): cv.int_range(min=0, max=256),
+    cv.Optional(CONF_REQUEST_TIMEOUT, default="2s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_MAX_RETRIES, default=2): cv.int_range(min=0, max=10),
+    cv.Optional(CONF_MAX_IN_FLIGHT, default=2): cv.int_range(min=1, max=8),
+    cv.Optional(CONF_PUBLISH_DEADBAND, default=0.0): cv.positive_float,
+    cv.Optional(CONF_STATE_POLL_INTERVAL, default="10s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_TEMPERATURE_POLL_INTERVAL, default="30s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_SETTINGS_POLL_INTERVAL, default="300s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_ROTATION, default=False): cv.boolean,
+    cv.Optional(CONF_ROTATION_BUDGET, default="30s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_BULK_READS, default=False): cv.boolean,
 }).extend(ble_client.BLE_CLIENT_SCHEMA)
 
+def _final_validate(config):
+    full_config = fv.full_config.get()
+    boilers = full_config.get("smartboiler", [])
+    tracker = full_config.get("esp32_ble_tracker") or {}
+    if isinstance(tracker, list):
+        tracker = tracker[0] if tracker else {}
+    max_connections = tracker.get(CONF_MAX_CONNECTIONS, DEFAULT_MAX_CONNECTIONS)
+    connected = sum(1 for conf in boilers if not conf[CONF_ROTATION])
+    # all water heaters in rotation share a single connection
+    needed = connected + (1 if connected < len(boilers) else 0)
+    if needed > max_connections:
+        raise cv.Invalid(
+            f"{connected} water heaters stay connected, but only {max_connections} BLE connections are available; "
+            f"set '{CONF_ROTATION}: true' on the others")
+    return config
+
+FINAL_VALIDATE_SCHEMA = _final_validate
+
+@automation.register_action(
+    "smartboiler.dump_capture",
+    SmartBoilerDumpCaptureAction,
+    cv.Schema({cv.GenerateID(): cv.use_id(SmartBoiler)}),
+)
+async def dump_capture_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+@automation.register_action(
+    "smartboiler.set_schedule",
+    SmartBoilerSetScheduleAction,
+    cv.Schema({
+        cv.GenerateID(): cv.use_id(SmartBoiler),
+        cv.Required(CONF_DAY): cv.templatable(cv.int_range(min=0, max=6)),
+        cv.Required(CONF_HOURS): cv.templatable(cv.string),
+    }),
+)
+async def set_schedule_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    day = await cg.templatable(config[CONF_DAY], args, cg.uint8)
+    cg.add(var.set_day(day))
+    hours = await cg.templatable(config[CONF_HOURS], args, cg.std_string)
+    cg.add(var.set_hours(hours))
+    # the written days are read back, and unchanged days must be known
+    parent = await cg.get_variable(config[CONF_ID])
+    cg.add(parent.set_schedule_polling(True))
+    cg.add_define("USE_SMARTBOILER_SCHEDULE")
+    return var
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
     await ble_client.register_ble_node(var, config)
+    cg.add(var.set_request_timeout(config[CONF_REQUEST_TIMEOUT]))
+    cg.add(var.set_max_retries(config[CONF_MAX_RETRIES]))
+    cg.add(var.set_max_in_flight(config[CONF_MAX_IN_FLIGHT]))
+    cg.add(var.set_publish_deadband(config[CONF_PUBLISH_DEADBAND]))
+    cg.add(var.set_state_poll_interval(config[CONF_STATE_POLL_INTERVAL]))
+    cg.add(var.set_temperature_poll_interval(config[CONF_TEMPERATURE_POLL_INTERVAL]))
+    cg.add(var.set_settings_poll_interval(config[CONF_SETTINGS_POLL_INTERVAL]))
+    cg.add(var.set_rotation(config[CONF_ROTATION]))
+    cg.add(var.set_rotation_budget(config[CONF_ROTATION_BUDGET]))
+    cg.add(var.set_bulk_reads(config[CONF_BULK_READS]))
+    cg.add(var.set_heating_poll_interval(config[CONF_HEATING_POLL_INTERVAL]))
+    cg.add(var.set_hdo_check_interval(config[CONF_HDO_CHECK_INTERVAL]))
+    if config[CONF_PACKET_CAPTURE] > 0:
+        # the buffer size is compiled in once, large enough for every water heater
+        capture_size = max(conf[CONF_PACKET_CAPTURE] for conf in CORE.config["smartboiler"])
+        cg.add_define("USE_SMARTBOILER_CAPTURE")
+        cg.add_define("SMARTBOILER_CAPTURE_SIZE", capture_size)
+        cg.add(var.set_capture(True))
 
     if CONF_TEMP1 in config:
         sens = await sensor.new_sensor(config[CONF_TEMP1])
         cg.add(var.set_temp1(sens))
+        cg.add_define("USE_SMARTBOILER_TEMP1")
 
     if CONF_TEMP2 in config:
         sens = await sensor.new_sensor(config[CONF_TEMP2])
         cg.add(var.set_temp2(sens))
+        cg.add_define("USE_SMARTBOILER_TEMP2")
 
     if CONF_CONSUMPTION in config:
         sens = await sensor.new_sensor(config[CONF_CONSUMPTION])
         cg.add(var.set_consumption(sens))
 
+    if CONF_POWER in config:
+        sens = await sensor.new_sensor(config[CONF_POWER])
+        cg.add(var.set_power(sens))
+        cg.add_define("USE_SMARTBOILER_POWER")
+
+    if CONF_CYCLE_ENERGY in config:
+        sens = await sensor.new_sensor(config[CONF_CYCLE_ENERGY])
+        cg.add(var.set_cycle_energy(sens))
+        cg.add_define("USE_SMARTBOILER_POWER")
+
+    if CONF_ENERGY_TODAY in config:
+        sens = await sensor.new_sensor(config[CONF_ENERGY_TODAY])
+        cg.add(var.set_energy_today(sens))
+        cg.add_define("USE_SMARTBOILER_HISTORY")
+
+    if CONF_ENERGY_WEEK in config:
+        sens = await sensor.new_sensor(config[CONF_ENERGY_WEEK])
+        cg.add(var.set_energy_week(sens))
+        cg.add_define("USE_SMARTBOILER_HISTORY")
+
+    if CONF_ENERGY_MONTH in config:
+        sens = await sensor.new_sensor(config[CONF_ENERGY_MONTH])
+        cg.add(var.set_energy_month(sens))
+        cg.add_define("USE_SMARTBOILER_HISTORY")
+
+    if CONF_ENERGY_YEAR in config:
+        sens = await sensor.new_sensor(config[CONF_ENERGY_YEAR])
+        cg.add(var.set_energy_year(sens))
+        cg.add_define("USE_SMARTBOILER_HISTORY")
+
     if CONF_HDO_LOW_TARIFF in config:
         sens = await binary_sensor.new_binary_sensor(config[CONF_HDO_LOW_TARIFF])
         cg.add(var.set_hdo_low_tariff(sens))
@@ -90,12 +314,14 @@ async def to_code(config):
     if CONF_MODE in config:
         sel = await select.new_select(config[CONF_MODE], options=['ANTIFREEZE', 'SMART', 'PROG', 'MANUAL'])
         cg.add(var.set_mode(sel))
+        cg.add_define("USE_SMARTBOILER_MODE")
         await cg.register_parented(sel, var)
 
     if CONF_THERMOSTAT in config:
         therm = cg.new_Pvariable(config[CONF_THERMOSTAT][CONF_ID])
         await climate.register_climate(therm, config[CONF_THERMOSTAT])
         cg.add(var.set_thermostat(therm))
+        cg.add_define("USE_SMARTBOILER_THERMOSTAT")
         await cg.register_parented(therm, var)
 
     if CONF_PIN in config:
@@ -118,3 +344,36 @@ async def to_code(config):
         name = cg.new_Pvariable(config[CONF_BNAME][CONF_ID])
         await text_sensor.register_text_sensor(name, config[CONF_BNAME])
         cg.add(var.set_name(name))
+
+    if CONF_SCHEDULE in config:
+        schedule = cg.new_Pvariable(config[CONF_SCHEDULE][CONF_ID])
+        await text_sensor.register_text_sensor(schedule, config[CONF_SCHEDULE])
+        cg.add(var.set_schedule_text(schedule))
+        cg.add_define("USE_SMARTBOILER_SCHEDULE")
+
+    if CONF_LAST_EVENT in config:
+        event = cg.new_Pvariable(config[CONF_LAST_EVENT][CONF_ID])
+        await text_sensor.register_text_sensor(event, config[CONF_LAST_EVENT])
+        cg.add(var.set_last_event(event))
+        cg.add_define("USE_SMARTBOILER_EVENT_LOG")
+
+    for conf in config.get(CONF_ON_LOG_ENTRY, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [(cg.uint32, "time"), (cg.uint32, "code")], conf)
+        cg.add_define("USE_SMARTBOILER_EVENT_LOG")
+
+    if CONF_DIAGNOSTICS in config:
+        cg.add_define("USE_SMARTBOILER_DIAGNOSTICS")
+        diagnostics = config[CONF_DIAGNOSTICS]
+        for key, setter in (
+            (CONF_RTT, var.set_rtt_sensor),
+            (CONF_HOME_ERRORS, var.set_home_errors_sensor),
+            (CONF_WRITE_FAILURES, var.set_write_failures_sensor),
+            (CONF_UNMATCHED_CONFIRMS, var.set_unmatched_confirms_sensor),
+            (CONF_RECONNECTS, var.set_reconnects_sensor),
+            (CONF_QUEUE_PEAK, var.set_queue_peak_sensor),
+            (CONF_ROLLBACKS, var.set_rollbacks_sensor),
+        ):
+            if key in diagnostics:
+                sens = await sensor.new_sensor(diagnostics[key])
+                cg.add(setter(sens))
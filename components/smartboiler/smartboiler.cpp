@@ -1,6 +1,7 @@
 #include "smartboiler.h"
 #include "esphome/core/application.h"
 #include "esphome/components/md5/md5.h"
+#include <algorithm>
 
 #define UUID_LENGTH 6
 
@@ -18,24 +19,121 @@ static const uint16_t SB_LOGGING_SERVICE_UUID = 0x1898;
 static const uint16_t SB_LOGGING_CHARACTERISTIC_UUID = 0x2B98;
 static const uint16_t CLIENT_CHARACTERISTIC_CONFIG_DESCRIPTOR_UUID = 0x2902;
 
-static const int COMMAND_DELAY = 100;
+// delay of the first poll after connecting, per instance index
+static const uint32_t CONNECT_STAGGER = 250;
+// static values older than this are read again on the next connection
+static const uint32_t STATIC_MAX_AGE = 24 * 60 * 60 * 1000;
+// consecutive failed aggregate reads after which the values are read one by one
+static const uint8_t AGGREGATE_MAX_FAILURES = 3;
+
+// bump when the layout of SavedSmartBoilerSnapshot changes
+static const uint8_t SNAPSHOT_VERSION = 1;
+// keeps the snapshot apart from the stored UID
+static const uint32_t SNAPSHOT_HASH_SALT = 0x5B5A0001;
+static const uint32_t SNAPSHOT_SAVE_INTERVAL = 10 * 60 * 1000;
+// keeps the event log cursor apart from the stored UID
+static const uint32_t LOG_CURSOR_HASH_SALT = 0x5B5A0002;
+
+// the tariff is asked this often while the current slot is not learned yet
+static const uint32_t TARIFF_LEARN_INTERVAL = 15 * 60 * 1000;
+// two observations of the same tariff further apart do not tell what happened in between
+static const uint16_t TARIFF_MAX_GAP_SLOTS = 8;
+static const uint32_t TARIFF_SAVE_INTERVAL = 6 * 60 * 60 * 1000;
+// bump when the layout of SavedTariffModel changes
+static const uint8_t TARIFF_MODEL_VERSION = 1;
+static const uint32_t TARIFF_HASH_SALT = 0x5B5A0003;
+// the clock of the water heater is read again after this time
+static const uint32_t CLOCK_POLL_INTERVAL = 6 * 60 * 60 * 1000;
+
+uint8_t SmartBoiler::instance_count_ = 0;
+SmartBoiler *SmartBoiler::rotation_members_[MAX_INSTANCES] = {};
+uint8_t SmartBoiler::rotation_size_ = 0;
+uint8_t SmartBoiler::rotation_turn_ = 0;
+
+uint32_t SmartBoiler::preference_hash_() {
+#ifdef USE_SMARTBOILER_THERMOSTAT
+  // the thermostat hash keeps UIDs stored by earlier versions valid
+  if (this->thermostat_)
+    return this->thermostat_->get_object_id_hash();
+#endif
+  return fnv1_hash(this->parent()->address_str());
+}
 
 void SmartBoiler::restore_state_() {
   SavedSmartBoilerSettings recovered{};
-  this->pref_ = global_preferences->make_preference<SavedSmartBoilerSettings>(this->thermostat_->get_object_id_hash());
+  this->pref_ = global_preferences->make_preference<SavedSmartBoilerSettings>(this->preference_hash_());
   bool restored = this->pref_.load(&recovered);
   if (restored) {
-    this->uid_ = recovered.uid;
+    // the UID fills the whole field without a terminating zero
+    this->uid_ = std::string(recovered.uid, strnlen(recovered.uid, sizeof(recovered.uid)));
     ESP_LOGD(TAG, "using stored UID: %s", this->uid_.c_str());
   }
 }
 
 void SmartBoiler::save_state_() {
   SavedSmartBoilerSettings state{};
-  strcpy(state.uid, this->uid_.c_str());
+  // no terminating zero, the restore path reads the field with strnlen()
+  memcpy(state.uid, this->uid_.data(), std::min(this->uid_.size(), sizeof(state.uid)));
   this->pref_.save(&state);
 }
 
+/**
+ * Restore last known values from flash and publish them, so entities are
+ * available right after boot.
+ */
+void SmartBoiler::restore_snapshot_() {
+  this->snapshot_pref_ =
+      global_preferences->make_preference<SavedSmartBoilerSnapshot>(this->preference_hash_() ^ SNAPSHOT_HASH_SALT);
+  SavedSmartBoilerSnapshot recovered{};
+  if (!this->snapshot_pref_.load(&recovered) || recovered.version != SNAPSHOT_VERSION) {
+    this->snapshot_ = {};
+    this->snapshot_.version = SNAPSHOT_VERSION;
+    this->snapshot_.mode = SNAPSHOT_UNKNOWN_MODE;
+    this->snapshot_.target_temperature = SNAPSHOT_UNKNOWN_TEMPERATURE;
+    return;
+  }
+  this->snapshot_ = recovered;
+  this->snapshot_.name[sizeof(this->snapshot_.name) - 1] = 0;
+  this->snapshot_.fw_version[sizeof(this->snapshot_.fw_version) - 1] = 0;
+  ESP_LOGD(TAG, "Restored last known state of the water heater");
+
+  uint32_t now = millis();
+  this->isHdoEnabled = this->snapshot_.hdo_enabled;
+#ifdef USE_SMARTBOILER_MODE
+  auto action = this->convert_mode_to_action(this->snapshot_.mode);
+  if (action != nullptr && this->mode_select_)
+    this->mode_select_->publish_state(action);
+#endif
+#ifdef USE_SMARTBOILER_THERMOSTAT
+  if (this->snapshot_.target_temperature != SNAPSHOT_UNKNOWN_TEMPERATURE && this->thermostat_)
+    this->thermostat_->publish_target_temp(this->snapshot_.target_temperature / 10.0f);
+#endif
+  if (this->snapshot_.name[0]) {
+    this->publish_text_(this->name_, this->snapshot_.name);
+    this->poller_.mark_updated(SBPacket::SBC_PACKET_HOME_BOILERNAME, now);
+  }
+  if (this->snapshot_.fw_version[0]) {
+    this->publish_text_(this->version_, this->snapshot_.fw_version);
+    this->poller_.mark_updated(SBPacket::SBC_PACKET_HOME_FWVERSION, now);
+  }
+  if (this->snapshot_.capacity)
+    this->poller_.mark_updated(SBPacket::SBC_PACKET_HOME_CAPACITY, now);
+}
+
+/**
+ * Write the snapshot when it changed, at most once per SNAPSHOT_SAVE_INTERVAL
+ * to limit flash wear.
+ */
+void SmartBoiler::save_snapshot_() {
+  uint32_t now = millis();
+  if (!this->snapshot_dirty_ || (this->snapshot_saved_at_ != 0 && now - this->snapshot_saved_at_ < SNAPSHOT_SAVE_INTERVAL))
+    return;
+  this->snapshot_pref_.save(&this->snapshot_);
+  this->snapshot_dirty_ = false;
+  this->snapshot_saved_at_ = now;
+  ESP_LOGD(TAG, "Saved last known state of the water heater");
+}
+
 void SmartBoiler::setup() {
   ESP_LOGD(TAG, "Setup()");
   this->restore_state_();
@@ -45,50 +143,307 @@ void SmartBoiler::setup() {
     this->save_state_();
   }
   this->state_txt_->publish_state(this->state_to_string(this->state_));
+  this->setup_polling_();
+  this->restore_snapshot_();
+  if (this->hdo_low_tariff_sensor_)
+    this->restore_tariff_model_();
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  if (this->event_log_) {
+    this->log_cursor_pref_ =
+        global_preferences->make_preference<uint32_t>(this->preference_hash_() ^ LOG_CURSOR_HASH_SALT);
+    if (this->log_cursor_pref_.load(&this->log_cursor_))
+      ESP_LOGD(TAG, "Event log entries up to %u were already reported", this->log_cursor_);
+  }
+#endif
+  if (this->rotation_) {
+    if (rotation_size_ >= MAX_INSTANCES) {
+      ESP_LOGE(TAG, "More than %u water heaters in rotation", MAX_INSTANCES);
+      this->mark_failed();
+      return;
+    }
+    // connections are opened only while it is this water heater's turn, the
+    // BLE client is disabled by the first rotate_() as it is set up after us
+    rotation_members_[rotation_size_++] = this;
+  }
 }
 
 void SmartBoiler::dump_config() {
   ESP_LOGCONFIG(TAG, "SmartBoiler:");
+#ifdef USE_SMARTBOILER_TEMP1
   LOG_SENSOR("  ", "Temp1", temperature_sensor_1_sensor_);
+#endif
+#ifdef USE_SMARTBOILER_TEMP2
   LOG_SENSOR("  ", "Temp2", temperature_sensor_2_sensor_);
+#endif
   LOG_SENSOR("  ", "Consumption", consumption_sensor_);
+#ifdef USE_SMARTBOILER_HISTORY
+  LOG_SENSOR("  ", "Energy today", energy_today_);
+  LOG_SENSOR("  ", "Energy week", energy_week_);
+  LOG_SENSOR("  ", "Energy month", energy_month_);
+  LOG_SENSOR("  ", "Energy year", energy_year_);
+#endif
   LOG_BINARY_SENSOR("  ", "HDO", hdo_low_tariff_sensor_);
+#ifdef USE_SMARTBOILER_MODE
   LOG_SELECT("  ", "Mode", mode_select_);
+#endif
+#ifdef USE_SMARTBOILER_THERMOSTAT
   LOG_CLIMATE("  ", "Thermostat", thermostat_);
+#endif
   LOG_NUMBER("  ", "Pairing PIN", mPin_);
   LOG_TEXT_SENSOR("  ", "Version", version_);
   LOG_TEXT_SENSOR("  ", "State", state_txt_);
+  ESP_LOGCONFIG(TAG, "  Max in flight: %u", this->flow_.get_max_in_flight());
+  ESP_LOGCONFIG(TAG, "  Frames saved by coalescing: %u", this->frames_saved_);
+  ESP_LOGCONFIG(TAG, "  Notifications dropped: %u", this->notify_ring_.overflows());
+  ESP_LOGCONFIG(TAG, "  Poll intervals: state %u ms, temperatures %u ms, settings %u ms", this->state_poll_interval_,
+                this->temperature_poll_interval_, this->settings_poll_interval_);
+  if (this->hdo_low_tariff_sensor_) {
+    ESP_LOGCONFIG(TAG, "  HDO: selection A '%s', B '%s', DP '%s', frequency '%s', setting '%s'",
+                  this->hdo_config_[0].data(), this->hdo_config_[1].data(), this->hdo_config_[2].data(),
+                  this->hdo_config_[3].data(), this->hdo_config_[4].data());
+    ESP_LOGCONFIG(TAG, "  HDO tariff model: %u%% of the week learned, checked every %u s",
+                  this->tariff_model_.coverage(), this->hdo_check_interval_ / 1000);
+  }
+  if (this->rotation_)
+    ESP_LOGCONFIG(TAG, "  Rotation: %u water heaters, visit budget %u ms", rotation_size_, this->rotation_budget_);
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  if (this->event_log_)
+    ESP_LOGCONFIG(TAG, "  Event log: %u entries read, cursor %u", this->log_entries_.size(), this->log_cursor_);
+#endif
+#ifdef USE_SMARTBOILER_DIAGNOSTICS
+  this->dump_diagnostics_();
+#endif
 }
 
-void SmartBoiler::loop() { this->process_command_queue_(); }
+void SmartBoiler::loop() {
+  this->drain_notifications_();
+  if (this->rotation_)
+    this->rotate_();
+  if (this->state_ == ConnectionState::CONNECTED) {
+    auto packet = this->poller_.take_due(millis());
+    if (packet != SBPacket::SBC_PACKET_NONE) {
+      // one aggregate read refreshes all of its values
+      auto aggregate = sb_aggregate_of(packet);
+      if (this->bulk_reads_ && aggregate != SBPacket::SBC_PACKET_NONE && !this->aggregate_unsupported_(aggregate)) {
+        // values due together share the read, its reply refreshes them all
+        if (!this->is_read_pending_(aggregate)) {
+          this->request_value(aggregate, 0, [this, aggregate](SBCompletion status, const SBProtocolResult *result) {
+            // firmware without aggregate packets rejects them or does not answer at all, but
+            // a single error or timeout may as well belong to another request or a weak link
+            if (status == SBCompletion::REPLIED) {
+              this->aggregate_failures_(aggregate) = 0;
+            } else if (status == SBCompletion::REJECTED || status == SBCompletion::TIMED_OUT) {
+              if (++this->aggregate_failures_(aggregate) >= AGGREGATE_MAX_FAILURES)
+                this->disable_aggregate_(aggregate);
+            }
+          });
+        }
+      } else {
+        this->request_value(packet);
+      }
+    }
+  }
+#ifdef USE_SMARTBOILER_POWER
+  // follow the counter closely while the heating element is on
+  if (this->power_ && this->state_ == ConnectionState::CONNECTED && this->power_estimator_.is_heating() &&
+      millis() - this->consumption_requested_at_ >= this->heating_poll_interval_)
+    this->request_consumption_();
+#endif
+#ifdef USE_SMARTBOILER_HISTORY
+  this->request_history_();
+#endif
+  this->update_tariff_();
+#ifdef USE_SMARTBOILER_SCHEDULE
+  // changes requested in this loop are written together
+  if (this->state_ == ConnectionState::CONNECTED && this->schedule_.has_changes())
+    this->write_schedule_();
+#endif
+  this->process_command_queue_();
+#ifdef USE_SMARTBOILER_THERMOSTAT
+  // one climate update per loop, no matter how many fields changed
+  if (this->thermostat_)
+    this->thermostat_->flush_state();
+#endif
+  this->save_snapshot_();
+}
+
+/**
+ * Rotation mode: water heaters take turns in connecting. A visit connects,
+ * authenticates, reads one batch of values and disconnects again, or ends
+ * when the visit budget runs out. Published values stay in place between
+ * visits.
+ */
+void SmartBoiler::rotate_() {
+  if (!this->rotation_joined_) {
+    // BLEClient::setup() enabled the client after our setup() ran
+    this->rotation_joined_ = true;
+    this->parent()->set_enabled(false);
+  }
+  if (rotation_members_[rotation_turn_] != this)
+    return;
+  uint32_t now = millis();
+  if (!this->visiting_) {
+    ESP_LOGD(TAG, "[%s] Rotation: connecting", this->parent()->address_str().c_str());
+    this->visiting_ = true;
+    this->visit_started_ = now;
+    this->parent()->set_enabled(true);
+    return;
+  }
+
+  bool done = this->state_ == ConnectionState::CONNECTED && this->poller_.started_values_requested() &&
+              this->command_queue_.empty() && this->sent_queue_.size() == 0;
+#ifdef USE_SMARTBOILER_HISTORY
+  done = done && this->history_requests_.empty();
+#endif
+  if (!done && now - this->visit_started_ < this->rotation_budget_)
+    return;
 
-void SmartBoiler::send_to_boiler(SBProtocolRequest request) {
+  if (done) {
+    if (this->last_visit_end_ != 0)
+      ESP_LOGI(TAG, "[%s] Rotation: refreshed in %u ms, %u ms since the previous refresh",
+               this->parent()->address_str().c_str(), now - this->visit_started_, now - this->last_visit_end_);
+    this->last_visit_end_ = now;
+  } else {
+    ESP_LOGW(TAG, "[%s] Rotation: visit budget of %u ms exhausted", this->parent()->address_str().c_str(),
+             this->rotation_budget_);
+  }
+  this->visiting_ = false;
+  this->parent()->set_enabled(false);
+  rotation_turn_ = (rotation_turn_ + 1) % rotation_size_;
+}
+
+/**
+ * Publish a sensor value only when it moved by more than the deadband since
+ * the last published value.
+ */
+void SmartBoiler::publish_sensor_(sensor::Sensor *sensor, float value) {
+  if (sensor == nullptr)
+    return;
+  if (sensor->has_state() && std::fabs(sensor->get_raw_state() - value) <= this->publish_deadband_)
+    return;
+  sensor->publish_state(value);
+}
+
+void SmartBoiler::publish_text_(text_sensor::TextSensor *sensor, std::string_view value) {
+  if (sensor == nullptr || (sensor->has_state() && sensor->state == value))
+    return;
+  sensor->publish_state(std::string(value));
+}
+
+void SmartBoiler::send_to_boiler(const SBProtocolRequest &request) {
   this->last_command_timestamp_ = millis();
-  ESP_LOGD(TAG, "Sending: REQ: %d DATA=[%s]", request.mRqType, format_hex_pretty(request.mData).c_str());
+  if (request.overflow()) {
+    ESP_LOGW(TAG, "Request %d does not fit into a single frame, dropped", request.mRqType);
+    return;
+  }
+#ifdef USE_SMARTBOILER_CAPTURE
+  if (this->capture_enabled_)
+    this->capture_.record(SBCaptureDirection::TX, this->parent_->get_conn_id(), this->last_command_timestamp_,
+                          request.data(), request.size());
+#endif
+  ESP_LOGV(TAG, "Sending: REQ: %d DATA=[%s]", request.mRqType, format_hex_pretty(request.data(), request.size()).c_str());
   auto status = esp_ble_gattc_write_char(this->parent_->get_gattc_if(), this->parent_->get_conn_id(),
-                                         this->char_handle_, request.mData.size(), request.mData.data(),
+                                         this->char_handle_, request.size(), const_cast<uint8_t *>(request.data()),
                                          ESP_GATT_WRITE_TYPE_NO_RSP, ESP_GATT_AUTH_REQ_NONE);
 
-  if (status)
+  if (status) {
     ESP_LOGW(TAG, "[%s] esp_ble_gattc_write_char failed, status=%d", this->parent_->address_str().c_str(), status);
+    this->diagnostics_.on_write_failure();
+  }
 }
 
+#ifdef USE_SMARTBOILER_THERMOSTAT
 void SmartBoiler::on_set_temperature(uint8_t temp) {
   if (temp < MIN_TEMP || temp > MAX_TEMP) {
     ESP_LOGW(TAG, "Invalid set temperature: %d", temp);
     return;
   }
-  auto cmd = SBProtocolRequest(SBC_PACKET_HOME_SETNORMALTEMPERATURE, this->mPacketUid++);
-  cmd.write_le((uint32_t) temp);
-  this->enqueue_command_(cmd);
+  // shown right away, rolled back if the water heater does not take it
+  uint8_t seq = ++this->temperature_write_.seq;
+  this->temperature_write_.pending = true;
+  if (this->thermostat_)
+    this->thermostat_->publish_target_temp(temp);
+  auto cmd = SBProtocolRequest(SBC_PACKET_HOME_SETNORMALTEMPERATURE, this->next_uid_());
+  cmd.put<SBLayout<SBC_PACKET_HOME_SETNORMALTEMPERATURE>::Value>(temp);
+  this->enqueue_command_(std::move(cmd), [this, seq, temp](SBCompletion status, const SBProtocolResult *result) {
+    this->on_temperature_written_(seq, temp, status);
+  });
 }
+#endif
 
+#ifdef USE_SMARTBOILER_MODE
 void SmartBoiler::on_set_mode(const std::string &payload) {
   auto mode = this->convert_action_to_mode(payload);
-  auto cmd = SBProtocolRequest(SBC_PACKET_HOME_SETMODE, this->mPacketUid++);
-  cmd.write_le(uint32_t(mode));
-  this->enqueue_command_(cmd);
+  auto action = this->convert_mode_to_action(mode);
+  // an unknown name would be sent as STOP
+  if (action == nullptr)
+    return;
+  // shown right away, rolled back if the water heater does not take it
+  uint8_t seq = ++this->mode_write_.seq;
+  this->mode_write_.pending = true;
+  if (this->mode_select_)
+    this->mode_select_->publish_state(action);
+  auto cmd = SBProtocolRequest(SBC_PACKET_HOME_SETMODE, this->next_uid_());
+  cmd.put<SBLayout<SBC_PACKET_HOME_SETMODE>::Value>(mode);
+  this->enqueue_command_(std::move(cmd), [this, seq, mode](SBCompletion status, const SBProtocolResult *result) {
+    this->on_mode_written_(seq, mode, status);
+  });
+}
+#endif
+
+#if defined(USE_SMARTBOILER_MODE) || defined(USE_SMARTBOILER_THERMOSTAT)
+static const char *write_failure_to_string(SBCompletion status) {
+  switch (status) {
+    case SBCompletion::REJECTED:
+      return "rejected";
+    case SBCompletion::TIMED_OUT:
+      return "not confirmed";
+    default:
+      return "not sent";
+  }
+}
+#endif
+
+#ifdef USE_SMARTBOILER_MODE
+void SmartBoiler::on_mode_written_(uint8_t seq, uint8_t mode, SBCompletion status) {
+  // a newer write owns the published value
+  if (seq != this->mode_write_.seq)
+    return;
+  this->mode_write_.pending = false;
+  if (status == SBCompletion::CONFIRMED) {
+    this->update_snapshot_(this->snapshot_.mode, mode);
+    return;
+  }
+  ESP_LOGW(TAG, "Mode %d %s, rolling back", mode, write_failure_to_string(status));
+  this->diagnostics_.on_rollback();
+  auto confirmed = this->convert_mode_to_action(this->snapshot_.mode);
+  if (confirmed == nullptr) {
+    // nothing confirmed to go back to, read what the water heater uses
+    this->poller_.make_due(SBPacket::SBC_PACKET_HOME_MODE, millis());
+  } else if (this->mode_select_) {
+    this->mode_select_->publish_state(confirmed);
+  }
+}
+#endif
+
+#ifdef USE_SMARTBOILER_THERMOSTAT
+void SmartBoiler::on_temperature_written_(uint8_t seq, uint8_t temp, SBCompletion status) {
+  if (seq != this->temperature_write_.seq)
+    return;
+  this->temperature_write_.pending = false;
+  if (status == SBCompletion::CONFIRMED) {
+    this->update_snapshot_(this->snapshot_.target_temperature, int16_t(temp * 10));
+    return;
+  }
+  ESP_LOGW(TAG, "Target temperature %u °C %s, rolling back", temp, write_failure_to_string(status));
+  this->diagnostics_.on_rollback();
+  if (this->snapshot_.target_temperature == SNAPSHOT_UNKNOWN_TEMPERATURE) {
+    this->poller_.make_due(SBPacket::SBC_PACKET_HOME_TEMPERATURE, millis());
+  } else if (this->thermostat_) {
+    this->thermostat_->publish_target_temp(this->snapshot_.target_temperature / 10.0f);
+  }
 }
+#endif
 
 void SmartBoiler::on_set_hdo_enabled(const std::string &payload) {
   auto hdoOpt = parse_number<int>(payload);
@@ -96,9 +451,9 @@ void SmartBoiler::on_set_hdo_enabled(const std::string &payload) {
     ESP_LOGW(TAG, "Invalid set_hdo_enabled value: %s", payload.c_str());
     return;
   }
-  auto cmd = SBProtocolRequest(SBC_PACKET_HDO_SET_ONOFF, this->mPacketUid++);
-  cmd.write_le(uint32_t(*hdoOpt ? 1 : 0));
-  this->enqueue_command_(cmd);
+  auto cmd = SBProtocolRequest(SBC_PACKET_HDO_SET_ONOFF, this->next_uid_());
+  cmd.put<SBLayout<SBC_PACKET_HDO_SET_ONOFF>::Value>(*hdoOpt ? 1 : 0);
+  this->enqueue_command_(std::move(cmd));
 }
 
 void SmartBoiler::gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
@@ -107,12 +462,15 @@ void SmartBoiler::gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t
     case ESP_GATTC_OPEN_EVT: {
       if (param->open.status == ESP_GATT_OK) {
         ESP_LOGI(TAG, "[%s] Connected", this->parent_->address_str().c_str());
+        this->diagnostics_.on_connect();
       }
       break;
     }
     case ESP_GATTC_DISCONNECT_EVT: {
       ESP_LOGI(TAG, "[%s] Disconnected", this->parent_->address_str().c_str());
-      this->set_state(ConnectionState::DISCONNECTED);
+      // loop() cleans up; notifications still in the ring belong to the closed connection
+      this->notify_ready_.store(false, std::memory_order_relaxed);
+      this->link_epoch_.fetch_add(1, std::memory_order_release);
       break;
     }
     case ESP_GATTC_SEARCH_CMPL_EVT: {
@@ -144,11 +502,14 @@ void SmartBoiler::gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t
       break;
     }
     case ESP_GATTC_REG_FOR_NOTIFY_EVT: {
-      this->authenticate();
+      // authentication is sent from loop()
+      this->notify_ready_.store(true, std::memory_order_release);
       break;
     }
     case ESP_GATTC_NOTIFY_EVT: {
-      handle_incoming(param->notify.value, param->notify.value_len);
+      // decoded in loop(), keep the BLE callback short
+      this->notify_ring_.push(param->notify.value, param->notify.value_len,
+                              this->link_epoch_.load(std::memory_order_relaxed));
       break;
     }
     default:
@@ -160,194 +521,1195 @@ void SmartBoiler::authenticate() {
   ESP_LOGD(TAG, "Sending authentication request.");
   auto cmd = SBProtocolRequest(SBPacket::SBC_PACKET_RQ_GLOBAL_MAC);
   cmd.writeString(this->uid_);
-  this->enqueue_command_(cmd);
+  this->auth_started_at_ = millis();
+  this->first_data_received_ = false;
+  this->enqueue_command_(std::move(cmd));
   this->set_state(ConnectionState::AUTHENTICATING);
 }
 
 void SmartBoiler::getInitData() {
   ESP_LOGD(TAG, "Requesting initial data from water heater");
-  this->request_value(SBPacket::SBC_PACKET_HOME_MODE);
-  this->request_value(SBPacket::SBC_PACKET_HOME_BOILERMODEL);
-  this->request_value(SBPacket::SBC_PACKET_HOME_CAPACITY);
-  this->request_value(SBPacket::SBC_PACKET_HOME_BOILERNAME);
-  this->request_value(SBPacket::SBC_PACKET_HOME_TEMPERATURE);
-  this->request_value(SBPacket::SBC_PACKET_HOME_SENSOR1);
-  this->request_value(SBPacket::SBC_PACKET_HOME_SENSOR2);
-  this->request_value(SBPacket::SBC_PACKET_HOME_HSRCSTATE);
-  this->request_value(SBPacket::SBC_PACKET_HDO_ONOFF);
+  // every value is due now, later deadlines follow their own intervals
+  // static values known from a previous connection or from flash are not read again
+  if (this->rotation_) {
+    // each visit is a single batch
+    this->poller_.start(millis(), STATIC_MAX_AGE);
+    this->request_consumption_();
+  } else {
+    this->poller_.start(millis() + this->instance_index_ * CONNECT_STAGGER, STATIC_MAX_AGE);
+  }
+  // the firmware may have been updated while disconnected, try the aggregates again
+  this->home_all_unsupported_ = false;
+  this->hdo_all_unsupported_ = false;
+  this->home_all_failures_ = 0;
+  this->hdo_all_failures_ = 0;
+  // the tariff may have switched while disconnected
+  this->tariff_next_check_ = millis();
+  this->has_tariff_obs_ = false;
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  this->start_log_sync_();
+#endif
+}
+
+void SmartBoiler::setup_polling_() {
+  struct PolledValue {
+    SBPacket packet;
+    uint32_t interval;
+  };
+  const PolledValue POLLED_VALUES[] = {
+      {SBPacket::SBC_PACKET_HOME_HSRCSTATE, this->state_poll_interval_},
+      {SBPacket::SBC_PACKET_HOME_SENSOR1, this->temperature_poll_interval_},
+      {SBPacket::SBC_PACKET_HOME_SENSOR2, this->temperature_poll_interval_},
+      {SBPacket::SBC_PACKET_HOME_MODE, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_HOME_TEMPERATURE, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_HDO_ONOFF, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_NIGHT_GETDAYS, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_NIGHT_GETDAYS2, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_HDO_SELECTION_A, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_HDO_SELECTION_B, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_HDO_SELECTION_DP, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_HDO_FREQUENCY, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_HDO_SETTING, this->settings_poll_interval_},
+      {SBPacket::SBC_PACKET_HOME_TIME, CLOCK_POLL_INTERVAL},
+      // static values are read once per connection
+      {SBPacket::SBC_PACKET_HOME_BOILERMODEL, 0},
+      {SBPacket::SBC_PACKET_HOME_CAPACITY, 0},
+      {SBPacket::SBC_PACKET_HOME_BOILERNAME, 0},
+      {SBPacket::SBC_PACKET_HOME_FWVERSION, 0},
+  };
+  // replies without a handler would be dropped anyway
+  for (const auto &value : POLLED_VALUES) {
+    if (PACKET_HANDLERS[value.packet] == nullptr)
+      continue;
+#ifdef USE_SMARTBOILER_SCHEDULE
+    // the handler is there when any water heater uses the schedule
+    if (!this->schedule_polling_ && (value.packet == SBPacket::SBC_PACKET_NIGHT_GETDAYS ||
+                                     value.packet == SBPacket::SBC_PACKET_NIGHT_GETDAYS2))
+      continue;
+#endif
+    this->poller_.add(value.packet, value.interval);
+  }
+  // spread the deadlines of all instances over each interval; golden ratio
+  // steps keep any number of instances well apart without knowing the total
+  this->instance_index_ = instance_count_++;
+  this->poller_.set_phase(uint8_t(this->instance_index_ * 158));
 }
 
 void SmartBoiler::update() {
+#ifdef USE_SMARTBOILER_DIAGNOSTICS
+  this->publish_diagnostics_();
+#endif
   if (this->state_ == ConnectionState::CONNECTED) {
-    ESP_LOGD(TAG, "Requesting consumption");
-    auto cmd = SBProtocolRequest(SBC_PACKET_STATISTICS_GETALL, this->mPacketUid++);
-    this->enqueue_command_(cmd);
+    ESP_LOGD(TAG, "Throughput: %.1f req/s, RTT %u ms, gap %u ms, frames saved: %u",
+             this->flow_.take_throughput(millis()), this->flow_.get_srtt(), this->flow_.get_gap(), this->frames_saved_);
+    this->log_value_ages_();
+    this->request_consumption_();
+#ifdef USE_SMARTBOILER_EVENT_LOG
+    this->start_log_sync_();
+#endif
+  }
+}
+
+void SmartBoiler::request_value(SBPacket sensor, uint16_t uid, SBCompletionHandler on_done) {
+  this->enqueue_command_(SBProtocolRequest(sensor, uid), std::move(on_done));
+}
+
+void SmartBoiler::read_value(SBPacket packet, SBCompletionHandler on_done) {
+  this->request_value(packet, 0, std::move(on_done));
+}
+
+void SmartBoiler::write_value(SBPacket packet, uint32_t value, SBCompletionHandler on_done) {
+  auto cmd = SBProtocolRequest(packet, this->next_uid_());
+  cmd.put<SBSettingLayout::Value>(value);
+  this->enqueue_command_(std::move(cmd), std::move(on_done));
+}
+
+/**
+ * Act on what the BLE callback recorded: a closed connection, notifications
+ * being enabled, and the notifications themselves, at most
+ * NOTIFY_DRAIN_BUDGET per call so a burst does not stall the other
+ * components. Frames of a closed connection are dropped.
+ */
+void SmartBoiler::drain_notifications_() {
+  uint8_t epoch = this->link_epoch_.load(std::memory_order_acquire);
+  if (epoch != this->handled_epoch_) {
+    this->handled_epoch_ = epoch;
+    this->on_disconnected_();
+  }
+  if (this->notify_ready_.exchange(false, std::memory_order_acquire))
+    this->authenticate();
+  for (size_t i = 0; i < NOTIFY_DRAIN_BUDGET; i++) {
+    auto frame = this->notify_ring_.peek();
+    if (frame == nullptr)
+      break;
+    if (frame->epoch == epoch)
+      this->handle_incoming(frame->data, frame->length);
+    this->notify_ring_.pop();
+  }
+  auto overflows = this->notify_ring_.overflows();
+  if (overflows != this->notify_overflows_reported_) {
+    ESP_LOGW(TAG, "%u notifications dropped, receive ring full or frame too long",
+             overflows - this->notify_overflows_reported_);
+    this->notify_overflows_reported_ = overflows;
   }
 }
 
-void SmartBoiler::request_value(SBPacket sensor, uint16_t uid) {
-  this->enqueue_command_(SBProtocolRequest(sensor, uid));
+void SmartBoiler::on_disconnected_() {
+  this->set_state(ConnectionState::DISCONNECTED);
+  // replies to outstanding requests will never arrive
+  this->cancel_requests_();
+  this->flow_.reset();
+#ifdef USE_SMARTBOILER_HISTORY
+  this->history_requests_.clear();
+#endif
+#ifdef USE_SMARTBOILER_POWER
+  // switches of the heating element are not seen while disconnected
+  this->heating_known_ = false;
+  this->cycle_running_ = false;
+#endif
+#ifdef USE_SMARTBOILER_SCHEDULE
+  this->schedule_.retry_writes();
+#endif
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  if (this->log_syncing_)
+    this->finish_log_sync_(false);
+#endif
 }
 
 void SmartBoiler::handle_incoming(const uint8_t *value, uint16_t value_len) {
+#ifdef USE_SMARTBOILER_CAPTURE
+  if (this->capture_enabled_)
+    this->capture_.record(SBCaptureDirection::RX, this->parent_->get_conn_id(), millis(), value, value_len);
+#endif
   auto result = SBProtocolResult(value, value_len);
 
-  ESP_LOGD(TAG, "Received: REQ: %d DATA=[%s]", result.mRqType, format_hex_pretty(value, value_len).c_str());
+  ESP_LOGV(TAG, "Received: REQ: %d DATA=[%s]", result.mRqType, format_hex_pretty(value, value_len).c_str());
 
-  switch (result.mRqType) {
-    case SBPacket::SBC_PACKET_GLOBAL_PAIRPIN: {
-      ESP_LOGD(TAG, "PIN pairing required.");
-      // water heater requires pairing of this client via PIN
-      this->set_state(ConnectionState::NEED_PIN);
-      break;
-    }
-    case SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID: {
-      // all setting commands are sent with unique packet UID and confirmation from BT
-      // server is expected. Most of them contain no additional data, with exception of
-      // SBC_PACKET_STATISTICS_GETALL
-      ESP_LOGD(TAG, "Received confirmation for packet with UID: %0X", result.mUid);
-      ESP_LOGD(TAG, "mByteData: DATA=[%s]", format_hex_pretty(result.mByteData).c_str());
-
-      // find original request in queue of sent packets
-      auto originalRequest = std::find_if(this->sent_queue_.begin(), this->sent_queue_.end(),
-                                          [&](const SBProtocolRequest& req) { return req.mUid == result.mUid; });
-      if (originalRequest != this->sent_queue_.end()) {
-        ESP_LOGD(TAG, "original request was: %d", (*originalRequest).mRqType);
-        // remove the sent request from the queue as it was sucessfully accepted
-        this->sent_queue_.erase(originalRequest);
-
-        // handle some special confirm packets
-        switch ((*originalRequest).mRqType) {
-          case SBPacket::SBC_PACKET_STATISTICS_GETALL: {
-            uint32_t consumption = result.load_uint32_le(0);
-            uint32_t timestamp = result.load_uint32_le(4);
-            if (this->consumption_sensor_)
-              this->consumption_sensor_->publish_state((float) consumption / 1000);
-            break;
-          }
-          default:
-            break;
-        }
-      }
-      break;
-    }
-    case SBPacket::SBC_PACKET_GLOBAL_DEVICEBONDED: {
-      ESP_LOGI(TAG, "Device is already paired with the water heater.");
-      this->set_state(ConnectionState::CONNECTED);
-      this->getInitData();
-      break;
-    }
-    case SBPacket::SBC_PACKET_GLOBAL_PINRESULT: {
-      auto pinResult = parse_number<int>(result.mString);
-      if (pinResult.has_value() && pinResult.value() == 1) {
-        ESP_LOGI(TAG, "PIN is correct.");
-        this->set_state(ConnectionState::CONNECTED);
-        this->getInitData();
-      } else {
-        ESP_LOGW(TAG, "Wrong PIN provided, water heater response: %s", result.mString.c_str());
-      }
-      break;
-    }
+  if (result.mRqType < SB_PACKET_COUNT) {
+    auto handler = PACKET_HANDLERS[result.mRqType];
+    // a malformed reply does not count as a fresh value
+    if (handler != nullptr && (this->*handler)(result))
+      this->poller_.mark_updated(result.mRqType, millis());
+  }
 
-    case SBPacket::SBC_PACKET_HOME_FWVERSION: {
-      // Format: firmware;board revision;serial number
-      auto firstSemicol = result.mString.find(';');
-      if (firstSemicol != std::string::npos) {
-        auto secondSemicol = result.mString.find(';', firstSemicol + 1);
-        if (secondSemicol != std::string::npos) {
-          auto fwVersion = result.mString.substr(0, firstSemicol);
-          auto boardRev = result.mString.substr(firstSemicol + 1, secondSemicol - firstSemicol - 1);
-          auto serial = result.mString.substr(secondSemicol + 1);
-          char buffer[100];
-          sprintf(buffer, "fw:%s, board: %s, S/N: %s", fwVersion.c_str(), boardRev.c_str(), serial.c_str());
-          std::string version(buffer);
-          this->version_->publish_state(version);
-          break;
-        }
-      }
-      ESP_LOGW(TAG, "Bad FW info format: %s", result.mString.c_str());
-      break;
-    }
+  // plain reads are answered by a packet of the same type
+  auto pendingRead = this->sent_queue_.find_read(result.mRqType);
+  if (pendingRead != nullptr)
+    this->complete_request_(pendingRead, SBCompletion::REPLIED, &result);
+}
 
-    case SBPacket::SBC_PACKET_HOME_MODE: {
-      auto modeOpt = parse_number<int>(result.mString);
-      if (!modeOpt.has_value()) {
-        ESP_LOGW(TAG, "Bad mode string from water heater: %s", result.mString.c_str());
-        break;
-      }
-      auto mode = modeOpt.value();
-      auto modeAsString = convert_mode_to_action(mode);
-      if (!modeAsString.empty()) {
-        if (mode_select_)
-          mode_select_->publish_state(modeAsString);
-      } else
-        ESP_LOGW(TAG, "Bad mode value from water heater: %d", mode);
-      break;
-    }
-    case SBPacket::SBC_PACKET_HOME_TEMPERATURE: {
-      auto tempOpt = parse_number<float>(result.mString);
-      if (tempOpt.has_value()) {
-        this->thermostat_->publish_target_temp(*tempOpt);
-      }
-      break;
+/**
+ * Packets handled by this component. Entries for entities which are not
+ * configured in any instance are compiled out; adding support for a new
+ * packet means adding a handler and an entry here.
+ */
+constexpr SmartBoiler::PacketHandlerTable SmartBoiler::build_packet_handlers_() {
+  constexpr PacketHandlerEntry ENTRIES[] = {
+      {SBPacket::SBC_PACKET_GLOBAL_PAIRPIN, &SmartBoiler::handle_pair_pin_},
+      {SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID, &SmartBoiler::handle_confirm_uid_},
+      {SBPacket::SBC_PACKET_GLOBAL_DEVICEBONDED, &SmartBoiler::handle_device_bonded_},
+      {SBPacket::SBC_PACKET_GLOBAL_PINRESULT, &SmartBoiler::handle_pin_result_},
+      {SBPacket::SBC_PACKET_HOME_ERROR, &SmartBoiler::handle_error_},
+      {SBPacket::SBC_PACKET_HOME_TIME, &SmartBoiler::handle_time_},
+      {SBPacket::SBC_PACKET_HDO_ONOFF, &SmartBoiler::handle_hdo_onoff_},
+      {SBPacket::SBC_PACKET_HOME_ALL, &SmartBoiler::handle_home_all_},
+      {SBPacket::SBC_PACKET_HOME_CAPACITY, &SmartBoiler::handle_capacity_},
+      {SBPacket::SBC_PACKET_HDO_ALL, &SmartBoiler::handle_hdo_all_},
+      {SBPacket::SBC_PACKET_HOME_FWVERSION, &SmartBoiler::handle_fw_version_},
+#ifdef USE_SMARTBOILER_MODE
+      {SBPacket::SBC_PACKET_HOME_MODE, &SmartBoiler::handle_mode_},
+#endif
+#ifdef USE_SMARTBOILER_THERMOSTAT
+      {SBPacket::SBC_PACKET_HOME_TEMPERATURE, &SmartBoiler::handle_temperature_},
+#endif
+#ifdef USE_SMARTBOILER_TEMP1
+      {SBPacket::SBC_PACKET_HOME_SENSOR1, &SmartBoiler::handle_sensor1_},
+#endif
+#if defined(USE_SMARTBOILER_TEMP2) || defined(USE_SMARTBOILER_THERMOSTAT) || defined(USE_SMARTBOILER_POWER)
+      {SBPacket::SBC_PACKET_HOME_SENSOR2, &SmartBoiler::handle_sensor2_},
+#endif
+      {SBPacket::SBC_PACKET_HOME_HSRCSTATE, &SmartBoiler::handle_heating_state_},
+      {SBPacket::SBC_PACKET_HOME_BOILERNAME, &SmartBoiler::handle_name_},
+      {SBPacket::SBC_PACKET_HDO_LESSEXPTARIFFAVAILABLENOW, &SmartBoiler::handle_tariff_now_},
+      {SBPacket::SBC_PACKET_HDO_SELECTION_A, &SmartBoiler::handle_hdo_config_},
+      {SBPacket::SBC_PACKET_HDO_SELECTION_B, &SmartBoiler::handle_hdo_config_},
+      {SBPacket::SBC_PACKET_HDO_SELECTION_DP, &SmartBoiler::handle_hdo_config_},
+      {SBPacket::SBC_PACKET_HDO_FREQUENCY, &SmartBoiler::handle_hdo_config_},
+      {SBPacket::SBC_PACKET_HDO_SETTING, &SmartBoiler::handle_hdo_config_},
+#ifdef USE_SMARTBOILER_SCHEDULE
+      {SBPacket::SBC_PACKET_NIGHT_GETDAYS, &SmartBoiler::handle_schedule_},
+      {SBPacket::SBC_PACKET_NIGHT_GETDAYS2, &SmartBoiler::handle_schedule_},
+#endif
+  };
+
+  PacketHandlerTable table{};
+  for (const auto &entry : ENTRIES)
+    table[entry.packet] = entry.handler;
+  return table;
+}
+
+const SmartBoiler::PacketHandlerTable SmartBoiler::PACKET_HANDLERS = SmartBoiler::build_packet_handlers_();
+
+bool SmartBoiler::handle_pair_pin_(const SBProtocolResult &result) {
+  ESP_LOGD(TAG, "PIN pairing required.");
+  // water heater requires pairing of this client via PIN
+  this->set_state(ConnectionState::NEED_PIN);
+  return true;
+}
+
+bool SmartBoiler::handle_confirm_uid_(const SBProtocolResult &result) {
+  // all setting commands are sent with unique packet UID and confirmation from BT
+  // server is expected. Most of them contain no additional data, with exception of
+  // statistics, which are decoded by the handler of the request
+  ESP_LOGD(TAG, "Received confirmation for packet with UID: %0X", result.mUid);
+  ESP_LOGV(TAG, "Confirmation data: DATA=[%s]", format_hex_pretty(result.mPayload.data(), result.mPayload.size()).c_str());
+
+  // find original request in the table of sent packets
+  // UID 0 belongs to plain reads, which are never confirmed
+  auto pending = result.mUid != 0 ? this->sent_queue_.find_uid(result.mUid) : nullptr;
+  if (pending == nullptr) {
+    this->diagnostics_.on_unmatched_confirm();
+    return false;
+  }
+  ESP_LOGD(TAG, "original request was: %d", pending->request.mRqType);
+  // remove the sent request from the table as it was sucessfully accepted
+  this->complete_request_(pending, SBCompletion::CONFIRMED, &result);
+  return true;
+}
+
+bool SmartBoiler::handle_device_bonded_(const SBProtocolResult &result) {
+  ESP_LOGI(TAG, "Device is already paired with the water heater.");
+  this->set_state(ConnectionState::CONNECTED);
+  this->getInitData();
+  return true;
+}
+
+bool SmartBoiler::handle_pin_result_(const SBProtocolResult &result) {
+  int32_t pinResult;
+  if (result.parse_int(pinResult) && pinResult == 1) {
+    ESP_LOGI(TAG, "PIN is correct.");
+    this->set_state(ConnectionState::CONNECTED);
+    this->getInitData();
+    return true;
+  }
+  ESP_LOGW(TAG, "Wrong PIN provided, water heater response: %.*s", (int) result.mString.size(), result.mString.data());
+  return false;
+}
+
+bool SmartBoiler::handle_fw_version_(const SBProtocolResult &result) {
+  if (this->version_ == nullptr)
+    return true;
+  // Format: firmware;board revision;serial number
+  auto firstSemicol = result.mString.find(';');
+  if (firstSemicol != std::string_view::npos) {
+    auto secondSemicol = result.mString.find(';', firstSemicol + 1);
+    if (secondSemicol != std::string_view::npos) {
+      auto fwVersion = result.mString.substr(0, firstSemicol);
+      auto boardRev = result.mString.substr(firstSemicol + 1, secondSemicol - firstSemicol - 1);
+      auto serial = result.mString.substr(secondSemicol + 1);
+      char buffer[100];
+      snprintf(buffer, sizeof(buffer), "fw:%.*s, board: %.*s, S/N: %.*s", (int) fwVersion.size(), fwVersion.data(),
+               (int) boardRev.size(), boardRev.data(), (int) serial.size(), serial.data());
+      this->publish_text_(this->version_, buffer);
+      this->update_snapshot_text_(this->snapshot_.fw_version, sizeof(this->snapshot_.fw_version), buffer);
+      return true;
     }
-    case SBPacket::SBC_PACKET_HOME_SENSOR1: {
-      auto tempOpt = parse_number<float>(result.mString);
-      if (tempOpt.has_value()) {
-        this->temperature_sensor_1_sensor_->publish_state(*tempOpt);
-      }
+  }
+  ESP_LOGW(TAG, "Bad FW info format: %.*s", (int) result.mString.size(), result.mString.data());
+  return false;
+}
+
+#ifdef USE_SMARTBOILER_MODE
+bool SmartBoiler::handle_mode_(const SBProtocolResult &result) {
+  int32_t mode;
+  if (!result.parse_int(mode)) {
+    ESP_LOGW(TAG, "Bad mode string from water heater: %.*s", (int) result.mString.size(), result.mString.data());
+    return false;
+  }
+  auto modeAsString = mode >= 0 && mode <= UINT8_MAX ? this->convert_mode_to_action(uint8_t(mode)) : nullptr;
+  if (modeAsString == nullptr) {
+    ESP_LOGW(TAG, "Bad mode value from water heater: %d", (int) mode);
+    return false;
+  }
+  this->update_snapshot_(this->snapshot_.mode, uint8_t(mode));
+  // the reply may have been sent before the pending write was applied
+  if (this->mode_write_.pending)
+    return true;
+  if (this->mode_select_ && (!this->mode_select_->has_state() || this->mode_select_->state != modeAsString))
+    this->mode_select_->publish_state(modeAsString);
+  return true;
+}
+#endif
+
+#ifdef USE_SMARTBOILER_THERMOSTAT
+bool SmartBoiler::handle_temperature_(const SBProtocolResult &result) {
+  int32_t temp;
+  if (!result.parse_fixed(1, temp))
+    return false;
+  if (this->thermostat_) {
+    this->update_snapshot_(this->snapshot_.target_temperature, int16_t(temp));
+    if (!this->temperature_write_.pending)
+      this->thermostat_->publish_target_temp(temp / 10.0f);
+  }
+  return true;
+}
+#endif
+
+#ifdef USE_SMARTBOILER_TEMP1
+bool SmartBoiler::handle_sensor1_(const SBProtocolResult &result) {
+  int32_t temp;
+  if (!result.parse_fixed(1, temp))
+    return false;
+  if (this->temperature_sensor_1_sensor_)
+    this->publish_sensor_(this->temperature_sensor_1_sensor_, temp / 10.0f);
+  return true;
+}
+#endif
+
+bool SmartBoiler::handle_sensor2_(const SBProtocolResult &result) {
+  int32_t temp;
+  if (!result.parse_fixed(1, temp))
+    return false;
+#ifdef USE_SMARTBOILER_POWER
+  this->last_temp2_ = int16_t(temp);
+#endif
+#ifdef USE_SMARTBOILER_TEMP2
+  if (this->temperature_sensor_2_sensor_)
+    this->publish_sensor_(this->temperature_sensor_2_sensor_, temp / 10.0f);
+#endif
+#ifdef USE_SMARTBOILER_THERMOSTAT
+  if (this->thermostat_)
+    this->thermostat_->publish_current_temp(temp / 10.0f);
+#endif
+  return true;
+}
+
+bool SmartBoiler::handle_heating_state_(const SBProtocolResult &result) {
+  int32_t heat;
+  if (!result.parse_int(heat))
+    return false;
+  auto is_heating = heat == 1;
+  if (this->heat_on_sensor_)
+    this->heat_on_sensor_->publish_state(is_heating);
+#ifdef USE_SMARTBOILER_THERMOSTAT
+  if (this->thermostat_)
+    this->thermostat_->publish_action(is_heating);
+#endif
+#ifdef USE_SMARTBOILER_POWER
+  if (this->power_)
+    this->on_heating_(is_heating);
+#endif
+  return true;
+}
+
+bool SmartBoiler::handle_hdo_onoff_(const SBProtocolResult &result) {
+  int32_t hdo;
+  if (!result.parse_int(hdo))
+    return false;
+  this->isHdoEnabled = hdo == 1;
+  this->update_snapshot_(this->snapshot_.hdo_enabled, uint8_t(this->isHdoEnabled));
+  // without the decoder there is no low tariff
+  if (!this->isHdoEnabled)
+    this->publish_tariff_(false);
+  ESP_LOGI(TAG, "Internal HDO decoder is %s.", this->isHdoEnabled ? "enabled" : "disabled");
+  return true;
+}
+
+bool SmartBoiler::handle_name_(const SBProtocolResult &result) {
+  if (this->name_)
+    this->publish_text_(this->name_, result.mString);
+  this->update_snapshot_text_(this->snapshot_.name, sizeof(this->snapshot_.name), result.mString);
+  return true;
+}
+
+bool SmartBoiler::handle_capacity_(const SBProtocolResult &result) {
+  int32_t capacity;
+  if (!result.parse_int(capacity) || capacity <= 0)
+    return false;
+  ESP_LOGD(TAG, "Water heater capacity: %d l", (int) capacity);
+  this->update_snapshot_(this->snapshot_.capacity, uint16_t(capacity));
+  return true;
+}
+
+bool SmartBoiler::handle_error_(const SBProtocolResult &result) {
+  ESP_LOGW(TAG, "water heater indicates that the last request has failed");
+  this->flow_.on_error();
+  this->diagnostics_.on_home_error();
+  // the error does not tell which request failed: aggregate reads are rejected
+  // by firmware without them, otherwise it can only be the request in flight.
+  // One error fails one request, the older aggregate read if both are pending
+  SBPendingRequest *blamed = nullptr;
+  for (auto aggregate : {SBPacket::SBC_PACKET_HOME_ALL, SBPacket::SBC_PACKET_HDO_ALL}) {
+    auto pending = this->sent_queue_.find_read(aggregate);
+    if (pending != nullptr && (blamed == nullptr || int32_t(pending->sent_at - blamed->sent_at) < 0))
+      blamed = pending;
+  }
+  if (blamed == nullptr && this->sent_queue_.size() == 1)
+    blamed = this->sent_queue_.find_active();
+  if (blamed != nullptr)
+    this->fail_request_(blamed, SBCompletion::REJECTED, &result);
+  return true;
+}
+
+bool SmartBoiler::handle_home_all_(const SBProtocolResult &result) {
+  return this->handle_aggregate_(result, SB_HOME_ALL_FIELDS, sizeof(SB_HOME_ALL_FIELDS) / sizeof(SBPacket));
+}
+
+bool SmartBoiler::handle_hdo_all_(const SBProtocolResult &result) {
+  return this->handle_aggregate_(result, SB_HDO_ALL_FIELDS, sizeof(SB_HDO_ALL_FIELDS) / sizeof(SBPacket));
+}
+
+/**
+ * Split an aggregate reply and pass each value to the handler of its own
+ * packet, as if it was read separately.
+ */
+bool SmartBoiler::handle_aggregate_(const SBProtocolResult &result, const SBPacket *fields, size_t count) {
+  std::string_view values[SB_AGGREGATE_MAX_FIELDS];
+  size_t found = 0;
+  size_t start = 0;
+  while (found < SB_AGGREGATE_MAX_FIELDS) {
+    auto end = result.mString.find(';', start);
+    values[found++] = result.mString.substr(start, end == std::string_view::npos ? end : end - start);
+    if (end == std::string_view::npos)
       break;
+    start = end + 1;
+  }
+  if (found != count) {
+    ESP_LOGW(TAG, "Unexpected format of aggregate packet %d: %.*s", result.mRqType, (int) result.mString.size(),
+             result.mString.data());
+    this->disable_aggregate_(result.mRqType);
+    return false;
+  }
+
+  uint32_t now = millis();
+  for (size_t i = 0; i < count; i++) {
+    // a malformed field is read again at its own interval
+    auto handler = PACKET_HANDLERS[fields[i]];
+    if (handler != nullptr && !(this->*handler)(SBProtocolResult(fields[i], values[i])))
+      continue;
+    this->poller_.mark_updated(fields[i], now);
+    this->poller_.refreshed(fields[i], now);
+  }
+  return true;
+}
+
+bool &SmartBoiler::aggregate_unsupported_(SBPacket aggregate) {
+  return aggregate == SBPacket::SBC_PACKET_HOME_ALL ? this->home_all_unsupported_ : this->hdo_all_unsupported_;
+}
+
+uint8_t &SmartBoiler::aggregate_failures_(SBPacket aggregate) {
+  return aggregate == SBPacket::SBC_PACKET_HOME_ALL ? this->home_all_failures_ : this->hdo_all_failures_;
+}
+
+/**
+ * Stop using an aggregate packet and read its values one by one.
+ */
+void SmartBoiler::disable_aggregate_(SBPacket aggregate) {
+  if (this->aggregate_unsupported_(aggregate))
+    return;
+  ESP_LOGI(TAG, "Water heater does not support packet %d, reading values separately", aggregate);
+  this->aggregate_unsupported_(aggregate) = true;
+  uint32_t now = millis();
+  for (size_t i = 0; i < this->poller_.size(); i++) {
+    auto packet = this->poller_.at(i).packet;
+    if (sb_aggregate_of(packet) == aggregate)
+      this->poller_.make_due(packet, now);
+  }
+}
+
+bool SmartBoiler::handle_time_(const SBProtocolResult &result) {
+  uint32_t seconds;
+  if (!parse_week_time_(result.mString, seconds)) {
+    ESP_LOGW(TAG, "Bad time format: %.*s", (int) result.mString.size(), result.mString.data());
+    return false;
+  }
+  auto time = result.mString.substr(2, 8);
+  ESP_LOGD(TAG, "Water heater internal time: %s, %.*s", this->day_to_string(seconds / 86400), (int) time.size(),
+           time.data());
+  this->clock_known_ = true;
+  this->clock_week_s_ = seconds;
+  this->clock_ref_ms_ = millis();
+  return true;
+}
+
+bool SmartBoiler::parse_week_time_(std::string_view text, uint32_t &seconds) {
+  // D.HH:MM:SS
+  if (text.size() < 10 || text[1] != '.' || text[4] != ':' || text[7] != ':')
+    return false;
+  for (size_t i : {0, 2, 3, 5, 6, 8, 9}) {
+    if (text[i] < '0' || text[i] > '9')
+      return false;
+  }
+  uint32_t day = text[0] - '0';
+  uint32_t hours = (text[2] - '0') * 10 + (text[3] - '0');
+  uint32_t minutes = (text[5] - '0') * 10 + (text[6] - '0');
+  uint32_t secs = (text[8] - '0') * 10 + (text[9] - '0');
+  if (day > 6 || hours > 23 || minutes > 59 || secs > 59)
+    return false;
+  seconds = ((day * 24 + hours) * 60 + minutes) * 60 + secs;
+  return true;
+}
+
+bool SmartBoiler::week_time_(uint32_t &seconds) {
+  if (!this->clock_known_)
+    return false;
+  seconds = (this->clock_week_s_ + (millis() - this->clock_ref_ms_) / 1000) % SB_WEEK_SECONDS;
+  return true;
+}
+
+void SmartBoiler::restore_tariff_model_() {
+  this->tariff_pref_ =
+      global_preferences->make_preference<SavedTariffModel>(this->preference_hash_() ^ TARIFF_HASH_SALT);
+  SavedTariffModel saved{};
+  if (this->tariff_pref_.load(&saved) && saved.version == TARIFF_MODEL_VERSION) {
+    this->tariff_model_.data() = saved.slots;
+    ESP_LOGD(TAG, "Restored HDO tariff model, %u%% of the week learned", this->tariff_model_.coverage());
+  }
+}
+
+/**
+ * Publish the tariff predicted by the model and ask the water heater for the
+ * actual one: every TARIFF_LEARN_INTERVAL while the current quarter-hour is
+ * not learned yet, otherwise every hdo_check_interval_.
+ */
+void SmartBoiler::update_tariff_() {
+  uint32_t week_s;
+  if (this->hdo_low_tariff_sensor_ == nullptr || !this->isHdoEnabled || !this->week_time_(week_s))
+    return;
+  uint32_t now = millis();
+  auto slot = SBTariffModel::slot_of(week_s);
+  bool confident = this->tariff_model_.is_confident(slot);
+  if (confident)
+    this->publish_tariff_(this->tariff_model_.predict_low(slot));
+  if (this->state_ == ConnectionState::CONNECTED && int32_t(now - this->tariff_next_check_) >= 0) {
+    this->tariff_next_check_ = now + (confident ? this->hdo_check_interval_ : TARIFF_LEARN_INTERVAL);
+    this->request_value(SBPacket::SBC_PACKET_HDO_LESSEXPTARIFFAVAILABLENOW);
+  }
+
+  if (this->tariff_model_.take_dirty())
+    this->tariff_dirty_ = true;
+  if (this->tariff_dirty_ && (this->tariff_saved_at_ == 0 || now - this->tariff_saved_at_ >= TARIFF_SAVE_INTERVAL)) {
+    SavedTariffModel saved{};
+    saved.version = TARIFF_MODEL_VERSION;
+    saved.slots = this->tariff_model_.data();
+    this->tariff_pref_.save(&saved);
+    this->tariff_dirty_ = false;
+    this->tariff_saved_at_ = now;
+    ESP_LOGD(TAG, "Saved HDO tariff model, %u%% of the week learned", this->tariff_model_.coverage());
+  }
+}
+
+void SmartBoiler::publish_tariff_(bool low) {
+  auto sensor = this->hdo_low_tariff_sensor_;
+  if (sensor != nullptr && (!sensor->has_state() || sensor->state != low))
+    sensor->publish_state(low);
+}
+
+/**
+ * Actual tariff reported by the water heater. The same tariff observed
+ * twice shortly after each other is assumed for all slots in between; after
+ * a switch, LASTHDOTIME tells where the edge is.
+ */
+bool SmartBoiler::handle_tariff_now_(const SBProtocolResult &result) {
+  int32_t value;
+  if (!result.parse_int(value))
+    return false;
+  bool low = value == 1;
+  this->publish_tariff_(low);
+  uint32_t week_s;
+  if (!this->week_time_(week_s))
+    return true;
+  uint32_t now = millis();
+  auto slot = SBTariffModel::slot_of(week_s);
+  if (this->tariff_model_.is_confident(slot) && this->tariff_model_.predict_low(slot) != low) {
+    ESP_LOGI(TAG, "HDO tariff is %s, but the model predicted otherwise", low ? "low" : "high");
+    // follow the change closely until it is learned
+    this->tariff_next_check_ = now + TARIFF_LEARN_INTERVAL;
+  }
+
+  bool recent = this->has_tariff_obs_ &&
+                now - this->tariff_obs_at_ <= TARIFF_MAX_GAP_SLOTS * SB_TARIFF_SLOT_SECONDS * 1000 &&
+                SBTariffModel::distance(this->tariff_obs_slot_, slot) <= TARIFF_MAX_GAP_SLOTS;
+  if (recent && low == this->tariff_obs_low_) {
+    // each slot counts once per week, the previous one is already observed
+    if (slot != this->tariff_obs_slot_)
+      this->tariff_model_.observe((this->tariff_obs_slot_ + 1) % SB_TARIFF_SLOTS, slot, low);
+  } else {
+    this->tariff_model_.observe(slot, slot, low);
+    if (recent) {
+      uint16_t from = this->tariff_obs_slot_;
+      this->request_value(SBPacket::SBC_PACKET_HDO_LASTHDOTIME, 0,
+                          [this, from, slot, low](SBCompletion status, const SBProtocolResult *result) {
+                            if (status == SBCompletion::REPLIED)
+                              this->handle_hdo_last_time_(*result, from, slot, low);
+                          });
     }
-    case SBPacket::SBC_PACKET_HOME_SENSOR2: {
-      auto tempOpt = parse_number<float>(result.mString);
-      if (tempOpt.has_value()) {
-        this->temperature_sensor_2_sensor_->publish_state(*tempOpt);
-        if (this->thermostat_)
-          this->thermostat_->publish_current_temp(*tempOpt);
-      }
+  }
+  this->has_tariff_obs_ = true;
+  this->tariff_obs_low_ = low;
+  this->tariff_obs_slot_ = slot;
+  this->tariff_obs_at_ = now;
+  return true;
+}
+
+void SmartBoiler::handle_hdo_last_time_(const SBProtocolResult &result, uint16_t from, uint16_t to, bool low) {
+  uint32_t seconds;
+  if (!parse_week_time_(result.mString, seconds)) {
+    ESP_LOGD(TAG, "Unknown format of the last HDO time: %.*s", (int) result.mString.size(), result.mString.data());
+    return;
+  }
+  ESP_LOGD(TAG, "Last HDO switch: %s %.*s", this->day_to_string(seconds / 86400), 8, result.mString.data() + 2);
+  auto edge = SBTariffModel::slot_of(seconds);
+  // the switch must lie between both observations
+  if (SBTariffModel::distance(from, edge) > SBTariffModel::distance(from, to))
+    return;
+  auto before = [](uint16_t slot) -> uint16_t { return (slot + SB_TARIFF_SLOTS - 1) % SB_TARIFF_SLOTS; };
+  if (edge != from)
+    this->tariff_model_.observe(from, before(edge), !low);
+  if (edge != to)
+    this->tariff_model_.observe(edge, before(to), low);
+}
+
+/**
+ * Settings of the HDO receiver. They select the ripple control commands the
+ * water heater reacts to, so the learned tariff model is dropped when they
+ * change.
+ */
+bool SmartBoiler::handle_hdo_config_(const SBProtocolResult &result) {
+  size_t index;
+  switch (result.mRqType) {
+    case SBPacket::SBC_PACKET_HDO_SELECTION_A:
+      index = 0;
       break;
-    }
-    case SBPacket::SBC_PACKET_HOME_HSRCSTATE: {
-      auto heatOpt = parse_number<int>(result.mString);
-      auto is_heating = *heatOpt == 1;
-      this->heat_on_sensor_->publish_state(is_heating);
-      if (thermostat_)
-        this->thermostat_->publish_action(is_heating);
+    case SBPacket::SBC_PACKET_HDO_SELECTION_B:
+      index = 1;
       break;
-    }
-    case SBPacket::SBC_PACKET_HDO_ONOFF: {
-      auto hdoOpt = parse_number<int>(result.mString);
-      this->isHdoEnabled = hdoOpt.value() == 1;
-      this->hdo_low_tariff_sensor_->publish_state(this->isHdoEnabled);
-      ESP_LOGI(TAG, "Internal HDO decoder is %s.", this->isHdoEnabled ? "enabled" : "disabled");
+    case SBPacket::SBC_PACKET_HDO_SELECTION_DP:
+      index = 2;
       break;
-    }
-    case SBPacket::SBC_PACKET_HOME_BOILERNAME: {
-      this->name_->publish_state(result.mString);
+    case SBPacket::SBC_PACKET_HDO_FREQUENCY:
+      index = 3;
       break;
-    }
-    case SBPacket::SBC_PACKET_HOME_ERROR: {
-      ESP_LOGW(TAG, "water heater indicates that the last request has failed");
+    default:
+      index = 4;
       break;
+  }
+  auto &field = this->hdo_config_[index];
+  auto value = result.mString.substr(0, HDO_CONFIG_SIZE - 1);
+  // an empty reply carries no configuration
+  if (value.empty())
+    return false;
+  if (value == field.data())
+    return true;
+  if (field[0] != 0) {
+    ESP_LOGI(TAG, "HDO configuration changed, learning the tariff again");
+    this->tariff_model_.clear();
+  }
+  memcpy(field.data(), value.data(), value.size());
+  field[value.size()] = 0;
+  ESP_LOGD(TAG, "HDO configuration %d: %s", result.mRqType, field.data());
+  return true;
+}
+
+#ifdef USE_SMARTBOILER_EVENT_LOG
+/**
+ * Read entries of the water heater's event log which were not reported yet.
+ * FIRSTLOG returns the newest entry, each NEXTLOG the one before; LOG_PIPELINE
+ * NEXTLOG requests are kept on their way, so the flow control paces the read.
+ */
+void SmartBoiler::start_log_sync_() {
+  if (!this->event_log_ || this->log_syncing_)
+    return;
+  this->log_batch_size_ = 0;
+  this->log_outstanding_ = 0;
+  if (!this->enqueue_command_(SBProtocolRequest(SBPacket::SBC_PACKET_GLOBAL_FIRSTLOG),
+                              [this](SBCompletion status, const SBProtocolResult *result) {
+                                this->on_log_read_(status, result);
+                              }))
+    return;
+  this->log_syncing_ = true;
+  this->log_outstanding_++;
+}
+
+void SmartBoiler::handle_log_entry_(const SBProtocolResult &result) {
+  if (!this->log_syncing_)
+    return;
+  if (this->log_outstanding_ > 0)
+    this->log_outstanding_--;
+  SBLogEntry entry;
+  entry.time = result.get<SBLogEntryLayout::Time>();
+  entry.code = result.get<SBLogEntryLayout::Code>();
+  ESP_LOGV(TAG, "Event log entry: code %u at %u", entry.code, entry.time);
+
+  // the log ends with an empty entry, a wrap around or the entries reported already
+  bool older = this->log_batch_size_ == 0 || entry.time < this->log_batch_[this->log_batch_size_ - 1].time;
+  if (entry.time == 0 || entry.time <= this->log_cursor_ || !older) {
+    this->finish_log_sync_(true);
+    return;
+  }
+  this->log_batch_[this->log_batch_size_++] = entry;
+  if (this->log_batch_size_ == LOG_RING_SIZE) {
+    ESP_LOGW(TAG, "More than %u new event log entries, older ones are skipped", LOG_RING_SIZE);
+    this->finish_log_sync_(true);
+    return;
+  }
+  while (this->log_outstanding_ < LOG_PIPELINE &&
+         this->enqueue_command_(SBProtocolRequest(SBPacket::SBC_PACKET_GLOBAL_NEXTLOG),
+                                [this](SBCompletion status, const SBProtocolResult *result) {
+                                  this->on_log_read_(status, result);
+                                }))
+    this->log_outstanding_++;
+  if (this->log_outstanding_ == 0)
+    this->finish_log_sync_(false);
+}
+
+// a log read is never repeated, the water heater may have moved on to the next entry already
+void SmartBoiler::on_log_read_(SBCompletion status, const SBProtocolResult *result) {
+  if (status == SBCompletion::REPLIED)
+    this->handle_log_entry_(*result);
+  else if (this->log_syncing_)
+    this->finish_log_sync_(false);
+}
+
+/**
+ * Report the entries of a complete read, oldest first, and store the cursor.
+ * An interrupted read reports nothing and is repeated by the next one.
+ */
+void SmartBoiler::finish_log_sync_(bool complete) {
+  this->log_syncing_ = false;
+  if (!complete) {
+    ESP_LOGW(TAG, "Event log read interrupted after %u new entries", this->log_batch_size_);
+    return;
+  }
+  if (this->log_batch_size_ == 0) {
+    ESP_LOGD(TAG, "No new event log entries");
+    return;
+  }
+  for (size_t i = this->log_batch_size_; i-- > 0;) {
+    const auto &entry = this->log_batch_[i];
+    ESP_LOGI(TAG, "Event log: code %u at %u", entry.code, entry.time);
+    if (this->log_entries_.full())
+      this->log_entries_.pop();
+    this->log_entries_.push(SBLogEntry(entry));
+    this->log_entry_callback_.call(entry.time, entry.code);
+  }
+  const auto &newest = this->log_batch_[0];
+  if (this->last_event_) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "code %u at %u", newest.code, newest.time);
+    this->publish_text_(this->last_event_, buffer);
+  }
+  this->log_cursor_ = newest.time;
+  this->log_cursor_pref_.save(&this->log_cursor_);
+  this->log_batch_size_ = 0;
+}
+#endif
+
+#ifdef USE_SMARTBOILER_SCHEDULE
+bool SmartBoiler::handle_schedule_(const SBProtocolResult &result) {
+  bool read;
+  if (result.mRqType == SBPacket::SBC_PACKET_NIGHT_GETDAYS)
+    read = this->read_schedule_days_<SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS>::Hours>(result, 0);
+  else
+    read = this->read_schedule_days_<SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS2>::Hours>(
+        result, SB_SCHEDULE_FIRST_PART_DAYS);
+  if (read)
+    this->publish_schedule_();
+  return read;
+}
+
+template<typename Hours> bool SmartBoiler::read_schedule_days_(const SBProtocolResult &result, uint8_t first) {
+  if (result.mPayload.count<Hours>() < Hours::COUNT) {
+    ESP_LOGW(TAG, "Schedule packet %d too short: %u bytes", result.mRqType, result.mPayload.size());
+    return false;
+  }
+  for (uint8_t i = 0; i < Hours::COUNT; i++) {
+    this->schedule_.on_read(first + i, result.mPayload.get<Hours>(i));
+    if (this->schedule_.take_rejected())
+      ESP_LOGW(TAG, "Water heater did not accept the schedule of %s", this->day_to_string(first + i));
+  }
+  return true;
+}
+
+template<typename Hours> void SmartBoiler::write_schedule_days_(SBProtocolRequest &cmd, uint8_t first) {
+  for (uint8_t i = 0; i < Hours::COUNT; i++)
+    cmd.put<Hours>(i, this->schedule_.get(first + i));
+}
+
+void SmartBoiler::set_schedule(uint8_t day, const std::string &hours) {
+  uint32_t mask;
+  if (!SBSchedule::parse_hours(hours, mask) || !this->schedule_.set(day, mask)) {
+    ESP_LOGW(TAG, "Invalid schedule: day %u, hours '%s'", day, hours.c_str());
+    return;
+  }
+  ESP_LOGD(TAG, "Schedule of %s set to '%s'", this->day_to_string(day), hours.c_str());
+}
+
+/**
+ * Send the changed days of the schedule, see SBSchedule::plan().
+ */
+void SmartBoiler::write_schedule_() {
+  SBScheduleWrite writes[SB_SCHEDULE_DAYS];
+  size_t count = this->schedule_.plan(writes);
+  for (size_t i = 0; i < count; i++) {
+    const auto &write = writes[i];
+    auto cmd = SBProtocolRequest(write.packet, this->next_uid_());
+    switch (write.packet) {
+      case SBPacket::SBC_PACKET_NIGHT_SAVEDAY:
+        cmd.put<SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAY>::Day>(write.first_day);
+        this->write_schedule_days_<SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAY>::Hours>(cmd, write.first_day);
+        break;
+      case SBPacket::SBC_PACKET_NIGHT_SAVEDAYS:
+        this->write_schedule_days_<SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS>::Hours>(cmd, write.first_day);
+        break;
+      default:
+        this->write_schedule_days_<SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS2>::Hours>(cmd, write.first_day);
+        break;
     }
-    case SBPacket::SBC_PACKET_HOME_TIME: {
-      // time is in format D.HH:MM:SS
-      // first byte is day
-      auto day = result.mString[0] - '0';
-      // the rest is a string
-      auto time = result.mString.substr(2,8);
-      char buffer[30];
-      sprintf(buffer, "%s, %s", this->day_to_string(day), time.c_str());
-      ESP_LOGD(TAG, "Water heater internal time: %s", buffer);
+    ESP_LOGD(TAG, "Writing schedule: packet %d, %u day(s) from %s", write.packet, write.count,
+             this->day_to_string(write.first_day));
+    // read the written days back, also after a failure to see what the water heater kept
+    auto read_back = write.first_day < SB_SCHEDULE_FIRST_PART_DAYS ? SBPacket::SBC_PACKET_NIGHT_GETDAYS
+                                                                     : SBPacket::SBC_PACKET_NIGHT_GETDAYS2;
+    this->enqueue_command_(std::move(cmd), [this, read_back](SBCompletion status, const SBProtocolResult *result) {
+      if (status != SBCompletion::CANCELLED)
+        this->poller_.make_due(read_back, millis());
+    });
+  }
+}
+
+void SmartBoiler::publish_schedule_() {
+  if (this->schedule_txt_ == nullptr || !this->schedule_.complete())
+    return;
+  // e.g. "Mo 0-5,22-23; Tu 0-5; ..."
+  static const char *const DAYS[SB_SCHEDULE_DAYS] = {"Mo", "Tu", "We", "Th", "Fr", "Sa", "Su"};
+  char buffer[256];
+  size_t pos = 0;
+  for (uint8_t day = 0; day < SB_SCHEDULE_DAYS && pos + 4 < sizeof(buffer); day++) {
+    pos += snprintf(buffer + pos, sizeof(buffer) - pos, "%s%s ", day ? "; " : "", DAYS[day]);
+    if (pos + 1 >= sizeof(buffer))
       break;
+    pos += SBSchedule::format_hours(this->schedule_.get(day), buffer + pos, sizeof(buffer) - pos);
+  }
+  this->publish_text_(this->schedule_txt_, std::string_view(buffer, pos < sizeof(buffer) ? pos : sizeof(buffer) - 1));
+}
+#endif
+
+void SmartBoiler::request_consumption_() {
+  ESP_LOGD(TAG, "Requesting consumption");
+  this->consumption_requested_at_ = millis();
+  this->enqueue_command_(SBProtocolRequest(SBC_PACKET_STATISTICS_GETALL, this->next_uid_()),
+                         [this](SBCompletion status, const SBProtocolResult *result) {
+                           this->on_consumption_(status, result);
+                         });
+}
+
+// lifetime consumption in Wh and the device time of the reading, sent with the confirmation
+void SmartBoiler::on_consumption_(SBCompletion status, const SBProtocolResult *result) {
+  if (status != SBCompletion::CONFIRMED)
+    return;
+  uint32_t consumption = result->get<SBLayout<SBC_PACKET_STATISTICS_GETALL>::Consumption>();
+  if (this->consumption_sensor_)
+    this->publish_sensor_(this->consumption_sensor_, (float) consumption / 1000);
+#ifdef USE_SMARTBOILER_POWER
+  if (this->power_)
+    this->on_consumption_sample_(consumption, result->get<SBLayout<SBC_PACKET_STATISTICS_GETALL>::Time>());
+#endif
+#ifdef USE_SMARTBOILER_HISTORY
+  // buckets change only together with the lifetime counter
+  if (this->history_ && consumption != this->last_consumption_)
+    this->refresh_history_();
+  this->last_consumption_ = consumption;
+#endif
+}
+
+#ifdef USE_SMARTBOILER_POWER
+/**
+ * The heating element was switched. The power follows right away from the
+ * measured rated power; the counter is read to mark the start or the end of
+ * the heating cycle.
+ */
+void SmartBoiler::on_heating_(bool heating) {
+  uint32_t now = millis();
+  if (!this->heating_known_) {
+    // a cycle in progress when connecting is not measured
+    this->heating_known_ = true;
+    this->power_estimator_.set_heating(heating, now);
+    return;
+  }
+  if (heating == this->power_estimator_.is_heating())
+    return;
+  this->power_estimator_.set_heating(heating, now);
+  float rated = this->power_estimator_.get_rated_power();
+  if (!heating || rated > 0)
+    this->publish_sensor_(this->power_sensor_, heating ? rated : 0.0f);
+  if (heating) {
+    this->cycle_running_ = true;
+    this->cycle_closing_ = false;
+    this->cycle_start_wh_ = UINT32_MAX;
+    this->cycle_start_temp_ = this->last_temp2_;
+    this->cycle_started_at_ = now;
+  } else if (this->cycle_running_) {
+    this->cycle_closing_ = true;
+  }
+  this->request_consumption_();
+}
+
+void SmartBoiler::on_consumption_sample_(uint32_t wh, uint32_t device_time) {
+  uint32_t now = millis();
+  if (this->power_estimator_.add_sample(wh, device_time, now)) {
+    ESP_LOGD(TAG, "Average power %.0f W, heating element %.0f W", this->power_estimator_.get_rate(),
+             this->power_estimator_.get_rated_power());
+    this->publish_sensor_(this->power_sensor_, this->power_estimator_.get_rate());
+  }
+  if (!this->cycle_running_)
+    return;
+  if (this->cycle_start_wh_ == UINT32_MAX) {
+    // a cycle which ended before its start was read is not measured
+    if (this->cycle_closing_)
+      this->cycle_running_ = false;
+    else
+      this->cycle_start_wh_ = wh;
+    return;
+  }
+  if (!this->cycle_closing_)
+    return;
+  this->cycle_running_ = false;
+  uint32_t energy = wh - this->cycle_start_wh_;
+  this->publish_sensor_(this->cycle_energy_sensor_, energy / 1000.0f);
+  // heat stored in the water, capacity is in liters
+  if (this->snapshot_.capacity && this->cycle_start_temp_ != INT16_MIN && this->last_temp2_ != INT16_MIN) {
+    float rise = (this->last_temp2_ - this->cycle_start_temp_) / 10.0f;
+    ESP_LOGI(TAG, "Heating cycle: %u Wh in %u s, water %+.1f °C, %.0f Wh stored in %u l", energy,
+             (now - this->cycle_started_at_) / 1000, rise, rise * this->snapshot_.capacity * SB_WATER_WH_PER_LITER_KELVIN,
+             this->snapshot_.capacity);
+  } else {
+    ESP_LOGI(TAG, "Heating cycle: %u Wh in %u s", energy, (now - this->cycle_started_at_) / 1000);
+  }
+}
+#endif
+
+#ifdef USE_SMARTBOILER_HISTORY
+/**
+ * Schedule reading of the consumption history buckets which may have
+ * changed since the last refresh.
+ */
+void SmartBoiler::refresh_history_() {
+  uint8_t indexes[YEAR_BUCKETS];
+  this->history_requests_.clear();
+  size_t count = this->week_history_.start_refresh(indexes);
+  for (size_t i = 0; i < count; i++)
+    this->history_requests_.push({SBPacket::SBC_PACKET_STATISTICS_WEEK, indexes[i]});
+  count = this->year_history_.start_refresh(indexes);
+  for (size_t i = 0; i < count; i++)
+    this->history_requests_.push({SBPacket::SBC_PACKET_STATISTICS_YEAR, indexes[i]});
+}
+
+void SmartBoiler::request_history_() {
+  // leave room in the command queue for polls and user commands
+  if (this->state_ != ConnectionState::CONNECTED || this->history_requests_.empty() ||
+      this->command_queue_.size() >= COMMAND_QUEUE_SIZE / 2)
+    return;
+  auto bucket = this->history_requests_.pop();
+  auto cmd = SBProtocolRequest(bucket.packet, this->next_uid_());
+  cmd.put<SBStatisticsBucketLayout::Index>(bucket.index);
+  this->enqueue_command_(std::move(cmd), [this, bucket](SBCompletion status, const SBProtocolResult *result) {
+    this->on_history_(bucket, status, result);
+  });
+}
+
+void SmartBoiler::on_history_(SBHistoryRequest bucket, SBCompletion status, const SBProtocolResult *result) {
+  if (status != SBCompletion::CONFIRMED)
+    return;
+  uint32_t consumption = result->get<SBStatisticsBucketLayout::Consumption>();
+  bool week = bucket.packet == SBPacket::SBC_PACKET_STATISTICS_WEEK;
+  ESP_LOGD(TAG, "Consumption in %s bucket %u: %u Wh", week ? "week" : "year", bucket.index, consumption);
+  if (week)
+    this->week_history_.update(bucket.index, consumption);
+  else
+    this->year_history_.update(bucket.index, consumption);
+  this->publish_history_();
+}
+
+void SmartBoiler::publish_history_() {
+  if (this->week_history_.has_current())
+    this->publish_sensor_(this->energy_today_, this->week_history_.current() / 1000.0f);
+  if (this->week_history_.complete())
+    this->publish_sensor_(this->energy_week_, this->week_history_.total() / 1000.0f);
+  if (this->year_history_.has_current())
+    this->publish_sensor_(this->energy_month_, this->year_history_.current() / 1000.0f);
+  if (this->year_history_.complete())
+    this->publish_sensor_(this->energy_year_, this->year_history_.total() / 1000.0f);
+}
+#endif
+
+/**
+ * One line per frame: SBCAP <millis> <T|R> <connection ID> <length> <hex data>.
+ * Frames longer than SB_CAPTURE_FRAME_SIZE are cut, length is the original one.
+ */
+void SmartBoiler::dump_capture() {
+#ifdef USE_SMARTBOILER_CAPTURE
+  if (!this->capture_enabled_) {
+    ESP_LOGW(TAG, "[%s] Packet capture is not enabled, set packet_capture to use it",
+             this->parent()->address_str().c_str());
+    return;
+  }
+  ESP_LOGI(TAG, "[%s] Captured frames: %u", this->parent()->address_str().c_str(), this->capture_.size());
+  for (size_t i = 0; i < this->capture_.size(); i++) {
+    const auto &record = this->capture_.at(i);
+    static const char *const DIGITS = "0123456789abcdef";
+    char hex[SB_CAPTURE_FRAME_SIZE * 2 + 1];
+    size_t stored = record.stored_length();
+    for (size_t j = 0; j < stored; j++) {
+      hex[2 * j] = DIGITS[record.data[j] >> 4];
+      hex[2 * j + 1] = DIGITS[record.data[j] & 0x0F];
     }
-    default:
+    hex[2 * stored] = 0;
+    ESP_LOGI(TAG, "SBCAP %u %c %u %u %s", record.time, char(record.direction), record.conn_id, record.length, hex);
+  }
+#else
+  ESP_LOGW(TAG, "Packet capture is not enabled, set packet_capture to use it");
+#endif
+}
+
+#ifdef USE_SMARTBOILER_DIAGNOSTICS
+void SmartBoiler::dump_diagnostics_() {
+  uint32_t now = millis();
+  ESP_LOGCONFIG(TAG, "  Diagnostics:");
+  ESP_LOGCONFIG(TAG, "    Queue peaks: commands %u/%u, sent %u/%u", this->diagnostics_.get_command_queue_peak(),
+                COMMAND_QUEUE_SIZE, this->diagnostics_.get_sent_queue_peak(), SENT_QUEUE_SIZE);
+  ESP_LOGCONFIG(TAG, "    Unmatched confirms: %u, HOME_ERROR replies: %u, write failures: %u, reconnects: %u",
+                this->diagnostics_.get_unmatched_confirms(), this->diagnostics_.get_home_errors(),
+                this->diagnostics_.get_write_failures(), this->diagnostics_.get_reconnects());
+  ESP_LOGCONFIG(TAG, "    Rolled back settings: %u", this->diagnostics_.get_rollbacks());
+  for (auto state : {ConnectionState::DISCONNECTED, ConnectionState::AUTHENTICATING, ConnectionState::CONNECTED,
+                     ConnectionState::NEED_PIN})
+    ESP_LOGCONFIG(TAG, "    %s: %u s", this->state_to_string(state),
+                  this->diagnostics_.get_time_in_state(uint8_t(state), now) / 1000);
+  const auto &all = this->diagnostics_.get_all();
+  ESP_LOGCONFIG(TAG, "    RTT of %u replies: p50 < %u ms, p90 < %u ms, p99 < %u ms", all.total(), all.percentile(50),
+                all.percentile(90), all.percentile(99));
+  for (const auto &histogram : this->diagnostics_.get_histograms()) {
+    if (histogram.packet == SBPacket::SBC_PACKET_NONE)
       break;
+    // replies per bucket, bucket i ends at 2^(i+1) ms
+    char buffer[SBRttHistogram::BUCKETS * 6 + 1];
+    size_t pos = 0;
+    for (auto count : histogram.counts)
+      pos += snprintf(buffer + pos, sizeof(buffer) - pos, " %u", count);
+    ESP_LOGCONFIG(TAG, "    RTT of REQ %d:%s", histogram.packet, buffer);
+  }
+}
+
+void SmartBoiler::publish_diagnostics_() {
+  const auto &all = this->diagnostics_.get_all();
+  if (this->rtt_sensor_ && all.total() > 0)
+    this->rtt_sensor_->publish_state(all.percentile(90));
+  if (this->home_errors_sensor_)
+    this->home_errors_sensor_->publish_state(this->diagnostics_.get_home_errors());
+  if (this->write_failures_sensor_)
+    this->write_failures_sensor_->publish_state(this->diagnostics_.get_write_failures());
+  if (this->unmatched_confirms_sensor_)
+    this->unmatched_confirms_sensor_->publish_state(this->diagnostics_.get_unmatched_confirms());
+  if (this->reconnects_sensor_)
+    this->reconnects_sensor_->publish_state(this->diagnostics_.get_reconnects());
+  if (this->queue_peak_sensor_)
+    this->queue_peak_sensor_->publish_state(this->diagnostics_.get_command_queue_peak());
+  if (this->rollbacks_sensor_)
+    this->rollbacks_sensor_->publish_state(this->diagnostics_.get_rollbacks());
+}
+#endif
+
+void SmartBoiler::update_snapshot_text_(char *field, size_t size, std::string_view value) {
+  if (value.size() >= size)
+    value = value.substr(0, size - 1);
+  if (value == field)
+    return;
+  // an empty value may have no buffer at all
+  if (!value.empty())
+    memcpy(field, value.data(), value.size());
+  field[value.size()] = 0;
+  this->snapshot_dirty_ = true;
+}
+
+/**
+ * Log how long ago each polled value was last received.
+ */
+void SmartBoiler::log_value_ages_() {
+  uint32_t now = millis();
+  for (size_t i = 0; i < this->poller_.size(); i++) {
+    const auto &entry = this->poller_.at(i);
+    if (entry.last_update == 0)
+      ESP_LOGD(TAG, "Value %d: not received yet", entry.packet);
+    else
+      ESP_LOGD(TAG, "Value %d: updated %u s ago", entry.packet, (now - entry.last_update) / 1000);
+  }
+}
+
+uint32_t SmartBoiler::get_value_age(SBPacket packet) {
+  auto entry = this->poller_.find(packet);
+  if (entry == nullptr || entry->last_update == 0)
+    return UINT32_MAX;
+  return millis() - entry->last_update;
+}
+
+/**
+ * Release an answered request, feed its round-trip time to the flow control
+ * and send the next command right away. Logs time from queueing the request
+ * to publishing its reply; the first reply after authentication also reports
+ * time-to-first-data.
+ */
+void SmartBoiler::complete_request_(SBPendingRequest *pending, SBCompletion status, const SBProtocolResult *result) {
+  uint32_t now = millis();
+  ESP_LOGD(TAG, "Latency: REQ: %d answered after %u ms, RTT %u ms", pending->request.mRqType,
+           now - pending->request.mQueuedAt, now - pending->sent_at);
+  if (!this->first_data_received_ && this->state_ == ConnectionState::CONNECTED) {
+    this->first_data_received_ = true;
+    ESP_LOGI(TAG, "First data received %u ms after authentication", now - this->auth_started_at_);
+  }
+  // RTT of a retransmitted request is ambiguous
+  if (pending->attempts == 1) {
+    this->flow_.on_reply(now - pending->sent_at);
+    this->diagnostics_.on_reply(pending->request.mRqType, now - pending->sent_at);
+  }
+  // the slot is free before the handler runs, it may send the next request
+  auto on_done = std::move(pending->on_done);
+  this->sent_queue_.release(pending);
+  if (on_done)
+    on_done(status, result);
+  this->process_command_queue_();
+}
+
+void SmartBoiler::fail_request_(SBPendingRequest *pending, SBCompletion status, const SBProtocolResult *result) {
+  auto on_done = std::move(pending->on_done);
+  this->sent_queue_.release(pending);
+  if (on_done)
+    on_done(status, result);
+}
+
+void SmartBoiler::cancel_requests_() {
+  // handlers run after both queues are empty, anything they send starts afresh
+  SBCompletionHandlers handlers[COMMAND_QUEUE_SIZE + SENT_QUEUE_SIZE];
+  size_t count = 0;
+  while (!this->command_queue_.empty()) {
+    auto command = this->command_queue_.pop();
+    if (command.on_done)
+      handlers[count++] = std::move(command.on_done);
+  }
+  for (auto pending = this->sent_queue_.find_active(); pending != nullptr; pending = this->sent_queue_.find_active()) {
+    if (pending->on_done)
+      handlers[count++] = std::move(pending->on_done);
+    this->sent_queue_.release(pending);
   }
+  for (size_t i = 0; i < count; i++)
+    handlers[i](SBCompletion::CANCELLED, nullptr);
 }
 
+#ifdef USE_SMARTBOILER_MODE
 void SmartBoilerModeSelect::control(const std::string &value) { get_parent()->on_set_mode(value); }
+#endif
 
+#ifdef USE_SMARTBOILER_THERMOSTAT
 void SmartBoilerThermostat::control(const esphome::climate::ClimateCall &call) {
   if (call.get_target_temperature().has_value()) {
     float tt = *call.get_target_temperature();
@@ -370,50 +1732,153 @@ esphome::climate::ClimateTraits SmartBoilerThermostat::traits() {
 }
 
 void SmartBoilerThermostat::publish_target_temp(float temp) {
-  this->target_temperature = temp;
-  this->publish_state();
+  if (this->target_temperature != temp) {
+    this->target_temperature = temp;
+    this->dirty_ = true;
+  }
 }
 
 void SmartBoilerThermostat::publish_current_temp(float temp) {
-  this->current_temperature = temp;
-  this->publish_state();
+  if (this->current_temperature != temp) {
+    this->current_temperature = temp;
+    this->dirty_ = true;
+  }
+}
+
+void SmartBoilerThermostat::flush_state() {
+  if (this->dirty_) {
+    this->dirty_ = false;
+    this->publish_state();
+  }
 }
 
 void SmartBoilerThermostat::publish_action(bool heating) {
-  if (get_parent()->mode_select_->state == "STOP")
-    this->action = esphome::climate::CLIMATE_ACTION_OFF;
-  else if (heating)
-    this->action = esphome::climate::CLIMATE_ACTION_HEATING;
-  else
-    this->action = esphome::climate::CLIMATE_ACTION_IDLE;
-  this->publish_state();
+  auto action = heating ? esphome::climate::CLIMATE_ACTION_HEATING : esphome::climate::CLIMATE_ACTION_IDLE;
+#ifdef USE_SMARTBOILER_MODE
+  auto mode_select = get_parent()->mode_select_;
+  if (mode_select && mode_select->state == "STOP")
+    action = esphome::climate::CLIMATE_ACTION_OFF;
+#endif
+  if (this->action != action) {
+    this->action = action;
+    this->dirty_ = true;
+  }
 }
+#endif
 
-void SmartBoiler::enqueue_command_(const SBProtocolRequest &command) {
-  this->command_queue_.push_back(command);
+bool SmartBoiler::enqueue_command_(SBProtocolRequest &&command, SBCompletionHandler on_done) {
+  command.mQueuedAt = millis();
+  if (command.is_query()) {
+    // the same query is already waiting or on its way, its reply serves both;
+    // when its handler slots are taken, the query is queued once more
+    SBCompletionHandlers *waiting = nullptr;
+    auto sent = this->sent_queue_.find_same(command);
+    if (sent != nullptr && (!on_done || !sent->on_done.full()))
+      waiting = &sent->on_done;
+    for (size_t i = 0; waiting == nullptr && i < this->command_queue_.size(); i++) {
+      auto &queued = this->command_queue_.at(i);
+      if (queued.request.same_payload(command) && (!on_done || !queued.on_done.full()))
+        waiting = &queued.on_done;
+    }
+    if (waiting != nullptr) {
+      this->frames_saved_++;
+      ESP_LOGV(TAG, "Dropping duplicate request %d", command.mRqType);
+      waiting->add(std::move(on_done));
+      return true;
+    }
+  } else if (command.is_coalescable()) {
+    // replace a queued setting of the same kind, only the latest value is sent
+    for (size_t i = 0; i < this->command_queue_.size(); i++) {
+      auto &queued = this->command_queue_.at(i);
+      if (queued.request.mRqType == command.mRqType) {
+        ESP_LOGV(TAG, "Replacing queued request %d (UID %0X)", queued.request.mRqType, queued.request.mUid);
+        auto replaced = std::move(queued.on_done);
+        queued.request = std::move(command);
+        queued.on_done = std::move(on_done);
+        this->frames_saved_++;
+        if (replaced)
+          replaced(SBCompletion::CANCELLED, nullptr);
+        return true;
+      }
+    }
+  }
+  if (this->command_queue_.full()) {
+    ESP_LOGW(TAG, "Command queue is full, request %d dropped", command.mRqType);
+    if (on_done)
+      on_done(SBCompletion::CANCELLED, nullptr);
+    return false;
+  }
+  this->command_queue_.push(SBCommand{std::move(command), std::move(on_done)});
+  this->diagnostics_.on_queue_depth(this->command_queue_.size(), this->sent_queue_.size());
   this->process_command_queue_();
+  return true;
+}
+
+// a read of this packet is queued or waits for its reply
+bool SmartBoiler::is_read_pending_(SBPacket packet) {
+  if (this->sent_queue_.find_read(packet) != nullptr)
+    return true;
+  for (size_t i = 0; i < this->command_queue_.size(); i++) {
+    const auto &queued = this->command_queue_.at(i).request;
+    if (queued.is_read() && queued.mRqType == packet)
+      return true;
+  }
+  return false;
 }
 
 void SmartBoiler::process_command_queue_() {
   uint32_t now = millis();
-  uint32_t cmdDelay = now - this->last_command_timestamp_;
+  // in-flight limit is checked separately below
+  if (!this->flow_.can_send(now, this->last_command_timestamp_, 0))
+    return;
 
-  if (cmdDelay > COMMAND_DELAY && !this->command_queue_.empty()) {
-    auto nextCmd = this->command_queue_.front();
-    this->send_to_boiler(nextCmd);
-    if (nextCmd.mUid) {
-      this->sent_queue_.push_back(nextCmd);
+  // retransmissions take precedence over new commands
+  auto expired = this->sent_queue_.find_expired(now);
+  if (expired != nullptr) {
+    // a log read is not repeated, the water heater may have moved on to the next entry already
+    if (expired->attempts > this->max_retries_ || expired->request.is_log_read()) {
+      ESP_LOGW(TAG, "No reply to request %d (UID %0X) after %u attempts, giving up", expired->request.mRqType,
+               expired->request.mUid, expired->attempts);
+      this->fail_request_(expired, SBCompletion::TIMED_OUT, nullptr);
+      return;
     }
-    this->command_queue_.erase(this->command_queue_.begin());
-    ESP_LOGD(TAG, "Queue status - QUEUE=[%d], SENT_QUEUE=[%d]", this->command_queue_.size(), this->sent_queue_.size());
+    ESP_LOGD(TAG, "Retransmitting request %d (UID %0X)", expired->request.mRqType, expired->request.mUid);
+    this->send_to_boiler(expired->request);
+    expired->attempts++;
+    expired->sent_at = now;
+    expired->deadline = now + this->request_timeout_;
+    return;
+  }
+
+  if (this->command_queue_.empty())
+    return;
+  auto &head = this->command_queue_.front().request;
+  // settings travel alone: HOME_ERROR does not name the request it answers,
+  // a rejected setting must not be confused with a read and rolled back wrongly
+  if (this->sent_queue_.find_coalescable() != nullptr ||
+      (head.is_coalescable() && this->sent_queue_.size() > 0))
+    return;
+  bool tracked = head.mUid || head.is_read();
+  // wait for a free slot, replies to untracked requests could not be matched
+  if (tracked && (this->sent_queue_.full() ||
+                  !this->flow_.can_send(now, this->last_command_timestamp_, this->sent_queue_.size())))
+    return;
+
+  auto nextCmd = this->command_queue_.pop();
+  this->send_to_boiler(nextCmd.request);
+  if (tracked) {
+    this->sent_queue_.insert(std::move(nextCmd), now, this->request_timeout_);
+    this->diagnostics_.on_queue_depth(this->command_queue_.size(), this->sent_queue_.size());
   }
+  ESP_LOGD(TAG, "Queue status - QUEUE=[%u], SENT_QUEUE=[%u]", this->command_queue_.size(), this->sent_queue_.size());
 }
 
 /**
  * Generate random UUID for this device.
  */
 std::string SmartBoiler::generateUUID() {
-  char sbuf[16];
+  // get_hex() writes 32 digits and a terminating zero
+  char sbuf[33];
   md5::MD5Digest md5{};
   md5.init();
   sprintf(sbuf, "%08X", random_uint32());
@@ -427,9 +1892,9 @@ std::string SmartBoiler::generateUUID() {
 
 void SmartBoiler::send_pin(uint32_t pin) {
   ESP_LOGD(TAG, "Sending PIN to water heater.");
-  auto cmd = SBProtocolRequest(SBC_PACKET_GLOBAL_PAIRPIN, this->mPacketUid++);
-  cmd.write_le(pin);
-  this->enqueue_command_(cmd);
+  auto cmd = SBProtocolRequest(SBC_PACKET_GLOBAL_PAIRPIN, this->next_uid_());
+  cmd.put<SBLayout<SBC_PACKET_GLOBAL_PAIRPIN>::Value>(pin);
+  this->enqueue_command_(std::move(cmd));
 }
 
 const char *SmartBoiler::state_to_string(ConnectionState state) {
@@ -469,6 +1934,7 @@ const char *SmartBoiler::day_to_string(uint8_t day) {
 }
 
 void SmartBoiler::set_state(ConnectionState newState) {
+  this->diagnostics_.on_state(uint8_t(newState), millis());
   this->state_ = newState;
   this->state_txt_->publish_state(this->state_to_string(newState));
 }
@@ -482,6 +1948,7 @@ void SmartBoilerPinInput::control(const float value) {
   }
 }
 
+#ifdef USE_SMARTBOILER_MODE
 /**
  * Convert string value from HA to code used by water heaters.
  * Modes SMART and MANUAL are converted to SMART_HDO/HDO in case
@@ -505,7 +1972,7 @@ uint8_t SmartBoiler::convert_action_to_mode(const std::string &payload) {
   return mode;
 }
 
-std::string SmartBoiler::convert_mode_to_action(const uint8_t mode) {
+const char *SmartBoiler::convert_mode_to_action(const uint8_t mode) {
   switch (mode) {
     case Mode::ANTIFREEZE:
       return MODE_ANTIFREEZE;
@@ -520,11 +1987,10 @@ std::string SmartBoiler::convert_mode_to_action(const uint8_t mode) {
     case Mode::HDO:
       return MODE_MANUAL;
     default:
-      ESP_LOGW(TAG, "Unknown water heater mode: %d", mode);
-      break;
+      return nullptr;
   }
-  return MODE_ANTIFREEZE;
 }
+#endif
 
 }  // namespace sb
 }  // namespace esphome
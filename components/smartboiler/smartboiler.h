@@ -3,7 +3,9 @@
 #ifndef SMARTBOILER_H
 #define SMARTBOILER_H
 
+#include "esphome/core/automation.h"
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
 #include "esphome/components/ble_client/ble_client.h"
 #include "esphome/components/text_sensor/text_sensor.h"
 #include "esphome/components/sensor/sensor.h"
@@ -12,6 +14,14 @@
 #include "esphome/components/climate/climate.h"
 #include "esphome/components/number/number.h"
 #include "SBProtocol.h"
+#include "SBQueue.h"
+#include "SBPoller.h"
+#include "SBStatistics.h"
+#include "SBDiagnostics.h"
+#include "SBCapture.h"
+#include "SBPower.h"
+#include "SBSchedule.h"
+#include "SBTariff.h"
 
 namespace esphome {
 namespace sb {
@@ -19,10 +29,27 @@ namespace sb {
 static const uint8_t MIN_TEMP = 40;
 static const uint8_t MAX_TEMP = 80;
 
-static const std::string MODE_ANTIFREEZE = "ANTIFREEZE";
-static const std::string MODE_SMART = "SMART";
-static const std::string MODE_PROG = "PROG";
-static const std::string MODE_MANUAL = "MANUAL";
+static const size_t COMMAND_QUEUE_SIZE = 16;
+static const size_t SENT_QUEUE_SIZE = 8;
+// notifications received but not decoded yet
+static const size_t NOTIFY_RING_SIZE = 16;
+// notifications decoded per loop(), the rest waits for the next one
+static const size_t NOTIFY_DRAIN_BUDGET = 4;
+// keep in sync with MULTI_CONF in __init__.py
+static const uint8_t MAX_INSTANCES = 8;
+static const size_t SB_AGGREGATE_MAX_FIELDS = 8;
+// entries of the water heater's event log kept on the device, also the most entries read at once
+static const size_t LOG_RING_SIZE = 16;
+// NEXTLOG requests sent ahead of the replies
+static const uint8_t LOG_PIPELINE = 2;
+// buckets of STATISTICS_WEEK (days) and STATISTICS_YEAR (months)
+static const size_t WEEK_BUCKETS = 7;
+static const size_t YEAR_BUCKETS = 12;
+
+static const char *const MODE_ANTIFREEZE = "ANTIFREEZE";
+static const char *const MODE_SMART = "SMART";
+static const char *const MODE_PROG = "PROG";
+static const char *const MODE_MANUAL = "MANUAL";
 
 class SmartBoilerModeSelect;
 class SmartBoilerThermostat;
@@ -34,6 +61,45 @@ struct SavedSmartBoilerSettings {
   char uid[6];
 } PACKED;
 
+static const uint8_t SNAPSHOT_UNKNOWN_MODE = 0xFF;
+static const int16_t SNAPSHOT_UNKNOWN_TEMPERATURE = INT16_MIN;
+
+// last known values of the water heater, published right after boot
+struct SavedSmartBoilerSnapshot {
+  // in tenths of degree
+  int16_t target_temperature;
+  // in liters, 0 when unknown
+  uint16_t capacity;
+  uint8_t version;
+  uint8_t mode;
+  uint8_t hdo_enabled;
+  char name[32];
+  char fw_version[64];
+};
+
+// entry of the water heater's event log
+struct SBLogEntry {
+  uint32_t time = 0;
+  uint32_t code = 0;
+};
+
+// setting published before the water heater confirmed it
+struct SBOptimisticWrite {
+  // identifies the latest write, older ones no longer own the published value
+  uint8_t seq = 0;
+  bool pending = false;
+};
+
+// learned HDO tariff model, see SBTariffModel
+struct SavedTariffModel {
+  uint8_t version;
+  std::array<uint8_t, SB_TARIFF_SLOTS / 2> slots;
+};
+
+// HDO_SELECTION_A, _B, _DP, HDO_FREQUENCY and HDO_SETTING as read
+static const size_t HDO_CONFIG_FIELDS = 5;
+static const size_t HDO_CONFIG_SIZE = 16;
+
 class SmartBoiler : public PollingComponent,
                     public esphome::ble_client::BLEClientNode {
  public:
@@ -46,66 +112,446 @@ class SmartBoiler : public PollingComponent,
                            esp_ble_gattc_cb_param_t *param) override;
 
   void set_pin_input(SmartBoilerPinInput *n) { mPin_ = n; }
+#ifdef USE_SMARTBOILER_TEMP1
   void set_temp1(sensor::Sensor *s) { temperature_sensor_1_sensor_ = s; }
+#endif
+#ifdef USE_SMARTBOILER_TEMP2
   void set_temp2(sensor::Sensor *s) { temperature_sensor_2_sensor_ = s; }
+#endif
   void set_hdo_low_tariff(binary_sensor::BinarySensor *s) { hdo_low_tariff_sensor_ = s; }
   void set_heat_on(binary_sensor::BinarySensor *s) { heat_on_sensor_ = s; }
+#ifdef USE_SMARTBOILER_MODE
   void set_mode(SmartBoilerModeSelect *s) { mode_select_ = s; }
+#endif
+#ifdef USE_SMARTBOILER_THERMOSTAT
   void set_thermostat(SmartBoilerThermostat *t) { thermostat_ = t; }
+#endif
   void set_consumption(sensor::Sensor *s) { consumption_sensor_ = s; }
+#ifdef USE_SMARTBOILER_HISTORY
+  void set_energy_today(sensor::Sensor *s) {
+    energy_today_ = s;
+    history_ = true;
+  }
+  void set_energy_week(sensor::Sensor *s) {
+    energy_week_ = s;
+    history_ = true;
+  }
+  void set_energy_month(sensor::Sensor *s) {
+    energy_month_ = s;
+    history_ = true;
+  }
+  void set_energy_year(sensor::Sensor *s) {
+    energy_year_ = s;
+    history_ = true;
+  }
+#endif
+#ifdef USE_SMARTBOILER_POWER
+  void set_power(sensor::Sensor *s) {
+    power_sensor_ = s;
+    power_ = true;
+  }
+  void set_cycle_energy(sensor::Sensor *s) {
+    cycle_energy_sensor_ = s;
+    power_ = true;
+  }
+#endif
+  void set_heating_poll_interval(uint32_t interval) { heating_poll_interval_ = interval; }
+  void set_hdo_check_interval(uint32_t interval) { hdo_check_interval_ = interval; }
+#ifdef USE_SMARTBOILER_SCHEDULE
+  void set_schedule_text(text_sensor::TextSensor *t) {
+    schedule_txt_ = t;
+    schedule_polling_ = true;
+  }
+  // set for water heaters whose schedule is changed by smartboiler.set_schedule
+  void set_schedule_polling(bool polling) { schedule_polling_ = polling; }
+  // change the PROG mode hours of a day (0 = Monday), hours like "0-5,22-23"
+  void set_schedule(uint8_t day, const std::string &hours);
+#endif
   void set_state(text_sensor::TextSensor *t) { state_txt_ = t; }
   void set_version(text_sensor::TextSensor *t) { version_ = t; }
   void set_name(text_sensor::TextSensor *t) { name_ = t; }
+  void set_request_timeout(uint32_t timeout) { request_timeout_ = timeout; }
+  void set_max_retries(uint8_t retries) { max_retries_ = retries; }
+  void set_max_in_flight(uint8_t max_in_flight) { flow_.set_max_in_flight(max_in_flight); }
+  void set_publish_deadband(float deadband) { publish_deadband_ = deadband; }
+  void set_state_poll_interval(uint32_t interval) { state_poll_interval_ = interval; }
+  void set_temperature_poll_interval(uint32_t interval) { temperature_poll_interval_ = interval; }
+  void set_settings_poll_interval(uint32_t interval) { settings_poll_interval_ = interval; }
+  void set_rotation(bool rotation) { rotation_ = rotation; }
+  void set_rotation_budget(uint32_t budget) { rotation_budget_ = budget; }
+  void set_bulk_reads(bool bulk_reads) { bulk_reads_ = bulk_reads; }
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  void set_last_event(text_sensor::TextSensor *t) {
+    last_event_ = t;
+    event_log_ = true;
+  }
+  void add_on_log_entry_callback(std::function<void(uint32_t, uint32_t)> &&callback) {
+    log_entry_callback_.add(std::move(callback));
+    event_log_ = true;
+  }
+#endif
+#ifdef USE_SMARTBOILER_DIAGNOSTICS
+  void set_rtt_sensor(sensor::Sensor *s) { rtt_sensor_ = s; }
+  void set_home_errors_sensor(sensor::Sensor *s) { home_errors_sensor_ = s; }
+  void set_write_failures_sensor(sensor::Sensor *s) { write_failures_sensor_ = s; }
+  void set_unmatched_confirms_sensor(sensor::Sensor *s) { unmatched_confirms_sensor_ = s; }
+  void set_reconnects_sensor(sensor::Sensor *s) { reconnects_sensor_ = s; }
+  void set_queue_peak_sensor(sensor::Sensor *s) { queue_peak_sensor_ = s; }
+  void set_rollbacks_sensor(sensor::Sensor *s) { rollbacks_sensor_ = s; }
+#endif
+#ifdef USE_SMARTBOILER_CAPTURE
+  void set_capture(bool capture) { capture_enabled_ = capture; }
+#endif
+  // print the captured frames to the log, oldest first
+  void dump_capture();
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  // event log entries read since boot, oldest first
+  size_t get_log_size() const { return log_entries_.size(); }
+  const SBLogEntry &get_log_entry(size_t i) const { return log_entries_.at(i); }
+#endif
+
+  // milliseconds since the value was last received, UINT32_MAX when never
+  uint32_t get_value_age(SBPacket packet);
+  // read a value; on_done is called once the reply arrives or the read fails
+  void read_value(SBPacket packet, SBCompletionHandler on_done);
+  // write a setting taking one number; on_done is called once it is confirmed or fails
+  void write_value(SBPacket packet, uint32_t value, SBCompletionHandler on_done);
 
  protected:
+  // decodes a packet and publishes its values, false when the packet carried no valid value
+  using PacketHandler = bool (SmartBoiler::*)(const SBProtocolResult &result);
+  using PacketHandlerTable = std::array<PacketHandler, SB_PACKET_COUNT>;
+  struct PacketHandlerEntry {
+    SBPacket packet;
+    PacketHandler handler;
+  };
+
+  bool handle_pair_pin_(const SBProtocolResult &result);
+  bool handle_confirm_uid_(const SBProtocolResult &result);
+  bool handle_device_bonded_(const SBProtocolResult &result);
+  bool handle_pin_result_(const SBProtocolResult &result);
+  bool handle_fw_version_(const SBProtocolResult &result);
+  bool handle_mode_(const SBProtocolResult &result);
+  bool handle_temperature_(const SBProtocolResult &result);
+  bool handle_sensor1_(const SBProtocolResult &result);
+  bool handle_sensor2_(const SBProtocolResult &result);
+  bool handle_heating_state_(const SBProtocolResult &result);
+  bool handle_hdo_onoff_(const SBProtocolResult &result);
+  bool handle_name_(const SBProtocolResult &result);
+  bool handle_error_(const SBProtocolResult &result);
+  bool handle_time_(const SBProtocolResult &result);
+  bool handle_home_all_(const SBProtocolResult &result);
+  bool handle_capacity_(const SBProtocolResult &result);
+  bool handle_hdo_all_(const SBProtocolResult &result);
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  void handle_log_entry_(const SBProtocolResult &result);
+#endif
+#ifdef USE_SMARTBOILER_SCHEDULE
+  bool handle_schedule_(const SBProtocolResult &result);
+  template<typename Hours> bool read_schedule_days_(const SBProtocolResult &result, uint8_t first);
+  template<typename Hours> void write_schedule_days_(SBProtocolRequest &cmd, uint8_t first);
+#endif
+  bool handle_tariff_now_(const SBProtocolResult &result);
+  // the tariff switched to low (or high) between the slots from and to
+  void handle_hdo_last_time_(const SBProtocolResult &result, uint16_t from, uint16_t to, bool low);
+  bool handle_hdo_config_(const SBProtocolResult &result);
+  bool handle_aggregate_(const SBProtocolResult &result, const SBPacket *fields, size_t count);
+  bool &aggregate_unsupported_(SBPacket aggregate);
+  uint8_t &aggregate_failures_(SBPacket aggregate);
+  bool is_read_pending_(SBPacket packet);
+  void disable_aggregate_(SBPacket aggregate);
+
   void set_uid(const std::string &uid) { this->uid_ = uid; }
+  // UID 0 marks plain reads, it is skipped when the counter wraps around
+  uint16_t next_uid_() {
+    if (this->mPacketUid == 0)
+      this->mPacketUid = 1;
+    return this->mPacketUid++;
+  }
+#ifdef USE_SMARTBOILER_THERMOSTAT
   void on_set_temperature(uint8_t temp);
+  void on_temperature_written_(uint8_t seq, uint8_t temp, SBCompletion status);
+#endif
+#ifdef USE_SMARTBOILER_MODE
   void on_set_mode(const std::string &payload);
+  void on_mode_written_(uint8_t seq, uint8_t mode, SBCompletion status);
+#endif
   void on_set_hdo_enabled(const std::string &payload);
   void handle_incoming(const uint8_t *data, uint16_t length);
-  void request_value(SBPacket value, uint16_t uid = 0);
-  void send_to_boiler(SBProtocolRequest request);
-  void enqueue_command_(const SBProtocolRequest &command);
+  void drain_notifications_();
+  // the connection was closed, drop everything that belonged to it
+  void on_disconnected_();
+  void request_value(SBPacket value, uint16_t uid = 0, SBCompletionHandler on_done = nullptr);
+  void send_to_boiler(const SBProtocolRequest &request);
+  // false when the command was dropped, on_done is then called with CANCELLED
+  bool enqueue_command_(SBProtocolRequest &&command, SBCompletionHandler on_done = nullptr);
   void process_command_queue_();
+  void complete_request_(SBPendingRequest *pending, SBCompletion status, const SBProtocolResult *result);
+  void fail_request_(SBPendingRequest *pending, SBCompletion status, const SBProtocolResult *result);
+  // drop queued and sent requests, their handlers are called with CANCELLED
+  void cancel_requests_();
+  void publish_sensor_(sensor::Sensor *sensor, float value);
+  void publish_text_(text_sensor::TextSensor *sensor, std::string_view value);
+  static constexpr PacketHandlerTable build_packet_handlers_();
+  // packet ID -> handler, nullptr for packets which are ignored
+  static const PacketHandlerTable PACKET_HANDLERS;
   void send_pin(uint32_t pin);
   void authenticate();
   void getInitData();
+  void setup_polling_();
+  void log_value_ages_();
+  void rotate_();
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  void start_log_sync_();
+  void finish_log_sync_(bool complete);
+  void on_log_read_(SBCompletion status, const SBProtocolResult *result);
+#endif
+#ifdef USE_SMARTBOILER_HISTORY
+  void refresh_history_();
+  void request_history_();
+  void publish_history_();
+  void on_history_(SBHistoryRequest bucket, SBCompletion status, const SBProtocolResult *result);
+#endif
+  void request_consumption_();
+  void on_consumption_(SBCompletion status, const SBProtocolResult *result);
+#ifdef USE_SMARTBOILER_POWER
+  void on_heating_(bool heating);
+  void on_consumption_sample_(uint32_t wh, uint32_t device_time);
+#endif
+#ifdef USE_SMARTBOILER_SCHEDULE
+  void write_schedule_();
+  void publish_schedule_();
+#endif
+  void restore_tariff_model_();
+  void update_tariff_();
+  void publish_tariff_(bool low);
+  // current time of the water heater in seconds since Monday 0:00, false when unknown
+  bool week_time_(uint32_t &seconds);
+  // parses a time in format D.HH:MM:SS, day 0 is Monday
+  static bool parse_week_time_(std::string_view text, uint32_t &seconds);
+#ifdef USE_SMARTBOILER_DIAGNOSTICS
+  void dump_diagnostics_();
+  void publish_diagnostics_();
+#endif
+  uint32_t preference_hash_();
   void restore_state_();
   void save_state_();
+  void restore_snapshot_();
+  void save_snapshot_();
+  template<typename T> void update_snapshot_(T &field, T value) {
+    if (field != value) {
+      field = value;
+      this->snapshot_dirty_ = true;
+    }
+  }
+  void update_snapshot_text_(char *field, size_t size, std::string_view value);
   void set_state(ConnectionState newState);
   std::string generateUUID();
   const char *state_to_string(ConnectionState state);
   const char *day_to_string(uint8_t day);
+#ifdef USE_SMARTBOILER_MODE
   uint8_t convert_action_to_mode(const std::string &payload);
-  std::string convert_mode_to_action(const uint8_t mode);
+  // nullptr for codes without an option in the mode select, such as STOP
+  const char *convert_mode_to_action(const uint8_t mode);
+#endif
 
   ESPPreferenceObject pref_;
+  ESPPreferenceObject snapshot_pref_;
+  SavedSmartBoilerSnapshot snapshot_{};
+  // mode and target temperature are shown as soon as they are requested,
+  // the snapshot keeps the values last confirmed by the water heater
+#ifdef USE_SMARTBOILER_MODE
+  SBOptimisticWrite mode_write_;
+#endif
+#ifdef USE_SMARTBOILER_THERMOSTAT
+  SBOptimisticWrite temperature_write_;
+#endif
+  bool snapshot_dirty_ = false;
+  uint32_t snapshot_saved_at_ = 0;
   // state of the connection
   ConnectionState state_ = ConnectionState::DISCONNECTED;
   // random UID of this device. Needs to be registered in boiler via PIN pairing.
   std::string uid_;
   // incremental counter for packets which requires unique ID
-  uint32_t mPacketUid = 1;
+  uint16_t mPacketUid = 1;
   uint32_t last_command_timestamp_;
+  // millis() of the last authentication request, for time-to-first-data measurement
+  uint32_t auth_started_at_ = 0;
+  bool first_data_received_ = false;
 
   // Handle for outgoing requests
   uint16_t char_handle_;
+  // notifications copied by the BLE callback, decoded in loop()
+  SBNotifyRing<NOTIFY_RING_SIZE> notify_ring_;
+  // changes on every disconnect, written by the BLE callback
+  std::atomic<uint8_t> link_epoch_{0};
+  // last epoch whose disconnect was handled by loop()
+  uint8_t handled_epoch_ = 0;
+  // set by the BLE callback once notifications are enabled, loop() then authenticates
+  std::atomic<bool> notify_ready_{false};
+  uint32_t notify_overflows_reported_ = 0;
   // queue of commands waiting to be send
-  std::vector<SBProtocolRequest> command_queue_;
-  // queue for sent command to later pair with responses
-  std::vector<SBProtocolRequest> sent_queue_;
+  SBRingQueue<SBCommand, COMMAND_QUEUE_SIZE> command_queue_;
+  // sent commands waiting to be paired with responses
+  SBPendingTable<SENT_QUEUE_SIZE> sent_queue_;
+  // how long to wait for a confirmation or reply before retransmitting
+  uint32_t request_timeout_ = 2000;
+  uint8_t max_retries_ = 2;
+  SBFlowControl flow_;
+  // sensor changes up to this value are not published
+  float publish_deadband_ = 0.0f;
+  // requests merged into a queued one or dropped as duplicates
+  uint32_t frames_saved_ = 0;
+  SBDiagnostics diagnostics_;
+#ifdef USE_SMARTBOILER_CAPTURE
+  // the buffer exists when any water heater captures, frames are recorded only for those which do
+  bool capture_enabled_ = false;
+  SBCapture<SMARTBOILER_CAPTURE_SIZE> capture_;
+#endif
+
+  SBPoller poller_;
+  uint32_t state_poll_interval_ = 10000;
+  uint32_t temperature_poll_interval_ = 30000;
+  uint32_t settings_poll_interval_ = 300000;
+  // position of this instance among all configured water heaters
+  uint8_t instance_index_ = 0;
+  static uint8_t instance_count_;
+  // aggregate packets are only used when enabled, their format is not confirmed on all firmware
+  bool bulk_reads_ = false;
+  // set when the firmware turns out not to support the aggregate packet, until the next connection
+  bool home_all_unsupported_ = false;
+  bool hdo_all_unsupported_ = false;
+  // consecutive failed aggregate reads
+  uint8_t home_all_failures_ = 0;
+  uint8_t hdo_all_failures_ = 0;
+
+  // rotation mode: only one water heater of the rotation is connected at a time
+  bool rotation_ = false;
+  uint32_t rotation_budget_ = 30000;
+  // false until the first rotate_() took the connection away from the BLE client
+  bool rotation_joined_ = false;
+  bool visiting_ = false;
+  uint32_t visit_started_ = 0;
+  uint32_t last_visit_end_ = 0;
+  static SmartBoiler *rotation_members_[MAX_INSTANCES];
+  static uint8_t rotation_size_;
+  static uint8_t rotation_turn_;
+
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  // event log is read only when something consumes its entries
+  bool event_log_ = false;
+  ESPPreferenceObject log_cursor_pref_;
+  // time of the newest entry already reported
+  uint32_t log_cursor_ = 0;
+  bool log_syncing_ = false;
+  // log requests sent during the current sync and not answered yet
+  uint8_t log_outstanding_ = 0;
+  // new entries of the current sync, newest first
+  std::array<SBLogEntry, LOG_RING_SIZE> log_batch_{};
+  size_t log_batch_size_ = 0;
+  SBRingQueue<SBLogEntry, LOG_RING_SIZE> log_entries_;
+  CallbackManager<void(uint32_t, uint32_t)> log_entry_callback_;
+#endif
+
+#ifdef USE_SMARTBOILER_HISTORY
+  // consumption history is read only when one of its sensors is configured
+  bool history_ = false;
+  // lifetime consumption in Wh, UINT32_MAX when not read yet
+  uint32_t last_consumption_ = UINT32_MAX;
+  SBConsumptionHistory<WEEK_BUCKETS> week_history_;
+  SBConsumptionHistory<YEAR_BUCKETS> year_history_;
+  // buckets are requested a few at a time, so a full refresh does not fill the command queue
+  SBRingQueue<SBHistoryRequest, WEEK_BUCKETS + YEAR_BUCKETS> history_requests_;
+#endif
+
+  // the counter is read this often while heating, otherwise every update_interval
+  uint32_t heating_poll_interval_ = 60000;
+  uint32_t consumption_requested_at_ = 0;
+#ifdef USE_SMARTBOILER_POWER
+  // power is estimated only when one of its sensors is configured
+  bool power_ = false;
+  SBPowerEstimator power_estimator_;
+  // false until the heating state was read on the current connection
+  bool heating_known_ = false;
+  // upper temperature in tenths of degree, INT16_MIN when unknown
+  int16_t last_temp2_ = INT16_MIN;
+  bool cycle_running_ = false;
+  bool cycle_closing_ = false;
+  // counter at the start of the heating cycle, UINT32_MAX until read
+  uint32_t cycle_start_wh_ = UINT32_MAX;
+  int16_t cycle_start_temp_ = INT16_MIN;
+  uint32_t cycle_started_at_ = 0;
+#endif
 
+#ifdef USE_SMARTBOILER_SCHEDULE
+  // PROG mode schedule, changes are written by write_schedule_() from loop()
+  SBSchedule schedule_;
+  // the schedule is read only when it is shown or changed
+  bool schedule_polling_ = false;
+#endif
+
+  // clock of the water heater: its week time at millis() clock_ref_ms_
+  bool clock_known_ = false;
+  uint32_t clock_week_s_ = 0;
+  uint32_t clock_ref_ms_ = 0;
+  SBTariffModel tariff_model_;
+  ESPPreferenceObject tariff_pref_;
+  bool tariff_dirty_ = false;
+  uint32_t tariff_saved_at_ = 0;
+  // the tariff is asked this often once the current slot is learned
+  uint32_t hdo_check_interval_ = 3600000;
+  uint32_t tariff_next_check_ = 0;
+  // last tariff reported by the water heater
+  bool has_tariff_obs_ = false;
+  bool tariff_obs_low_ = false;
+  uint16_t tariff_obs_slot_ = 0;
+  uint32_t tariff_obs_at_ = 0;
+  std::array<std::array<char, HDO_CONFIG_SIZE>, HDO_CONFIG_FIELDS> hdo_config_{};
+
+#ifdef USE_SMARTBOILER_TEMP1
   sensor::Sensor *temperature_sensor_1_sensor_ = nullptr;
+#endif
+#ifdef USE_SMARTBOILER_TEMP2
   sensor::Sensor *temperature_sensor_2_sensor_ = nullptr;
+#endif
   sensor::Sensor *consumption_sensor_ = nullptr;
+#ifdef USE_SMARTBOILER_HISTORY
+  sensor::Sensor *energy_today_ = nullptr;
+  sensor::Sensor *energy_week_ = nullptr;
+  sensor::Sensor *energy_month_ = nullptr;
+  sensor::Sensor *energy_year_ = nullptr;
+#endif
+#ifdef USE_SMARTBOILER_POWER
+  sensor::Sensor *power_sensor_ = nullptr;
+  sensor::Sensor *cycle_energy_sensor_ = nullptr;
+#endif
+#ifdef USE_SMARTBOILER_DIAGNOSTICS
+  sensor::Sensor *rtt_sensor_ = nullptr;
+  sensor::Sensor *home_errors_sensor_ = nullptr;
+  sensor::Sensor *write_failures_sensor_ = nullptr;
+  sensor::Sensor *unmatched_confirms_sensor_ = nullptr;
+  sensor::Sensor *reconnects_sensor_ = nullptr;
+  sensor::Sensor *queue_peak_sensor_ = nullptr;
+  sensor::Sensor *rollbacks_sensor_ = nullptr;
+#endif
 
   binary_sensor::BinarySensor *hdo_low_tariff_sensor_ = nullptr;
   binary_sensor::BinarySensor *heat_on_sensor_ = nullptr;
   text_sensor::TextSensor *state_txt_ = nullptr;
   text_sensor::TextSensor *version_ = nullptr;
   text_sensor::TextSensor *name_ = nullptr;
+#ifdef USE_SMARTBOILER_EVENT_LOG
+  text_sensor::TextSensor *last_event_ = nullptr;
+#endif
+#ifdef USE_SMARTBOILER_SCHEDULE
+  text_sensor::TextSensor *schedule_txt_ = nullptr;
+#endif
+#ifdef USE_SMARTBOILER_MODE
   SmartBoilerModeSelect *mode_select_ = nullptr;
+#endif
+#ifdef USE_SMARTBOILER_THERMOSTAT
   SmartBoilerThermostat *thermostat_ = nullptr;
+#endif
   SmartBoilerPinInput *mPin_ = nullptr;
 
   friend class SmartBoilerModeSelect;
@@ -117,11 +563,14 @@ private:
   
 };
 
+#ifdef USE_SMARTBOILER_MODE
 class SmartBoilerModeSelect : public esphome::select::Select, public esphome::Parented<SmartBoiler> {
  protected:
   virtual void control(const std::string &value) override;
 };
+#endif
 
+#ifdef USE_SMARTBOILER_THERMOSTAT
 class SmartBoilerThermostat : public esphome::climate::Climate, public esphome::Parented<SmartBoiler> {
  protected:
   virtual void control(const esphome::climate::ClimateCall &call) override;
@@ -130,9 +579,38 @@ class SmartBoilerThermostat : public esphome::climate::Climate, public esphome::
   void publish_target_temp(float temp);
   void publish_current_temp(float temp);
   void publish_action(bool is_heating);
+  // publish the accumulated changes, if any
+  void flush_state();
+
+  bool dirty_ = false;
 
   friend class SmartBoiler;
 };
+#endif
+
+#ifdef USE_SMARTBOILER_EVENT_LOG
+class SmartBoilerLogEntryTrigger : public Trigger<uint32_t, uint32_t> {
+ public:
+  explicit SmartBoilerLogEntryTrigger(SmartBoiler *parent) {
+    parent->add_on_log_entry_callback([this](uint32_t time, uint32_t code) { this->trigger(time, code); });
+  }
+};
+#endif
+
+template<typename... Ts> class SmartBoilerDumpCaptureAction : public Action<Ts...>, public Parented<SmartBoiler> {
+ public:
+  void play(Ts... x) override { this->parent_->dump_capture(); }
+};
+
+#ifdef USE_SMARTBOILER_SCHEDULE
+template<typename... Ts> class SmartBoilerSetScheduleAction : public Action<Ts...>, public Parented<SmartBoiler> {
+ public:
+  TEMPLATABLE_VALUE(uint8_t, day)
+  TEMPLATABLE_VALUE(std::string, hours)
+
+  void play(Ts... x) override { this->parent_->set_schedule(this->day_.value(x...), this->hours_.value(x...)); }
+};
+#endif
 
 class SmartBoilerPinInput : public esphome::number::Number, public esphome::Parented<SmartBoiler> {
  protected:
@@ -0,0 +1,110 @@
+// Encode and decode throughput of the frame codec, per packet type.
+// Run with --quick for a short smoke run.
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "SBProtocol.h"
+
+using namespace esphome::sb;
+
+static volatile uint32_t sink;
+
+template<typename F> static void measure(const char *what, size_t iterations, F &&body) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    body(i);
+  auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-36s %8.1f ns/frame  %7.2f M frames/s\n", what, ns / iterations, iterations / ns * 1000.0);
+}
+
+struct Reply {
+  const char *name;
+  std::vector<uint8_t> frame;
+};
+
+static std::vector<uint8_t> text(SBPacket type, const char *value) {
+  char buffer[40];
+  int length = snprintf(buffer, sizeof(buffer), "%02u%s\r\n", unsigned(type), value);
+  return std::vector<uint8_t>(buffer, buffer + length);
+}
+
+static std::vector<uint8_t> binary(SBPacket type, size_t size) {
+  auto frame = text(type, "");
+  frame.resize(SB_REPLY_ID_SIZE);
+  for (size_t i = 0; i < size; i++)
+    frame.push_back(uint8_t(i * 37 + 1));
+  return frame;
+}
+
+int main(int argc, char **argv) {
+  bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+  size_t iterations = quick ? 10000 : 10000000;
+
+  // decoding includes what the handler of the packet does with the result
+  const Reply replies[] = {
+      {"SENSOR1 45.0", text(SBPacket::SBC_PACKET_HOME_SENSOR1, "45.0")},
+      {"MODE 3", text(SBPacket::SBC_PACKET_HOME_MODE, "3")},
+      {"HOME_ALL", text(SBPacket::SBC_PACKET_HOME_ALL, "3;0;45.0;52.5;60")},
+      {"FWVERSION", text(SBPacket::SBC_PACKET_HOME_FWVERSION, "1.2.3;B;123456")},
+      {"CONFIRMUID + STATISTICS_GETALL", binary(SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID, 10)},
+      {"FIRSTLOG", binary(SBPacket::SBC_PACKET_GLOBAL_FIRSTLOG, 16)},
+      {"NIGHT_GETDAYS", binary(SBPacket::SBC_PACKET_NIGHT_GETDAYS, 12)},
+  };
+  printf("decode\n");
+  for (const auto &reply : replies) {
+    measure(reply.name, iterations, [&](size_t i) {
+      SBProtocolResult result(reply.frame.data(), uint16_t(reply.frame.size()));
+      int32_t value = 0;
+      switch (result.mRqType) {
+        case SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID:
+          value = result.mUid + result.get<SBLayout<SBPacket::SBC_PACKET_STATISTICS_GETALL>::Consumption>();
+          break;
+        case SBPacket::SBC_PACKET_GLOBAL_FIRSTLOG:
+          value = result.get<SBLogEntryLayout::Time>() + result.get<SBLogEntryLayout::Code>();
+          break;
+        case SBPacket::SBC_PACKET_NIGHT_GETDAYS:
+          for (size_t day = 0; day < 4; day++)
+            value += result.mPayload.get<SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS>::Hours>(day);
+          break;
+        case SBPacket::SBC_PACKET_HOME_ALL:
+          for (size_t start = 0, end = 0; end != std::string_view::npos; start = end + 1) {
+            end = result.mString.find(';', start);
+            int32_t field;
+            if (SBProtocolResult::parse_fixed(result.mString.substr(start, end - start), 1, field))
+              value += field;
+          }
+          break;
+        default:
+          result.parse_fixed(1, value);
+          break;
+      }
+      sink = sink + value;
+    });
+  }
+
+  printf("encode\n");
+  measure("read (header only)", iterations, [](size_t i) {
+    SBProtocolRequest request(SBPacket::SBC_PACKET_HOME_SENSOR1);
+    sink = sink + request.size();
+  });
+  measure("SETMODE", iterations, [](size_t i) {
+    SBProtocolRequest request(SBPacket::SBC_PACKET_HOME_SETMODE, uint16_t(i | 1));
+    request.put<SBLayout<SBPacket::SBC_PACKET_HOME_SETMODE>::Value>(uint32_t(i % 7));
+    sink = sink + request.size() + request.data()[4];
+  });
+  measure("NIGHT_SAVEDAYS", iterations, [](size_t i) {
+    using Hours = SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS>::Hours;
+    SBProtocolRequest request(SBPacket::SBC_PACKET_NIGHT_SAVEDAYS, uint16_t(i | 1));
+    for (size_t day = 0; day < Hours::COUNT; day++)
+      request.put<Hours>(day, uint32_t(i + day) & 0xFFFFFF);
+    sink = sink + request.size() + request.data()[5];
+  });
+  const std::string uid = "A1B2C3";
+  measure("RQ_GLOBAL_MAC", iterations, [&uid](size_t i) {
+    SBProtocolRequest request(SBPacket::SBC_PACKET_RQ_GLOBAL_MAC);
+    request.writeString(uid);
+    sink = sink + request.size();
+  });
+  return 0;
+}
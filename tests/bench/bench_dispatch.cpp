@@ -0,0 +1,66 @@
+// Cost of one notification through SmartBoiler::handle_incoming(): decode,
+// lookup in PACKET_HANDLERS, the handler itself and the pending read scan.
+// The values repeat, so after the first frame nothing is published.
+// Run with --quick for a short smoke run.
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include "sb_host.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+struct Notification {
+  const char *name;
+  std::vector<uint8_t> frame;
+};
+
+static std::vector<uint8_t> text(SBPacket type, const char *value) {
+  char buffer[40];
+  int length = snprintf(buffer, sizeof(buffer), "%02u%s\r\n", unsigned(type), value);
+  return std::vector<uint8_t>(buffer, buffer + length);
+}
+
+static void measure(SBHostHeater &heater, const char *what, size_t iterations,
+                    const std::vector<const std::vector<uint8_t> *> &frames) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    const auto &frame = *frames[i % frames.size()];
+    heater.boiler.handle_incoming(frame.data(), uint16_t(frame.size()));
+  }
+  auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-24s %8.1f ns/notification\n", what, ns / iterations);
+}
+
+int main(int argc, char **argv) {
+  bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+  size_t iterations = quick ? 10000 : 5000000;
+
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  node.run_until([&] { return heater.boiler.is_connected(); }, 5000);
+  // let the initial reads finish, the pending read scan then finds nothing
+  node.run_until([&] { return heater.boiler.sent_queue_.size() == 0 && heater.boiler.command_queue_.empty(); },
+                 10000);
+
+  const Notification notifications[] = {
+      {"SENSOR1", text(SBPacket::SBC_PACKET_HOME_SENSOR1, "45.0")},
+      {"SENSOR2", text(SBPacket::SBC_PACKET_HOME_SENSOR2, "52.5")},
+      {"HSRCSTATE", text(SBPacket::SBC_PACKET_HOME_HSRCSTATE, "0")},
+      {"MODE", text(SBPacket::SBC_PACKET_HOME_MODE, "3")},
+      {"TEMPERATURE", text(SBPacket::SBC_PACKET_HOME_TEMPERATURE, "60")},
+      {"FWVERSION", text(SBPacket::SBC_PACKET_HOME_FWVERSION, "1.2.3;B;123456")},
+      {"HDO_SELECTION_A", text(SBPacket::SBC_PACKET_HDO_SELECTION_A, "A1")},
+      {"HOME_ALL", text(SBPacket::SBC_PACKET_HOME_ALL, "3;0;45.0;52.5;60")},
+      {"no handler (LOG_MSG)", text(SBPacket::SBC_PACKET_LOG_MSG, "")},
+  };
+  std::vector<const std::vector<uint8_t> *> all;
+  for (const auto &notification : notifications) {
+    measure(heater, notification.name, iterations, {&notification.frame});
+    all.push_back(&notification.frame);
+  }
+  measure(heater, "mixed", iterations, all);
+  return 0;
+}
@@ -0,0 +1,135 @@
+// Latency and load of the request pipeline against the simulated water heater:
+//  - enqueue -> publish: a read is queued and the value it carries is published
+//  - time-to-first-data: authenticate() until the first value is published
+//  - queue depth over time after boot, one and three water heaters
+// Run with --quick for a short smoke run.
+#include <algorithm>
+#include <cstring>
+#include "sb_host.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+struct Percentiles {
+  explicit Percentiles(std::vector<uint32_t> samples) : samples_(std::move(samples)) {
+    std::sort(this->samples_.begin(), this->samples_.end());
+  }
+  uint32_t at(unsigned p) const {
+    if (this->samples_.empty())
+      return 0;
+    return this->samples_[std::min(this->samples_.size() - 1, this->samples_.size() * p / 100)];
+  }
+  void print(const char *what) const {
+    printf("%-44s n=%-5zu p50=%5u ms  p90=%5u ms  p99=%5u ms  max=%5u ms\n", what, this->samples_.size(), this->at(50),
+           this->at(90), this->at(99), this->samples_.empty() ? 0 : this->samples_.back());
+  }
+
+  std::vector<uint32_t> samples_;
+};
+
+// enqueue of a SENSOR1 read until temp1 publishes the value, with the regular polls running alongside
+static void bench_enqueue_to_publish(size_t samples, uint32_t device_latency) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  heater.sim.latency = device_latency;
+  node.pair_all();
+  node.setup();
+  node.run_until([&] { return heater.boiler.is_connected(); }, 5000);
+  node.run_for(10000);
+
+  std::vector<uint32_t> latencies;
+  for (size_t i = 0; i < samples; i++) {
+    float value = 40.0f + (i % 2 ? 0.5f : 1.0f) + i % 20;
+    heater.sim.state.sensor1 = value;
+    uint32_t queued = millis();
+    bool published = false;
+    host::publish_observer = [&](EntityBase *entity) {
+      if (entity == &heater.temp1 && heater.temp1.state == value && !published) {
+        published = true;
+        latencies.push_back(millis() - queued);
+      }
+    };
+    heater.boiler.read_value(SBPacket::SBC_PACKET_HOME_SENSOR1, nullptr);
+    node.run_until([&] { return published; }, 10000);
+    // let polls interleave with the next sample
+    node.run_for(37 + (i * 53) % 400);
+  }
+  host::publish_observer = nullptr;
+  char what[64];
+  snprintf(what, sizeof(what), "enqueue -> publish, device %u ms", device_latency);
+  Percentiles(latencies).print(what);
+}
+
+// authenticate() until the first value of the heater is published, over repeated reconnects
+static void bench_time_to_first_data(size_t reconnects) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+
+  std::vector<uint32_t> delays;
+  uint32_t authenticating_at = 0;
+  bool waiting = false;
+  host::publish_observer = [&](EntityBase *entity) {
+    if (entity == &heater.state && heater.state.state == "Authenticating") {
+      authenticating_at = millis();
+      waiting = true;
+    } else if (waiting && entity != &heater.state) {
+      waiting = false;
+      delays.push_back(millis() - authenticating_at);
+    }
+  };
+  for (size_t i = 0; i < reconnects; i++) {
+    node.run_until([&] { return heater.boiler.is_connected() && !waiting; }, 10000);
+    node.run_for(2000);
+    heater.client.drop_link();
+  }
+  host::publish_observer = nullptr;
+  Percentiles(delays).print("time to first data after authenticate()");
+}
+
+// depth of the command queue and the sent requests after boot, sampled every 10 ms, max per second;
+// seconds in which every queue stayed empty are not printed
+static void bench_queue_depth(size_t heaters, uint32_t seconds) {
+  SBHostNode node;
+  for (size_t i = 0; i < heaters; i++) {
+    char address[32];
+    snprintf(address, sizeof(address), "AA:00:00:00:00:%02X", unsigned(i + 1));
+    node.add_heater(address);
+  }
+  node.pair_all();
+  node.setup();
+  printf("queue depth, %zu water heater(s): second: queued/sent max of each heater\n", heaters);
+  for (uint32_t s = 0; s < seconds; s++) {
+    std::vector<std::pair<size_t, size_t>> peak(heaters);
+    for (int sample = 0; sample < 100; sample++) {
+      node.run_for(10);
+      for (size_t i = 0; i < heaters; i++) {
+        auto &boiler = node.heater(i).boiler;
+        peak[i].first = std::max(peak[i].first, boiler.command_queue_.size());
+        peak[i].second = std::max(peak[i].second, boiler.sent_queue_.size());
+      }
+    }
+    bool idle = std::all_of(peak.begin(), peak.end(), [](const auto &p) { return p.first == 0 && p.second == 0; });
+    if (idle)
+      continue;
+    printf("  %3u s:", s + 1);
+    for (const auto &p : peak)
+      printf("  %2zu/%zu", p.first, p.second);
+    printf("\n");
+  }
+  size_t requests = 0;
+  for (size_t i = 0; i < heaters; i++)
+    requests += node.heater(i).sim.requests();
+  printf("  requests sent: %zu, peak BLE connections: %zu\n", requests, ble_client::BLEClient::peak_connected_clients());
+}
+
+int main(int argc, char **argv) {
+  bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+  bench_enqueue_to_publish(quick ? 20 : 500, 30);
+  bench_enqueue_to_publish(quick ? 20 : 500, 120);
+  bench_time_to_first_data(quick ? 3 : 50);
+  bench_queue_depth(1, quick ? 5 : 120);
+  bench_queue_depth(3, quick ? 5 : 120);
+  return 0;
+}
@@ -0,0 +1,93 @@
+// Driver for compilers without libFuzzer: runs every file given on the
+// command line (or in a given directory) through the fuzz target, then
+// random mutations of them.
+#include <dirent.h>
+#include <sys/stat.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static std::vector<uint8_t> read_file(const std::string &path) {
+  std::vector<uint8_t> data;
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    return data;
+  uint8_t buffer[256];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    data.insert(data.end(), buffer, buffer + length);
+  fclose(file);
+  return data;
+}
+
+static void collect(const std::string &path, std::vector<std::vector<uint8_t>> &inputs) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    fprintf(stderr, "cannot read %s\n", path.c_str());
+    exit(1);
+  }
+  if (!S_ISDIR(info.st_mode)) {
+    inputs.push_back(read_file(path));
+    return;
+  }
+  DIR *dir = opendir(path.c_str());
+  while (auto entry = readdir(dir)) {
+    if (entry->d_name[0] != '.')
+      collect(path + "/" + entry->d_name, inputs);
+  }
+  closedir(dir);
+}
+
+// usage: fuzz_protocol [-runs=N] <file or directory>...
+int main(int argc, char **argv) {
+  unsigned long runs = 10000;
+  std::vector<std::vector<uint8_t>> inputs;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "-runs=", 6) == 0)
+      runs = strtoul(argv[i] + 6, nullptr, 10);
+    else
+      collect(argv[i], inputs);
+  }
+  for (const auto &input : inputs)
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+  printf("%zu corpus inputs passed\n", inputs.size());
+  if (inputs.empty())
+    inputs.push_back({});
+
+  uint32_t state = 0x9E3779B9;
+  auto next = [&state]() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  };
+  for (unsigned long run = 0; run < runs; run++) {
+    auto data = inputs[next() % inputs.size()];
+    for (uint32_t edits = 1 + next() % 4; edits > 0; edits--) {
+      switch (next() % 4) {
+        case 0:
+          if (!data.empty())
+            data[next() % data.size()] = uint8_t(next());
+          break;
+        case 1:
+          data.insert(data.begin() + (data.empty() ? 0 : next() % (data.size() + 1)), uint8_t(next()));
+          break;
+        case 2:
+          if (!data.empty())
+            data.erase(data.begin() + next() % data.size());
+          break;
+        default:
+          data.resize(next() % 40, uint8_t(next()));
+          break;
+      }
+    }
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+  }
+  printf("%lu mutated inputs passed\n", runs);
+  return 0;
+}
@@ -0,0 +1,123 @@
+// Fuzz target for the frame codec: reply decoding (SBProtocolResult,
+// parse_fixed, SBPayload fields of every layout), the request encoder and
+// the component's handling of a received notification.
+//
+// Built with libFuzzer when the compiler has it (clang -fsanitize=fuzzer);
+// otherwise fuzz_main.cpp replays the corpus and mutations of it.
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "sb_host.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+#define FUZZ_ASSERT(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "assertion failed: %s\n", #condition); \
+      abort(); \
+    } \
+  } while (0)
+
+// touch every byte of a payload, so out-of-bounds reads are seen by the sanitizers
+static volatile uint32_t sink;
+
+template<typename Hours> static void decode_hours(const SBPayload &payload) {
+  size_t count = payload.count<Hours>();
+  FUZZ_ASSERT(count <= Hours::COUNT);
+  for (size_t i = 0; i <= Hours::COUNT; i++)
+    sink = sink + payload.get<Hours>(i);
+}
+
+static void decode_reply(const uint8_t *data, size_t size) {
+  SBProtocolResult result(data, uint16_t(size));
+  FUZZ_ASSERT(result.mRawLength == size);
+  FUZZ_ASSERT(result.mString.size() <= size);
+  if (!result.mString.empty())
+    FUZZ_ASSERT(result.mString.data() >= reinterpret_cast<const char *>(data) &&
+                result.mString.data() + result.mString.size() <= reinterpret_cast<const char *>(data) + size);
+  const auto &payload = result.mPayload;
+  FUZZ_ASSERT(payload.size() <= size);
+  for (size_t i = 0; i < payload.size(); i++)
+    sink = sink + payload.data()[i];
+  if (result.mRqType < SB_PACKET_COUNT) {
+    FUZZ_ASSERT(payload.size() <= 18);
+  }
+
+  sink = sink + result.get<SBLayout<SBPacket::SBC_PACKET_STATISTICS_GETALL>::Consumption>();
+  sink = sink + result.get<SBLayout<SBPacket::SBC_PACKET_STATISTICS_GETALL>::Time>();
+  sink = sink + result.get<SBLogEntryLayout::Time>() + result.get<SBLogEntryLayout::Code>();
+  sink = sink + result.get<SBLayout<SBPacket::SBC_PACKET_HOLIDAY_GET>::End>();
+  decode_hours<SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS>::Hours>(payload);
+  decode_hours<SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS2>::Hours>(payload);
+
+  int32_t value;
+  for (uint8_t decimals = 0; decimals < 4; decimals++) {
+    if (result.parse_fixed(decimals, value))
+      sink = sink + uint32_t(value);
+  }
+  // the whole frame as text, not only the part after the packet ID
+  if (SBProtocolResult::parse_fixed(std::string_view(reinterpret_cast<const char *>(data), size), 1, value))
+    sink = sink + uint32_t(value);
+}
+
+// the input drives the encoder: packet type, UID and the values of the fields
+static void encode_request(const uint8_t *data, size_t size) {
+  if (size < 4)
+    return;
+  auto type = SBPacket(data[0] % SB_PACKET_COUNT);
+  uint16_t uid = data[1] | (data[2] << 8);
+  SBPayload input(data + 3, size - 3);
+  SBProtocolRequest request(type, uid);
+  switch (data[0] % 4) {
+    case 0:
+      request.put<SBSettingLayout::Value>(input.get<SBU32<0>>());
+      break;
+    case 1: {
+      using Layout = SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAY>;
+      request.put<Layout::Day>(input.get<SBU8<0>>());
+      // the index is checked by the encoder
+      request.put<Layout::Hours>(input.get<SBU8<1>>() % 3, input.get<SBU24<2>>());
+      break;
+    }
+    case 2: {
+      using Hours = SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS>::Hours;
+      for (size_t i = 0; i < Hours::COUNT; i++)
+        request.put<Hours>(i, input.get<SBU24<0>>() + i);
+      break;
+    }
+    default:
+      request.writeString(std::string(reinterpret_cast<const char *>(data + 3), size - 3));
+      break;
+  }
+  FUZZ_ASSERT(request.size() <= SB_MAX_FRAME_SIZE);
+  FUZZ_ASSERT(request.size() >= SB_REQUEST_HEADER_SIZE);
+  FUZZ_ASSERT((request.data()[0] | (request.data()[1] << 8)) == type);
+  FUZZ_ASSERT((request.data()[2] | (request.data()[3] << 8)) == uid);
+  if (data[0] % 4 == 0 && !request.overflow())
+    FUZZ_ASSERT(request.payload().get<SBSettingLayout::Value>() == input.get<SBU32<0>>());
+}
+
+// a connected component, as the notifications of a real water heater would find it
+static SBHostHeater &connected_heater() {
+  static SBHostNode *node = [] {
+    auto node = new SBHostNode();
+    node->add_heater("AA:00:00:00:00:01");
+    node->pair_all();
+    node->setup();
+    node->run_until([node] { return node->heater(0).boiler.is_connected(); }, 5000);
+    node->run_for(5000);
+    return node;
+  }();
+  return node->heater(0);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  decode_reply(data, size);
+  encode_request(data, size);
+  auto &heater = connected_heater();
+  heater.sim.send_unsolicited(std::vector<uint8_t>(data, data + size));
+  heater.boiler.loop();
+  return 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+// Minimal test runner: TEST() registers a case, CHECK() records failures and
+// main() of sb_test_main.cpp runs all cases of the executable.
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace sb_test {
+
+struct Case {
+  const char *name;
+  std::function<void()> body;
+};
+
+std::vector<Case> &cases();
+void fail(const char *file, int line, const std::string &message);
+
+struct Registrar {
+  Registrar(const char *name, std::function<void()> body) { cases().push_back({name, std::move(body)}); }
+};
+
+template<typename T> std::string show(const T &value) {
+  if constexpr (std::is_same_v<T, std::string>)
+    return "\"" + value + "\"";
+  else if constexpr (std::is_convertible_v<T, const char *>)
+    return value == nullptr ? "nullptr" : "\"" + std::string(value) + "\"";
+  else if constexpr (std::is_enum_v<T>)
+    return std::to_string(long(value));
+  else if constexpr (std::is_arithmetic_v<T>)
+    return std::to_string(value);
+  else
+    return "?";
+}
+
+}  // namespace sb_test
+
+#define SB_TEST_CONCAT_(a, b) a##b
+#define SB_TEST_CONCAT(a, b) SB_TEST_CONCAT_(a, b)
+#define TEST(name) \
+  static void name(); \
+  static sb_test::Registrar SB_TEST_CONCAT(registrar_, name)(#name, name); \
+  static void name()
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) \
+      sb_test::fail(__FILE__, __LINE__, #condition); \
+  } while (0)
+
+#define CHECK_EQ(actual, expected) \
+  do { \
+    auto actual_ = (actual); \
+    auto expected_ = (expected); \
+    if (!(actual_ == expected_)) \
+      sb_test::fail(__FILE__, __LINE__, \
+                    std::string(#actual " == " #expected ": ") + sb_test::show(actual_) + " != " + \
+                        sb_test::show(expected_)); \
+  } while (0)
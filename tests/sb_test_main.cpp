@@ -0,0 +1,33 @@
+#include "sb_test.h"
+#include <cstring>
+
+namespace sb_test {
+
+std::vector<Case> &cases() {
+  static std::vector<Case> all;
+  return all;
+}
+
+static int failures = 0;
+
+void fail(const char *file, int line, const std::string &message) {
+  failures++;
+  fprintf(stderr, "%s:%d: check failed: %s\n", file, line, message.c_str());
+}
+
+}  // namespace sb_test
+
+// runs all cases, or the ones whose name contains the first argument
+int main(int argc, char **argv) {
+  int failed_cases = 0;
+  for (const auto &test : sb_test::cases()) {
+    if (argc > 1 && strstr(test.name, argv[1]) == nullptr)
+      continue;
+    int before = sb_test::failures;
+    test.body();
+    bool ok = sb_test::failures == before;
+    failed_cases += !ok;
+    printf("%s %s\n", ok ? "[  OK  ]" : "[ FAIL ]", test.name);
+  }
+  return failed_cases == 0 ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+#include "sb_heater_sim.h"
+#include <cstdio>
+#include "esphome/core/hal.h"
+
+namespace esphome {
+namespace sb {
+
+// text replies end with two bytes which are not part of the value
+static const uint8_t TEXT_TRAILER[] = {'\r', '\n'};
+
+static void put_u32(std::vector<uint8_t> &data, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    data.push_back(uint8_t(value >> (8 * i)));
+}
+
+SBHeaterSim::SBHeaterSim(ble_client::BLEClient *client) : client_(client) {
+  client->on_write = [this](const uint8_t *data, size_t length) { this->on_write_(data, length); };
+  this->last_loop_ = millis();
+}
+
+void SBHeaterSim::reject_next(SBPacket type, size_t count) {
+  if (type < SB_PACKET_COUNT)
+    this->reject_[type] += count;
+}
+
+void SBHeaterSim::reset_statistics() {
+  this->requests_ = 0;
+  this->replies_ = 0;
+  this->peak_backlog_ = this->replies_queue_.size();
+  this->by_type_.fill(0);
+  this->bucket_reads_.clear();
+}
+
+void SBHeaterSim::loop() {
+  uint32_t now = millis();
+  if (this->state.heating)
+    this->state.consumption += this->state.rated_power * (now - this->last_loop_) / 3600000.0;
+  this->last_loop_ = now;
+  if (!this->client_->is_connected()) {
+    // replies in progress are lost with the link
+    this->replies_queue_.clear();
+    this->session_uid_.clear();
+    return;
+  }
+  while (!this->replies_queue_.empty() && int32_t(now - this->replies_queue_.front().due) >= 0) {
+    auto reply = std::move(this->replies_queue_.front());
+    this->replies_queue_.pop_front();
+    this->replies_++;
+    this->client_->notify(reply.frame.data(), reply.frame.size());
+  }
+}
+
+void SBHeaterSim::send_unsolicited(const std::vector<uint8_t> &frame) {
+  this->client_->notify(frame.data(), frame.size());
+}
+
+void SBHeaterSim::on_write_(const uint8_t *data, size_t length) {
+  if (length < SB_REQUEST_HEADER_SIZE)
+    return;
+  auto type = SBPacket(data[0] | (data[1] << 8));
+  uint16_t uid = data[2] | (data[3] << 8);
+  this->requests_++;
+  if (type < SB_PACKET_COUNT)
+    this->by_type_[type]++;
+  if (this->ignore_ > 0) {
+    this->ignore_--;
+    return;
+  }
+  if (type < SB_PACKET_COUNT && this->reject_[type] > 0) {
+    this->reject_[type]--;
+    this->error_();
+    return;
+  }
+  this->handle_request_(type, uid, data + SB_REQUEST_HEADER_SIZE, length - SB_REQUEST_HEADER_SIZE);
+}
+
+void SBHeaterSim::handle_request_(SBPacket type, uint16_t uid, const uint8_t *payload, size_t length) {
+  if (type == SBPacket::SBC_PACKET_RQ_GLOBAL_MAC) {
+    this->last_uid_ = std::string(reinterpret_cast<const char *>(payload), length);
+    if (this->is_paired(this->last_uid_)) {
+      this->session_uid_ = this->last_uid_;
+      this->reply_text_(SBPacket::SBC_PACKET_GLOBAL_DEVICEBONDED, "");
+    } else {
+      this->reply_text_(SBPacket::SBC_PACKET_GLOBAL_PAIRPIN, "");
+    }
+    return;
+  }
+  if (type == SBPacket::SBC_PACKET_GLOBAL_PAIRPIN) {
+    auto pin = SBPayload(payload, length).get<SBLayout<SBPacket::SBC_PACKET_GLOBAL_PAIRPIN>::Value>();
+    this->confirm_(uid);
+    if (pin == this->pin && !this->last_uid_.empty()) {
+      this->pair(this->last_uid_);
+      this->session_uid_ = this->last_uid_;
+      this->reply_text_(SBPacket::SBC_PACKET_GLOBAL_PINRESULT, "1");
+    } else {
+      this->reply_text_(SBPacket::SBC_PACKET_GLOBAL_PINRESULT, "0");
+    }
+    return;
+  }
+  if (this->session_uid_.empty()) {
+    // not authenticated yet
+    this->error_();
+    return;
+  }
+  if (uid == 0) {
+    std::string text;
+    std::vector<uint8_t> binary;
+    if (!this->handle_read_(type, text, binary))
+      this->error_();
+    else if (!binary.empty())
+      this->reply_binary_(type, binary);
+    else
+      this->reply_text_(type, text);
+    return;
+  }
+  std::vector<uint8_t> data;
+  if (this->handle_write_(type, payload, length, data))
+    this->confirm_(uid, data);
+  else
+    this->error_();
+}
+
+bool SBHeaterSim::handle_read_(SBPacket type, std::string &text, std::vector<uint8_t> &binary) {
+  char buffer[32];
+  auto &s = this->state;
+  switch (type) {
+    case SBPacket::SBC_PACKET_HOME_BOILERMODEL:
+      text = s.model;
+      return true;
+    case SBPacket::SBC_PACKET_HOME_FWVERSION:
+      text = s.fw_version;
+      return true;
+    case SBPacket::SBC_PACKET_HOME_MODE:
+      text = std::to_string(s.mode);
+      return true;
+    case SBPacket::SBC_PACKET_HOME_HSRCSTATE:
+      text = s.heating ? "1" : "0";
+      return true;
+    case SBPacket::SBC_PACKET_HOME_SENSOR1:
+      snprintf(buffer, sizeof(buffer), "%.1f", s.sensor1);
+      text = buffer;
+      return true;
+    case SBPacket::SBC_PACKET_HOME_SENSOR2:
+      snprintf(buffer, sizeof(buffer), "%.1f", s.sensor2);
+      text = buffer;
+      return true;
+    case SBPacket::SBC_PACKET_HOME_TEMPERATURE:
+      text = std::to_string(s.target_temperature);
+      return true;
+    case SBPacket::SBC_PACKET_HOME_TIME:
+      text = this->week_time_text_();
+      return true;
+    case SBPacket::SBC_PACKET_HOME_ALL:
+      if (!this->aggregates)
+        return false;
+      snprintf(buffer, sizeof(buffer), "%u;%u;%.1f;%.1f;%d", s.mode, s.heating ? 1 : 0, s.sensor1, s.sensor2,
+               s.target_temperature);
+      text = buffer;
+      return true;
+    case SBPacket::SBC_PACKET_HDO_ONOFF:
+      text = s.hdo_enabled ? "1" : "0";
+      return true;
+    case SBPacket::SBC_PACKET_HDO_SELECTION_A:
+    case SBPacket::SBC_PACKET_HDO_SELECTION_B:
+    case SBPacket::SBC_PACKET_HDO_SELECTION_DP:
+    case SBPacket::SBC_PACKET_HDO_FREQUENCY:
+      text = s.hdo_config[type - SBPacket::SBC_PACKET_HDO_SELECTION_A];
+      return true;
+    case SBPacket::SBC_PACKET_HDO_SETTING:
+      text = s.hdo_config[4];
+      return true;
+    case SBPacket::SBC_PACKET_HDO_ALL:
+      if (!this->aggregates)
+        return false;
+      text = std::string(s.hdo_enabled ? "1" : "0");
+      for (const auto &field : s.hdo_config)
+        text += ";" + field;
+      return true;
+    case SBPacket::SBC_PACKET_HDO_LASTHDOTIME:
+      text = s.last_hdo_time;
+      return true;
+    case SBPacket::SBC_PACKET_HDO_LESSEXPTARIFFAVAILABLENOW:
+      text = s.low_tariff ? "1" : "0";
+      return true;
+    case SBPacket::SBC_PACKET_NIGHT_GETDAYS:
+    case SBPacket::SBC_PACKET_NIGHT_GETDAYS2: {
+      size_t first = type == SBPacket::SBC_PACKET_NIGHT_GETDAYS ? 0 : 4;
+      size_t count = type == SBPacket::SBC_PACKET_NIGHT_GETDAYS ? 4 : 3;
+      for (size_t i = 0; i < count; i++) {
+        for (int b = 0; b < 3; b++)
+          binary.push_back(uint8_t(s.schedule[first + i] >> (8 * b)));
+      }
+      return true;
+    }
+    case SBPacket::SBC_PACKET_GLOBAL_FIRSTLOG:
+    case SBPacket::SBC_PACKET_GLOBAL_NEXTLOG: {
+      if (type == SBPacket::SBC_PACKET_GLOBAL_FIRSTLOG)
+        this->log_position_ = 0;
+      std::pair<uint32_t, uint32_t> entry{0, 0};
+      if (this->log_position_ < s.log.size())
+        entry = s.log[this->log_position_++];
+      put_u32(binary, entry.first);
+      put_u32(binary, 0);
+      put_u32(binary, entry.second);
+      put_u32(binary, 0);
+      return true;
+    }
+    case SBPacket::SBC_PACKET_HOME_BOILERNAME:
+      text = s.name;
+      return true;
+    case SBPacket::SBC_PACKET_HOME_CAPACITY:
+      text = std::to_string(s.capacity);
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool SBHeaterSim::handle_write_(SBPacket type, const uint8_t *payload, size_t length, std::vector<uint8_t> &data) {
+  SBPayload request(payload, length);
+  auto &s = this->state;
+  switch (type) {
+    case SBPacket::SBC_PACKET_HOME_SETNORMALTEMPERATURE: {
+      auto value = request.get<SBSettingLayout::Value>();
+      if (value < 40 || value > 80)
+        return false;
+      s.target_temperature = int(value);
+      return true;
+    }
+    case SBPacket::SBC_PACKET_HOME_SETMODE: {
+      auto value = request.get<SBSettingLayout::Value>();
+      if (value > Mode::PROG)
+        return false;
+      s.mode = uint8_t(value);
+      return true;
+    }
+    case SBPacket::SBC_PACKET_HDO_SET_ONOFF:
+      s.hdo_enabled = request.get<SBSettingLayout::Value>() != 0;
+      return true;
+    case SBPacket::SBC_PACKET_NIGHT_SAVEDAY: {
+      using Layout = SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAY>;
+      auto day = request.get<Layout::Day>();
+      if (day > 6 || request.count<Layout::Hours>() != 1)
+        return false;
+      s.schedule[day] = request.get<Layout::Hours>(0);
+      return true;
+    }
+    case SBPacket::SBC_PACKET_NIGHT_SAVEDAYS:
+    case SBPacket::SBC_PACKET_NIGHT_SAVEDAYS2: {
+      using First = SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS>::Hours;
+      using Second = SBLayout<SBPacket::SBC_PACKET_NIGHT_SAVEDAYS2>::Hours;
+      bool first = type == SBPacket::SBC_PACKET_NIGHT_SAVEDAYS;
+      size_t count = first ? request.count<First>() : request.count<Second>();
+      if (count != (first ? First::COUNT : Second::COUNT))
+        return false;
+      for (size_t i = 0; i < count; i++)
+        s.schedule[(first ? 0 : 4) + i] = first ? request.get<First>(i) : request.get<Second>(i);
+      return true;
+    }
+    case SBPacket::SBC_PACKET_STATISTICS_GETALL:
+      put_u32(data, uint32_t(s.consumption));
+      put_u32(data, this->device_seconds_());
+      return true;
+    case SBPacket::SBC_PACKET_STATISTICS_WEEK:
+    case SBPacket::SBC_PACKET_STATISTICS_YEAR: {
+      auto index = request.get<SBStatisticsBucketLayout::Index>();
+      this->bucket_reads_.emplace_back(type, index);
+      bool week = type == SBPacket::SBC_PACKET_STATISTICS_WEEK;
+      if (index >= (week ? s.week.size() : s.year.size()))
+        return false;
+      put_u32(data, week ? s.week[index] : s.year[index]);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+void SBHeaterSim::reply_text_(SBPacket type, const std::string &text) {
+  char id[8];
+  snprintf(id, sizeof(id), "%02u", unsigned(type));
+  std::vector<uint8_t> frame(id, id + 2);
+  frame.insert(frame.end(), text.begin(), text.end());
+  frame.insert(frame.end(), std::begin(TEXT_TRAILER), std::end(TEXT_TRAILER));
+  this->queue_(std::move(frame));
+}
+
+void SBHeaterSim::reply_binary_(SBPacket type, const std::vector<uint8_t> &data) {
+  char id[8];
+  snprintf(id, sizeof(id), "%02u", unsigned(type));
+  std::vector<uint8_t> frame(id, id + 2);
+  frame.insert(frame.end(), data.begin(), data.end());
+  this->queue_(std::move(frame));
+}
+
+void SBHeaterSim::confirm_(uint16_t uid, const std::vector<uint8_t> &data) {
+  std::vector<uint8_t> payload{uint8_t(uid & 0xFF), uint8_t(uid >> 8)};
+  payload.insert(payload.end(), data.begin(), data.end());
+  this->reply_binary_(SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID, payload);
+}
+
+void SBHeaterSim::error_() { this->reply_text_(SBPacket::SBC_PACKET_HOME_ERROR, ""); }
+
+void SBHeaterSim::queue_(std::vector<uint8_t> &&frame) {
+  uint32_t now = millis();
+  if (int32_t(this->busy_until_ - now) < 0)
+    this->busy_until_ = now;
+  this->busy_until_ += this->latency;
+  this->replies_queue_.push_back(Reply{this->busy_until_, std::move(frame)});
+  if (this->replies_queue_.size() > this->peak_backlog_)
+    this->peak_backlog_ = this->replies_queue_.size();
+}
+
+uint32_t SBHeaterSim::device_seconds_() const { return this->state.week_time + millis() / 1000; }
+
+std::string SBHeaterSim::week_time_text_() const {
+  uint32_t seconds = this->device_seconds_() % (7 * 24 * 3600);
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%u.%02u:%02u:%02u", seconds / 86400, seconds / 3600 % 24, seconds / 60 % 60,
+           seconds % 60);
+  return buffer;
+}
+
+}  // namespace sb
+}  // namespace esphome
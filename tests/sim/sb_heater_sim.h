@@ -0,0 +1,121 @@
+#pragma once
+#include <array>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include "esphome/components/ble_client/ble_client.h"
+#include "SBProtocol.h"
+
+namespace esphome {
+namespace sb {
+
+// values of the simulated water heater, changed freely by the tests
+struct SBHeaterState {
+  uint8_t mode = Mode::SMART;
+  // whole degrees, as written by SETNORMALTEMPERATURE
+  int target_temperature = 60;
+  float sensor1 = 45.0f;
+  float sensor2 = 52.5f;
+  bool heating = false;
+  // power of the heating element, the counter grows by it while heating
+  float rated_power = 2000.0f;
+  bool hdo_enabled = false;
+  bool low_tariff = false;
+  std::string name = "Bojler";
+  std::string fw_version = "1.2.3;B;123456";
+  std::string model = "OKHE 80 SMART";
+  int capacity = 80;
+  std::array<std::string, 5> hdo_config = {"A1", "B2", "DP3", "50", "1"};
+  // last tariff switch, D.HH:MM:SS
+  std::string last_hdo_time = "0.06:00:00";
+  // clock of the water heater in seconds since Monday 0:00 at millis() 0
+  uint32_t week_time = 8 * 3600;
+  // PROG mode hours of each day
+  std::array<uint32_t, 7> schedule{};
+  // lifetime energy counter in Wh
+  double consumption = 123456.0;
+  std::array<uint32_t, 7> week{};
+  std::array<uint32_t, 12> year{};
+  // event log, newest entry first
+  std::vector<std::pair<uint32_t, uint32_t>> log;
+};
+
+/**
+ * Water heater answering the frames written through a fake BLE client, the
+ * way the device does: DEVICEBONDED or PAIRPIN after authentication,
+ * CONFIRMUID with the UID of settings, text and binary replies to reads and
+ * HOME_ERROR to anything it does not know. Requests are served one after
+ * another, each taking latency milliseconds.
+ */
+class SBHeaterSim {
+ public:
+  explicit SBHeaterSim(ble_client::BLEClient *client);
+
+  // deliver the replies which are due, advance the energy counter
+  void loop();
+  void pair(const std::string &uid) { this->paired_.insert(uid); }
+  bool is_paired(const std::string &uid) const { return this->paired_.count(uid) != 0; }
+  void forget_pairings() { this->paired_.clear(); }
+  // UID sent by the last authentication request
+  const std::string &last_uid() const { return this->last_uid_; }
+
+  // the next count requests of this type are answered by HOME_ERROR
+  void reject_next(SBPacket type, size_t count = 1);
+  // the next count requests get no reply at all
+  void ignore_next(size_t count = 1) { this->ignore_ += count; }
+  // send a frame which was not requested
+  void send_unsolicited(const std::vector<uint8_t> &frame);
+
+  size_t requests() const { return this->requests_; }
+  size_t requests(SBPacket type) const { return type < SB_PACKET_COUNT ? this->by_type_[type] : 0; }
+  size_t replies() const { return this->replies_; }
+  // STATISTICS_WEEK and STATISTICS_YEAR buckets in the order they were read
+  const std::vector<std::pair<SBPacket, uint8_t>> &bucket_reads() const { return this->bucket_reads_; }
+  // largest number of replies waiting to be sent
+  size_t peak_backlog() const { return this->peak_backlog_; }
+  void reset_statistics();
+
+  SBHeaterState state;
+  // time the water heater takes to answer one request
+  uint32_t latency = 30;
+  uint32_t pin = 1234;
+  // firmware with HOME_ALL and HDO_ALL
+  bool aggregates = true;
+
+ protected:
+  struct Reply {
+    uint32_t due;
+    std::vector<uint8_t> frame;
+  };
+  void on_write_(const uint8_t *data, size_t length);
+  void handle_request_(SBPacket type, uint16_t uid, const uint8_t *payload, size_t length);
+  bool handle_read_(SBPacket type, std::string &text, std::vector<uint8_t> &binary);
+  bool handle_write_(SBPacket type, const uint8_t *payload, size_t length, std::vector<uint8_t> &data);
+  void reply_text_(SBPacket type, const std::string &text);
+  void reply_binary_(SBPacket type, const std::vector<uint8_t> &data);
+  void confirm_(uint16_t uid, const std::vector<uint8_t> &data = {});
+  void error_();
+  void queue_(std::vector<uint8_t> &&frame);
+  uint32_t device_seconds_() const;
+  std::string week_time_text_() const;
+
+  ble_client::BLEClient *client_;
+  std::set<std::string> paired_;
+  std::string last_uid_;
+  std::string session_uid_;
+  std::deque<Reply> replies_queue_;
+  uint32_t busy_until_ = 0;
+  uint32_t last_loop_ = 0;
+  size_t log_position_ = 0;
+  std::array<size_t, SB_PACKET_COUNT> reject_{};
+  size_t ignore_ = 0;
+  std::vector<std::pair<SBPacket, uint8_t>> bucket_reads_;
+  size_t requests_ = 0;
+  size_t replies_ = 0;
+  size_t peak_backlog_ = 0;
+  std::array<size_t, SB_PACKET_COUNT> by_type_{};
+};
+
+}  // namespace sb
+}  // namespace esphome
@@ -0,0 +1,112 @@
+#include "sb_host.h"
+#include <algorithm>
+
+namespace esphome {
+namespace sb {
+
+SBHostHeater::SBHostHeater(const std::string &address) : client(address), sim(&client) {
+  this->client.register_ble_node(&this->boiler);
+  this->boiler.set_temp1(&this->temp1);
+  this->boiler.set_temp2(&this->temp2);
+  this->boiler.set_consumption(&this->consumption);
+  this->boiler.set_power(&this->power);
+  this->boiler.set_cycle_energy(&this->cycle_energy);
+  this->boiler.set_energy_today(&this->energy_today);
+  this->boiler.set_energy_week(&this->energy_week);
+  this->boiler.set_energy_month(&this->energy_month);
+  this->boiler.set_energy_year(&this->energy_year);
+  this->boiler.set_heat_on(&this->heat_on);
+  this->boiler.set_hdo_low_tariff(&this->hdo_low_tariff);
+  this->boiler.set_state(&this->state);
+  this->boiler.set_version(&this->version);
+  this->boiler.set_name(&this->name);
+  this->boiler.set_schedule_text(&this->schedule);
+  this->boiler.set_last_event(&this->last_event);
+  this->mode.set_parent(&this->boiler);
+  this->boiler.set_mode(&this->mode);
+  this->thermostat.set_parent(&this->boiler);
+  this->boiler.set_thermostat(&this->thermostat);
+  this->pin.set_parent(&this->boiler);
+  this->boiler.set_pin_input(&this->pin);
+  this->thermostat.set_name(address + " thermostat");
+}
+
+SBHostNode::SBHostNode() {
+  host::set_millis(0);
+  global_preferences->reset();
+  ble_client::BLEClient::reset_statistics();
+}
+
+SBHostNode::~SBHostNode() = default;
+
+SBHostHeater &SBHostNode::add_heater(const std::string &address) {
+  this->heaters_.push_back(std::make_unique<SBHostHeater>(address));
+  return *this->heaters_.back();
+}
+
+void SBHostNode::setup() {
+  for (auto &heater : this->heaters_) {
+    this->components_.push_back(&heater->client);
+    this->components_.push_back(&heater->boiler);
+  }
+  // stable, so components of the same priority keep the order of the configuration
+  std::stable_sort(this->components_.begin(), this->components_.end(), [](Component *a, Component *b) {
+    return a->get_setup_priority() > b->get_setup_priority();
+  });
+  for (auto component : this->components_)
+    component->setup();
+  // like the ESPHome scheduler, the first update() runs after a random offset of at most 5 s
+  for (auto &heater : this->heaters_) {
+    uint32_t interval = heater->boiler.get_update_interval();
+    this->next_update_.push_back(millis() + random_uint32() % std::max<uint32_t>(std::min<uint32_t>(interval / 2, 5000), 1));
+  }
+}
+
+void SBHostNode::step(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    host::advance_millis(1);
+    uint32_t now = millis();
+    for (size_t h = 0; h < this->heaters_.size(); h++) {
+      auto &heater = *this->heaters_[h];
+      heater.client.host_loop();
+      heater.sim.loop();
+      // like ESPHome, a failed component is no longer run
+      if (heater.boiler.is_failed())
+        continue;
+      heater.boiler.loop();
+      if (int32_t(now - this->next_update_[h]) >= 0) {
+        this->next_update_[h] = now + heater.boiler.get_update_interval();
+        heater.boiler.update();
+      }
+    }
+  }
+}
+
+void SBHostNode::run_for(uint32_t ms) { this->step(ms); }
+
+bool SBHostNode::run_until(const std::function<bool()> &condition, uint32_t timeout) {
+  for (uint32_t waited = 0; waited < timeout; waited++) {
+    if (condition())
+      return true;
+    this->step();
+  }
+  return condition();
+}
+
+void SBHostNode::pair_all() {
+  // the UID is generated by setup(); store one first, so it is known up front
+  for (size_t i = 0; i < this->heaters_.size(); i++) {
+    auto &heater = *this->heaters_[i];
+    char uid[7];
+    snprintf(uid, sizeof(uid), "%06X", unsigned(0xA0B000 + i));
+    SavedSmartBoilerSettings settings{};
+    memcpy(settings.uid, uid, sizeof(settings.uid));
+    auto pref = global_preferences->make_preference<SavedSmartBoilerSettings>(
+        heater.thermostat.get_object_id_hash());
+    pref.save(&settings);
+    heater.sim.pair(uid);
+  }
+}
+
+}  // namespace sb
+}  // namespace esphome
@@ -0,0 +1,87 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "smartboiler.h"
+#include "sb_heater_sim.h"
+
+namespace esphome {
+namespace sb {
+
+// gives the tests access to the internals of the component
+class SBHostBoiler : public SmartBoiler {
+ public:
+  using SmartBoiler::aggregate_unsupported_;
+  using SmartBoiler::capture_;
+  using SmartBoiler::clock_known_;
+  using SmartBoiler::clock_ref_ms_;
+  using SmartBoiler::clock_week_s_;
+  using SmartBoiler::command_queue_;
+  using SmartBoiler::enqueue_command_;
+  using SmartBoiler::flow_;
+  using SmartBoiler::handle_incoming;
+  using SmartBoiler::mPacketUid;
+  using SmartBoiler::next_uid_;
+  using SmartBoiler::poller_;
+  using SmartBoiler::sent_queue_;
+  using SmartBoiler::snapshot_;
+  using SmartBoiler::state_;
+  using SmartBoiler::tariff_model_;
+  using SmartBoiler::uid_;
+
+  bool is_connected() const { return this->state_ == ConnectionState::CONNECTED; }
+};
+
+/**
+ * One water heater and everything the ESPHome configuration would create for
+ * it: the BLE client, the component with all of its entities and the
+ * simulated device at the other end of the link.
+ */
+struct SBHostHeater {
+  explicit SBHostHeater(const std::string &address);
+
+  ble_client::BLEClient client;
+  SBHeaterSim sim;
+  SBHostBoiler boiler;
+
+  sensor::Sensor temp1, temp2, consumption, power, cycle_energy;
+  sensor::Sensor energy_today, energy_week, energy_month, energy_year;
+  binary_sensor::BinarySensor heat_on, hdo_low_tariff;
+  text_sensor::TextSensor state, version, name, schedule, last_event;
+  SmartBoilerModeSelect mode;
+  SmartBoilerThermostat thermostat;
+  SmartBoilerPinInput pin;
+};
+
+/**
+ * ESPHome node on the host: sets the components up in the order of their
+ * setup priorities and runs their loops on a simulated clock, one
+ * millisecond at a time.
+ */
+class SBHostNode {
+ public:
+  SBHostNode();
+  ~SBHostNode();
+
+  // the heater is configured but not set up yet, change its settings before setup()
+  SBHostHeater &add_heater(const std::string &address);
+  SBHostHeater &heater(size_t i) { return *this->heaters_.at(i); }
+  size_t size() const { return this->heaters_.size(); }
+
+  void setup();
+  void step(uint32_t ms = 1);
+  void run_for(uint32_t ms);
+  // false when the condition did not become true within timeout ms
+  bool run_until(const std::function<bool()> &condition, uint32_t timeout);
+  // pair every heater with the water heater before setup(), as if done on an earlier boot
+  void pair_all();
+
+ protected:
+  std::vector<std::unique_ptr<SBHostHeater>> heaters_;
+  std::vector<Component *> components_;
+  std::vector<uint32_t> next_update_;
+};
+
+}  // namespace sb
+}  // namespace esphome
@@ -0,0 +1,129 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "esphome/core/component.h"
+
+// subset of the ESP-IDF GATT client API used by the component
+typedef int esp_gattc_cb_event_t;
+typedef int esp_gatt_if_t;
+typedef int esp_err_t;
+typedef uint8_t esp_bd_addr_t[6];
+
+enum {
+  ESP_GATTC_OPEN_EVT = 2,
+  ESP_GATTC_SEARCH_CMPL_EVT = 6,
+  ESP_GATTC_NOTIFY_EVT = 10,
+  ESP_GATTC_REG_FOR_NOTIFY_EVT = 38,
+  ESP_GATTC_DISCONNECT_EVT = 41,
+};
+enum { ESP_GATT_OK = 0, ESP_GATT_ERROR = 0x85 };
+enum { ESP_GATT_WRITE_TYPE_NO_RSP = 1 };
+enum { ESP_GATT_AUTH_REQ_NONE = 0 };
+
+struct esp_ble_gattc_cb_param_t {
+  struct {
+    int status;
+    uint16_t conn_id;
+  } open;
+  struct {
+    uint16_t conn_id;
+    uint8_t *value;
+    uint16_t value_len;
+    uint16_t handle;
+  } notify;
+};
+
+esp_err_t esp_ble_gattc_write_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, uint16_t value_len,
+                                   uint8_t *value, int write_type, int auth_req);
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t gattc_if, uint8_t *server_bda, uint16_t handle);
+
+namespace esphome {
+namespace ble_client {
+
+struct BLECharacteristic {
+  uint16_t handle;
+};
+
+class BLEClientNode;
+
+/**
+ * Fake BLE client. Connections are simulated by host_loop(); frames written
+ * by the node go to the attached peer, notify() delivers frames back. At most
+ * MAX_CONNECTIONS clients are connected at the same time, as on the ESP32.
+ */
+class BLEClient : public Component {
+ public:
+  static const size_t MAX_CONNECTIONS = 3;
+
+  explicit BLEClient(const std::string &address);
+  ~BLEClient() override;
+
+  // as in ESPHome, the client connects once it is set up
+  void setup() override { this->enabled = true; }
+  float get_setup_priority() const override { return setup_priority::AFTER_BLUETOOTH; }
+  void register_ble_node(BLEClientNode *node);
+
+  esp_gatt_if_t get_gattc_if() const { return 3; }
+  uint16_t get_conn_id() const { return this->conn_id_; }
+  const std::string &address_str() const { return this->address_; }
+  uint8_t *get_remote_bda() { return this->bda_; }
+  BLECharacteristic *get_characteristic(uint16_t service, uint16_t characteristic);
+  void disconnect();
+  void set_enabled(bool enabled);
+
+  bool enabled = false;
+
+  // host side
+  void host_loop();
+  bool is_connected() const { return this->connected_; }
+  // frames written by the node, as sent over the air
+  std::function<void(const uint8_t *data, size_t length)> on_write;
+  // deliver a notification to the node
+  void notify(const uint8_t *data, size_t length);
+  // drop the link as if the water heater went out of range
+  void drop_link();
+  uint32_t connect_delay = 50;
+  size_t connections() const { return this->connections_; }
+  size_t failed_connections() const { return this->failed_connections_; }
+  static size_t connected_clients();
+  static size_t peak_connected_clients();
+  static void reset_statistics();
+  // called by the GATT stubs
+  static BLEClient *find(uint16_t conn_id);
+  static BLEClient *find_by_bda(const uint8_t *bda);
+  void on_register_for_notify(uint16_t handle);
+
+ protected:
+  void dispatch_(esp_gattc_cb_event_t event, esp_ble_gattc_cb_param_t *param);
+  void close_();
+
+  std::string address_;
+  uint8_t bda_[6]{};
+  uint16_t conn_id_;
+  std::vector<BLEClientNode *> nodes_;
+  BLECharacteristic main_{0x2A};
+  BLECharacteristic logging_{0x2C};
+  bool connected_ = false;
+  bool connecting_ = false;
+  bool notify_pending_ = false;
+  uint32_t connect_at_ = 0;
+  size_t connections_ = 0;
+  size_t failed_connections_ = 0;
+};
+
+class BLEClientNode {
+ public:
+  virtual ~BLEClientNode() = default;
+  virtual void gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+                                   esp_ble_gattc_cb_param_t *param) = 0;
+  void set_ble_client_parent(BLEClient *parent) { this->parent_ = parent; }
+  BLEClient *parent() { return this->parent_; }
+
+ protected:
+  BLEClient *parent_{nullptr};
+};
+
+}  // namespace ble_client
+}  // namespace esphome
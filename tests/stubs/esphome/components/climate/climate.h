@@ -0,0 +1,61 @@
+#pragma once
+#include <set>
+#include "esphome/core/component.h"
+
+namespace esphome {
+namespace climate {
+
+enum ClimateMode { CLIMATE_MODE_OFF, CLIMATE_MODE_HEAT };
+enum ClimateAction { CLIMATE_ACTION_OFF, CLIMATE_ACTION_HEATING, CLIMATE_ACTION_IDLE };
+
+class ClimateCall {
+ public:
+  ClimateCall &set_target_temperature(float target_temperature) {
+    this->target_temperature_ = target_temperature;
+    return *this;
+  }
+  const optional<float> &get_target_temperature() const { return this->target_temperature_; }
+  const optional<ClimateMode> &get_mode() const { return this->mode_; }
+
+ protected:
+  optional<float> target_temperature_;
+  optional<ClimateMode> mode_;
+};
+
+class ClimateTraits {
+ public:
+  void set_visual_min_temperature(float value) { this->visual_min_temperature = value; }
+  void set_visual_max_temperature(float value) { this->visual_max_temperature = value; }
+  void set_visual_temperature_step(float value) { this->visual_temperature_step = value; }
+  void set_supports_current_temperature(bool value) { this->supports_current_temperature = value; }
+  void set_supports_action(bool value) { this->supports_action = value; }
+  void set_supported_modes(std::set<ClimateMode> modes) { this->supported_modes = std::move(modes); }
+
+  float visual_min_temperature = 0;
+  float visual_max_temperature = 0;
+  float visual_temperature_step = 0;
+  bool supports_current_temperature = false;
+  bool supports_action = false;
+  std::set<ClimateMode> supported_modes;
+};
+
+class Climate : public EntityBase {
+ public:
+  void publish_state() { this->published_(); }
+  // host side: a call made from the UI
+  void perform(const ClimateCall &call) { this->control(call); }
+
+  float target_temperature = NAN;
+  float current_temperature = NAN;
+  ClimateAction action = CLIMATE_ACTION_OFF;
+  ClimateMode mode = CLIMATE_MODE_OFF;
+
+ protected:
+  virtual void control(const ClimateCall &call) = 0;
+  virtual ClimateTraits traits() = 0;
+};
+
+}  // namespace climate
+}  // namespace esphome
+
+#define LOG_CLIMATE(prefix, type, obj)
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace md5 {
+
+// not MD5, only a stable digest of the same shape
+class MD5Digest {
+ public:
+  void init() { this->hash_ = 2166136261u; }
+  void add(const char *data, size_t length) {
+    for (size_t i = 0; i < length; i++)
+      this->hash_ = (this->hash_ ^ uint8_t(data[i])) * 16777619u;
+  }
+  void calculate() {}
+  // like ESPHome: 32 hex digits and a terminating zero
+  void get_hex(char *output);
+
+ protected:
+  uint32_t hash_ = 0;
+};
+
+}  // namespace md5
+}  // namespace esphome
@@ -0,0 +1,25 @@
+#pragma once
+#include "esphome/core/component.h"
+
+namespace esphome {
+namespace number {
+
+class Number : public EntityBase {
+ public:
+  void publish_state(float state) {
+    this->state = state;
+    this->published_();
+  }
+  // host side: a value entered in the UI
+  void perform(float value) { this->control(value); }
+
+  float state = NAN;
+
+ protected:
+  virtual void control(float value) = 0;
+};
+
+}  // namespace number
+}  // namespace esphome
+
+#define LOG_NUMBER(prefix, type, obj)
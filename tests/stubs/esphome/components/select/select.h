@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include "esphome/core/component.h"
+
+namespace esphome {
+namespace select {
+
+class Select : public EntityBase {
+ public:
+  void publish_state(const std::string &state) {
+    this->state = state;
+    this->has_state_ = true;
+    this->published_();
+  }
+  bool has_state() const { return this->has_state_; }
+  // host side: an option chosen in the UI
+  void perform(const std::string &value) { this->control(value); }
+
+  std::string state;
+
+ protected:
+  virtual void control(const std::string &value) = 0;
+
+  bool has_state_ = false;
+};
+
+}  // namespace select
+}  // namespace esphome
+
+#define LOG_SELECT(prefix, type, obj)
@@ -0,0 +1,29 @@
+#pragma once
+#include "esphome/core/component.h"
+
+namespace esphome {
+namespace sensor {
+
+class Sensor : public EntityBase {
+ public:
+  void publish_state(float state) {
+    this->raw_state = state;
+    this->state = state;
+    this->has_state_ = true;
+    this->published_();
+  }
+  float get_raw_state() const { return this->raw_state; }
+  float get_state() const { return this->state; }
+  bool has_state() const { return this->has_state_; }
+
+  float state = NAN;
+  float raw_state = NAN;
+
+ protected:
+  bool has_state_ = false;
+};
+
+}  // namespace sensor
+}  // namespace esphome
+
+#define LOG_SENSOR(prefix, type, obj)
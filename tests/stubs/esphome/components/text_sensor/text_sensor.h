@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include "esphome/core/component.h"
+
+namespace esphome {
+namespace text_sensor {
+
+class TextSensor : public EntityBase {
+ public:
+  void publish_state(const std::string &state) {
+    this->state = state;
+    this->has_state_ = true;
+    this->published_();
+  }
+  bool has_state() const { return this->has_state_; }
+
+  std::string state;
+
+ protected:
+  bool has_state_ = false;
+};
+
+}  // namespace text_sensor
+}  // namespace esphome
+
+#define LOG_TEXT_SENSOR(prefix, type, obj)
@@ -0,0 +1,45 @@
+#pragma once
+#include <functional>
+#include <tuple>
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+
+template<typename... Ts> class Trigger {
+ public:
+  void trigger(Ts... x) {
+    if (this->on_trigger_)
+      this->on_trigger_(x...);
+  }
+  // host side: what the automation of the trigger does
+  void set_on_trigger(std::function<void(Ts...)> &&on_trigger) { this->on_trigger_ = std::move(on_trigger); }
+
+ protected:
+  std::function<void(Ts...)> on_trigger_;
+};
+
+template<typename... Ts> class Action {
+ public:
+  virtual ~Action() = default;
+  virtual void play(Ts... x) = 0;
+};
+
+template<typename T, typename... X> class TemplatableValue {
+ public:
+  TemplatableValue() = default;
+  TemplatableValue(T value) : value_(value) {}
+  T value(X... x) { return this->value_; }
+  bool has_value() const { return true; }
+
+ protected:
+  T value_{};
+};
+
+}  // namespace esphome
+
+#define TEMPLATABLE_VALUE(type, name) \
+ protected: \
+  TemplatableValue<type, Ts...> name##_{}; \
+\
+ public: \
+  template<typename V> void set_##name(V name) { this->name##_ = name; }
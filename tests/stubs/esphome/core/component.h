@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+
+namespace esphome {
+
+namespace setup_priority {
+// same values as ESPHome, higher runs first
+static const float BLUETOOTH = 350.0f;
+static const float AFTER_BLUETOOTH = 300.0f;
+static const float DATA = 600.0f;
+}  // namespace setup_priority
+
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+  void mark_failed() { this->failed_ = true; }
+  bool is_failed() const { return this->failed_; }
+
+ protected:
+  bool failed_ = false;
+};
+
+class PollingComponent : public Component {
+ public:
+  PollingComponent() = default;
+  explicit PollingComponent(uint32_t update_interval) : update_interval_(update_interval) {}
+  virtual void update() = 0;
+  uint32_t get_update_interval() const { return this->update_interval_; }
+  void set_update_interval(uint32_t update_interval) { this->update_interval_ = update_interval; }
+
+ protected:
+  uint32_t update_interval_ = 600000;
+};
+
+class EntityBase;
+
+namespace host {
+// called after every publish of any entity, for latency measurements
+extern std::function<void(EntityBase *entity)> publish_observer;
+}  // namespace host
+
+class EntityBase {
+ public:
+  const std::string &get_name() const { return this->name_; }
+  void set_name(const std::string &name) { this->name_ = name; }
+  uint32_t get_object_id_hash() { return fnv1_hash(this->name_); }
+  // host side: number of publish_state() calls
+  size_t get_publish_count() const { return this->publishes_; }
+
+ protected:
+  void published_() {
+    this->publishes_++;
+    if (host::publish_observer)
+      host::publish_observer(this);
+  }
+
+  std::string name_;
+  size_t publishes_ = 0;
+};
+
+}  // namespace esphome
@@ -0,0 +1,14 @@
+#pragma once
+// the host build compiles every optional feature of the component
+
+#define USE_SMARTBOILER_TEMP1
+#define USE_SMARTBOILER_TEMP2
+#define USE_SMARTBOILER_POWER
+#define USE_SMARTBOILER_MODE
+#define USE_SMARTBOILER_THERMOSTAT
+#define USE_SMARTBOILER_SCHEDULE
+#define USE_SMARTBOILER_EVENT_LOG
+#define USE_SMARTBOILER_HISTORY
+#define USE_SMARTBOILER_DIAGNOSTICS
+#define USE_SMARTBOILER_CAPTURE
+#define SMARTBOILER_CAPTURE_SIZE 32
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+
+namespace esphome {
+
+// host clock, moved forward by the test harness only
+uint32_t millis();
+uint32_t micros();
+
+namespace host {
+void set_millis(uint32_t now);
+void advance_millis(uint32_t ms);
+}  // namespace host
+
+}  // namespace esphome
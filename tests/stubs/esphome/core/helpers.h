@@ -0,0 +1,55 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#define PACKED __attribute__((packed))
+
+namespace esphome {
+
+template<typename T> using optional = std::optional<T>;
+
+template<typename T> optional<T> parse_number(const std::string &str) {
+  char *end = nullptr;
+  long value = strtol(str.c_str(), &end, 10);
+  if (end == str.c_str() || *end != '\0')
+    return {};
+  return T(value);
+}
+std::string format_hex_pretty(const uint8_t *data, size_t length);
+std::string format_hex_pretty(const std::vector<uint8_t> &data);
+std::string str_upper_case(const std::string &str);
+uint32_t random_uint32();
+uint32_t fnv1_hash(const std::string &str);
+
+template<typename T> class Parented {
+ public:
+  Parented() = default;
+  explicit Parented(T *parent) : parent_(parent) {}
+  T *get_parent() const { return this->parent_; }
+  void set_parent(T *parent) { this->parent_ = parent; }
+
+ protected:
+  T *parent_{nullptr};
+};
+
+template<typename... X> class CallbackManager;
+template<typename... Ts> class CallbackManager<void(Ts...)> {
+ public:
+  void add(std::function<void(Ts...)> &&callback) { this->callbacks_.push_back(std::move(callback)); }
+  void call(Ts... args) {
+    for (auto &callback : this->callbacks_)
+      callback(args...);
+  }
+  size_t size() const { return this->callbacks_.size(); }
+
+ protected:
+  std::vector<std::function<void(Ts...)>> callbacks_;
+};
+
+}  // namespace esphome
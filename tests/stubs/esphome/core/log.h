@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdio>
+
+namespace esphome {
+
+enum { ESPHOME_LOG_LEVEL_NONE, ESPHOME_LOG_LEVEL_ERROR, ESPHOME_LOG_LEVEL_WARN, ESPHOME_LOG_LEVEL_INFO,
+       ESPHOME_LOG_LEVEL_CONFIG, ESPHOME_LOG_LEVEL_DEBUG, ESPHOME_LOG_LEVEL_VERBOSE, ESPHOME_LOG_LEVEL_VERY_VERBOSE };
+
+// prints to stderr when level is enabled by SB_LOG_LEVEL (0-7, default 2: warnings)
+void esp_log_printf_(int level, const char *tag, int line, const char *format, ...);
+bool esp_log_enabled_(int level);
+
+}  // namespace esphome
+
+// like ESPHome with a lower log level compiled in, arguments of disabled levels are not evaluated
+#define SB_HOST_LOG_(level, tag, ...) \
+  do { \
+    if (::esphome::esp_log_enabled_(level)) \
+      ::esphome::esp_log_printf_(level, tag, __LINE__, __VA_ARGS__); \
+  } while (0)
+#define ESP_LOGE(tag, ...) SB_HOST_LOG_(::esphome::ESPHOME_LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) SB_HOST_LOG_(::esphome::ESPHOME_LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) SB_HOST_LOG_(::esphome::ESPHOME_LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) SB_HOST_LOG_(::esphome::ESPHOME_LOG_LEVEL_CONFIG, tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) SB_HOST_LOG_(::esphome::ESPHOME_LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) SB_HOST_LOG_(::esphome::ESPHOME_LOG_LEVEL_VERBOSE, tag, __VA_ARGS__)
+#define ESP_LOGVV(tag, ...) SB_HOST_LOG_(::esphome::ESPHOME_LOG_LEVEL_VERY_VERBOSE, tag, __VA_ARGS__)
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+
+// stored in memory by hash, survives a restart of the component within one test
+class ESPPreferenceObject {
+ public:
+  ESPPreferenceObject() = default;
+  ESPPreferenceObject(uint32_t hash, size_t size) : hash_(hash), size_(size), valid_(true) {}
+  template<typename T> bool save(const T *src) {
+    return sizeof(T) == this->size_ && this->save_(reinterpret_cast<const uint8_t *>(src));
+  }
+  template<typename T> bool load(T *dest) {
+    return sizeof(T) == this->size_ && this->load_(reinterpret_cast<uint8_t *>(dest));
+  }
+
+ protected:
+  bool save_(const uint8_t *data);
+  bool load_(uint8_t *data);
+
+  uint32_t hash_ = 0;
+  size_t size_ = 0;
+  bool valid_ = false;
+};
+
+class ESPPreferences {
+ public:
+  template<typename T> ESPPreferenceObject make_preference(uint32_t hash, bool in_flash = false) {
+    return ESPPreferenceObject(hash, sizeof(T));
+  }
+  // forget everything stored, as after erasing the flash
+  void reset();
+  size_t saves() const { return this->saves_; }
+
+  size_t saves_ = 0;
+};
+
+extern ESPPreferences *global_preferences;
+
+}  // namespace esphome
@@ -0,0 +1,283 @@
+// Host implementations of the ESPHome and ESP-IDF functions used by the component
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstdlib>
+#include <map>
+#include "esphome/components/ble_client/ble_client.h"
+#include "esphome/components/md5/md5.h"
+#include "esphome/core/component.h"
+
+namespace esphome {
+
+static uint32_t host_millis = 0;
+
+uint32_t millis() { return host_millis; }
+uint32_t micros() { return host_millis * 1000; }
+
+namespace host {
+void set_millis(uint32_t now) { host_millis = now; }
+void advance_millis(uint32_t ms) { host_millis += ms; }
+
+std::function<void(EntityBase *entity)> publish_observer;
+}  // namespace host
+
+static int log_level() {
+  static int level = [] {
+    const char *env = getenv("SB_LOG_LEVEL");
+    return env != nullptr ? atoi(env) : int(ESPHOME_LOG_LEVEL_WARN);
+  }();
+  return level;
+}
+
+bool esp_log_enabled_(int level) { return level <= log_level(); }
+
+void esp_log_printf_(int level, const char *tag, int line, const char *format, ...) {
+  if (!esp_log_enabled_(level))
+    return;
+  static const char LETTERS[] = "NEWICDVV";
+  fprintf(stderr, "[%7u][%c][%s:%d]: ", host_millis, LETTERS[level], tag, line);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+std::string format_hex_pretty(const uint8_t *data, size_t length) {
+  std::string out;
+  char buffer[4];
+  for (size_t i = 0; i < length; i++) {
+    snprintf(buffer, sizeof(buffer), i ? ".%02X" : "%02X", data[i]);
+    out += buffer;
+  }
+  return out;
+}
+std::string format_hex_pretty(const std::vector<uint8_t> &data) { return format_hex_pretty(data.data(), data.size()); }
+
+std::string str_upper_case(const std::string &str) {
+  std::string out = str;
+  std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) { return char(toupper(c)); });
+  return out;
+}
+
+uint32_t random_uint32() {
+  // deterministic, every run of a test sees the same values
+  static uint32_t state = 0x12345678;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+uint32_t fnv1_hash(const std::string &str) {
+  uint32_t hash = 2166136261UL;
+  for (char c : str) {
+    hash *= 16777619UL;
+    hash ^= uint8_t(c);
+  }
+  return hash;
+}
+
+static std::map<uint32_t, std::vector<uint8_t>> &preference_store() {
+  static std::map<uint32_t, std::vector<uint8_t>> store;
+  return store;
+}
+
+static ESPPreferences host_preferences;
+ESPPreferences *global_preferences = &host_preferences;
+
+void ESPPreferences::reset() {
+  preference_store().clear();
+  this->saves_ = 0;
+}
+
+bool ESPPreferenceObject::save_(const uint8_t *data) {
+  if (!this->valid_)
+    return false;
+  preference_store()[this->hash_].assign(data, data + this->size_);
+  global_preferences->saves_++;
+  return true;
+}
+
+bool ESPPreferenceObject::load_(uint8_t *data) {
+  if (!this->valid_)
+    return false;
+  auto it = preference_store().find(this->hash_);
+  if (it == preference_store().end() || it->second.size() != this->size_)
+    return false;
+  memcpy(data, it->second.data(), this->size_);
+  return true;
+}
+
+namespace md5 {
+void MD5Digest::get_hex(char *output) {
+  uint32_t hash = this->hash_;
+  for (int i = 0; i < 32; i++) {
+    output[i] = "0123456789abcdef"[hash & 0x0F];
+    hash = (hash >> 4) | (hash << 28);
+    if (i % 8 == 7)
+      hash = hash * 16777619u + i;
+  }
+  output[32] = 0;
+}
+}  // namespace md5
+
+namespace ble_client {
+
+static std::vector<BLEClient *> &all_clients() {
+  static std::vector<BLEClient *> clients;
+  return clients;
+}
+static size_t connected_count = 0;
+static size_t peak_connected_count = 0;
+
+BLEClient::BLEClient(const std::string &address) : address_(address) {
+  static uint16_t next_conn_id = 0;
+  this->conn_id_ = next_conn_id++;
+  for (size_t i = 0; i < 6; i++)
+    this->bda_[i] = uint8_t(fnv1_hash(address) >> (i * 4));
+  all_clients().push_back(this);
+}
+
+BLEClient::~BLEClient() {
+  if (this->connected_)
+    connected_count--;
+  auto &clients = all_clients();
+  clients.erase(std::remove(clients.begin(), clients.end(), this), clients.end());
+}
+
+void BLEClient::register_ble_node(BLEClientNode *node) {
+  node->set_ble_client_parent(this);
+  this->nodes_.push_back(node);
+}
+
+BLECharacteristic *BLEClient::get_characteristic(uint16_t service, uint16_t characteristic) {
+  if (service == 0x1899 && characteristic == 0x2B99)
+    return &this->main_;
+  if (service == 0x1898 && characteristic == 0x2B98)
+    return &this->logging_;
+  return nullptr;
+}
+
+void BLEClient::set_enabled(bool enabled) {
+  this->enabled = enabled;
+  if (!enabled)
+    this->connecting_ = false;
+  if (!enabled && this->connected_)
+    this->disconnect();
+}
+
+void BLEClient::disconnect() {
+  if (!this->connected_)
+    return;
+  this->close_();
+}
+
+void BLEClient::drop_link() { this->disconnect(); }
+
+void BLEClient::close_() {
+  this->connected_ = false;
+  this->notify_pending_ = false;
+  connected_count--;
+  esp_ble_gattc_cb_param_t param{};
+  this->dispatch_(ESP_GATTC_DISCONNECT_EVT, &param);
+}
+
+void BLEClient::host_loop() {
+  if (!this->enabled || this->connected_)
+    return;
+  uint32_t now = millis();
+  if (!this->connecting_) {
+    this->connecting_ = true;
+    this->connect_at_ = now + this->connect_delay;
+    return;
+  }
+  if (int32_t(now - this->connect_at_) < 0)
+    return;
+  this->connecting_ = false;
+  esp_ble_gattc_cb_param_t param{};
+  param.open.conn_id = this->conn_id_;
+  if (connected_count >= MAX_CONNECTIONS) {
+    // the controller has no free connection, ESPHome tries again later
+    this->failed_connections_++;
+    param.open.status = ESP_GATT_ERROR;
+    this->dispatch_(ESP_GATTC_OPEN_EVT, &param);
+    this->connect_at_ = now + 1000;
+    this->connecting_ = true;
+    return;
+  }
+  this->connected_ = true;
+  this->connections_++;
+  connected_count++;
+  peak_connected_count = std::max(peak_connected_count, connected_count);
+  param.open.status = ESP_GATT_OK;
+  this->dispatch_(ESP_GATTC_OPEN_EVT, &param);
+  this->dispatch_(ESP_GATTC_SEARCH_CMPL_EVT, &param);
+  if (this->notify_pending_) {
+    this->notify_pending_ = false;
+    this->dispatch_(ESP_GATTC_REG_FOR_NOTIFY_EVT, &param);
+  }
+}
+
+void BLEClient::on_register_for_notify(uint16_t handle) {
+  if (handle == this->logging_.handle)
+    this->notify_pending_ = true;
+}
+
+void BLEClient::notify(const uint8_t *data, size_t length) {
+  if (!this->connected_)
+    return;
+  esp_ble_gattc_cb_param_t param{};
+  param.notify.conn_id = this->conn_id_;
+  param.notify.handle = this->logging_.handle;
+  param.notify.value = const_cast<uint8_t *>(data);
+  param.notify.value_len = uint16_t(length);
+  this->dispatch_(ESP_GATTC_NOTIFY_EVT, &param);
+}
+
+void BLEClient::dispatch_(esp_gattc_cb_event_t event, esp_ble_gattc_cb_param_t *param) {
+  for (auto node : this->nodes_)
+    node->gattc_event_handler(event, this->get_gattc_if(), param);
+}
+
+size_t BLEClient::connected_clients() { return connected_count; }
+size_t BLEClient::peak_connected_clients() { return peak_connected_count; }
+void BLEClient::reset_statistics() { peak_connected_count = connected_count; }
+
+BLEClient *BLEClient::find(uint16_t conn_id) {
+  for (auto client : all_clients()) {
+    if (client->get_conn_id() == conn_id)
+      return client;
+  }
+  return nullptr;
+}
+
+BLEClient *BLEClient::find_by_bda(const uint8_t *bda) {
+  for (auto client : all_clients()) {
+    if (client->get_remote_bda() == bda)
+      return client;
+  }
+  return nullptr;
+}
+
+}  // namespace ble_client
+}  // namespace esphome
+
+esp_err_t esp_ble_gattc_write_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, uint16_t value_len,
+                                   uint8_t *value, int write_type, int auth_req) {
+  auto client = esphome::ble_client::BLEClient::find(conn_id);
+  if (client == nullptr || !client->is_connected())
+    return ESP_GATT_ERROR;
+  if (client->on_write)
+    client->on_write(value, value_len);
+  return ESP_GATT_OK;
+}
+
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t gattc_if, uint8_t *server_bda, uint16_t handle) {
+  auto client = esphome::ble_client::BLEClient::find_by_bda(server_bda);
+  if (client == nullptr)
+    return ESP_GATT_ERROR;
+  client->on_register_for_notify(handle);
+  return ESP_GATT_OK;
+}
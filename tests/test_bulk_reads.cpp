@@ -0,0 +1,70 @@
+// Aggregate reads of the state and the HDO settings
+#include "sb_host.h"
+#include "sb_test.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+static const SBPacket HOME_ALL = SBPacket::SBC_PACKET_HOME_ALL;
+
+TEST(bulk_reads_are_off_by_default) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(60000);
+  CHECK_EQ(heater.sim.requests(HOME_ALL), size_t(0));
+  CHECK_EQ(heater.sim.requests(SBPacket::SBC_PACKET_HDO_ALL), size_t(0));
+  CHECK_EQ(heater.temp1.state, 45.0f);
+}
+
+TEST(aggregate_reply_reschedules_covered_values) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  heater.boiler.set_bulk_reads(true);
+  // not a multiple of the 10 s state interval
+  heater.boiler.set_temperature_poll_interval(25000);
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  heater.sim.reset_statistics();
+  node.run_for(120000);
+  // the heating state is due every 10 s, each reply refreshes the temperatures as well
+  CHECK(heater.sim.requests(HOME_ALL) <= 12);
+  CHECK_EQ(heater.sim.requests(SBPacket::SBC_PACKET_HOME_SENSOR1), size_t(0));
+  CHECK_EQ(heater.temp1.state, 45.0f);
+}
+
+TEST(single_error_keeps_aggregates) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  heater.boiler.set_bulk_reads(true);
+  heater.sim.reject_next(HOME_ALL, 1);
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(30000);
+  CHECK(!heater.boiler.aggregate_unsupported_(HOME_ALL));
+  CHECK(heater.sim.requests(HOME_ALL) > 1);
+}
+
+TEST(unsupported_aggregates_are_retried_after_reconnect) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  heater.boiler.set_bulk_reads(true);
+  heater.sim.aggregates = false;
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  CHECK(node.run_until([&] { return heater.boiler.aggregate_unsupported_(HOME_ALL); }, 60000));
+  CHECK_EQ(heater.sim.requests(HOME_ALL), size_t(3));
+  CHECK(node.run_until([&] { return heater.temp1.has_state(); }, 5000));
+  heater.client.drop_link();
+  node.step();
+  CHECK(!heater.boiler.is_connected());
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 5000));
+  CHECK(!heater.boiler.aggregate_unsupported_(HOME_ALL));
+  CHECK(node.run_until([&] { return heater.sim.requests(HOME_ALL) > 3; }, 30000));
+}
@@ -0,0 +1,101 @@
+// Frame codec and request UIDs
+#include "sb_host.h"
+#include "sb_test.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+static SBProtocolResult decode(const std::vector<uint8_t> &frame) {
+  return SBProtocolResult(frame.data(), uint16_t(frame.size()));
+}
+
+static std::vector<uint8_t> bytes(const char *text) { return std::vector<uint8_t>(text, text + strlen(text)); }
+
+TEST(decodes_text_reply) {
+  auto frame = bytes("0745.5\r\n");
+  auto result = decode(frame);
+  CHECK_EQ(result.mRqType, SBPacket::SBC_PACKET_HOME_SENSOR1);
+  CHECK(result.mString == "45.5");
+  int32_t value;
+  CHECK(result.parse_fixed(1, value));
+  CHECK_EQ(value, 455);
+}
+
+TEST(decodes_confirmation_with_data) {
+  std::vector<uint8_t> frame = {'5', '1', 0x34, 0x12, 0x40, 0xE2, 0x01, 0x00, 0x10, 0x0E, 0x00, 0x00};
+  auto result = decode(frame);
+  CHECK_EQ(result.mRqType, SBPacket::SBC_PACKET_GLOBAL_CONFIRMUID);
+  CHECK_EQ(result.mUid, uint16_t(0x1234));
+  CHECK_EQ(result.get<SBLayout<SBPacket::SBC_PACKET_STATISTICS_GETALL>::Consumption>(), uint32_t(123456));
+  CHECK_EQ(result.get<SBLayout<SBPacket::SBC_PACKET_STATISTICS_GETALL>::Time>(), uint32_t(3600));
+}
+
+TEST(rejects_malformed_frames) {
+  CHECK_EQ(decode(bytes("5")).mRqType, SBPacket::SBC_PACKET_NONE);
+  CHECK_EQ(decode(bytes("x7")).mRqType, SBPacket::SBC_PACKET_NONE);
+  // a confirmation without its UID cannot be matched
+  CHECK_EQ(decode(bytes("51\x01")).mRqType, SBPacket::SBC_PACKET_NONE);
+  // a short binary reply reads as 0 past its end
+  std::vector<uint8_t> frame = {'4', '4', 0x3F, 0x00, 0xC0, 0x01};
+  auto result = decode(frame);
+  CHECK_EQ(result.mPayload.count<SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS>::Hours>(), size_t(1));
+  CHECK_EQ(result.mPayload.get<SBLayout<SBPacket::SBC_PACKET_NIGHT_GETDAYS>::Hours>(1), uint32_t(0));
+}
+
+TEST(parse_fixed_bounds) {
+  int32_t value;
+  CHECK(SBProtocolResult::parse_fixed("-5.25", 1, value));
+  CHECK_EQ(value, -52);
+  CHECK(SBProtocolResult::parse_fixed("2147483647", 0, value));
+  CHECK(!SBProtocolResult::parse_fixed("2147483648", 0, value));
+  CHECK(!SBProtocolResult::parse_fixed("214748364.8", 1, value));
+  CHECK(!SBProtocolResult::parse_fixed("", 0, value));
+  CHECK(!SBProtocolResult::parse_fixed("4x", 0, value));
+}
+
+TEST(encodes_setting) {
+  SBProtocolRequest request(SBPacket::SBC_PACKET_HOME_SETMODE, 0x0102);
+  request.put<SBLayout<SBPacket::SBC_PACKET_HOME_SETMODE>::Value>(6);
+  const uint8_t expected[] = {18, 0, 0x02, 0x01, 6, 0, 0, 0};
+  CHECK_EQ(request.size(), uint8_t(sizeof(expected)));
+  CHECK(memcmp(request.data(), expected, sizeof(expected)) == 0);
+  CHECK(!request.overflow());
+}
+
+TEST(uid_skips_zero_on_wrap) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  heater.boiler.mPacketUid = 0xFFFF;
+  CHECK_EQ(heater.boiler.next_uid_(), uint16_t(0xFFFF));
+  CHECK_EQ(heater.boiler.next_uid_(), uint16_t(1));
+
+  // a write sent across the wrap is still confirmed, not taken for a plain read
+  heater.boiler.mPacketUid = 0xFFFF;
+  SBCompletion first = SBCompletion::CANCELLED, second = SBCompletion::CANCELLED;
+  heater.boiler.write_value(SBPacket::SBC_PACKET_HOME_SETNORMALTEMPERATURE, 50,
+                            [&](SBCompletion status, const SBProtocolResult *result) { first = status; });
+  heater.boiler.write_value(SBPacket::SBC_PACKET_HOME_SETMODE, Mode::PROG,
+                            [&](SBCompletion status, const SBProtocolResult *result) { second = status; });
+  node.run_for(1000);
+  CHECK_EQ(first, SBCompletion::CONFIRMED);
+  CHECK_EQ(second, SBCompletion::CONFIRMED);
+  CHECK_EQ(heater.sim.state.target_temperature, 50);
+  CHECK_EQ(heater.sim.state.mode, uint8_t(Mode::PROG));
+}
+
+TEST(parse_hours_syntax) {
+  uint32_t hours;
+  CHECK(SBSchedule::parse_hours("0-5,13,22-23", hours));
+  CHECK_EQ(hours, uint32_t(0x3F | 1u << 13 | 3u << 22));
+  CHECK(SBSchedule::parse_hours("", hours));
+  CHECK_EQ(hours, uint32_t(0));
+  CHECK(!SBSchedule::parse_hours("0-5,", hours));
+  CHECK(!SBSchedule::parse_hours(",", hours));
+  CHECK(!SBSchedule::parse_hours("0,,1", hours));
+  CHECK(!SBSchedule::parse_hours("5-3", hours));
+  CHECK(!SBSchedule::parse_hours("24", hours));
+}
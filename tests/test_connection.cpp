@@ -0,0 +1,264 @@
+// Connection, pairing and basic reads against the simulated water heater
+#include "sb_host.h"
+#include "sb_test.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+TEST(pairs_with_pin) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.setup();
+  CHECK(node.run_until([&] { return heater.state.state == "Require PIN"; }, 2000));
+  heater.pin.perform(1234);
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  CHECK(heater.sim.is_paired(heater.boiler.uid_));
+  CHECK_EQ(heater.boiler.uid_.size(), size_t(6));
+}
+
+TEST(wrong_pin_is_not_accepted) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.setup();
+  CHECK(node.run_until([&] { return heater.state.state == "Require PIN"; }, 2000));
+  heater.pin.perform(4321);
+  node.run_for(2000);
+  CHECK(!heater.boiler.is_connected());
+  CHECK(!heater.sim.is_paired(heater.boiler.uid_));
+}
+
+TEST(bonded_device_reads_values) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  CHECK_EQ(heater.temp1.state, 45.0f);
+  CHECK_EQ(heater.temp2.state, 52.5f);
+  CHECK_EQ(heater.mode.state, std::string("SMART"));
+  CHECK_EQ(heater.thermostat.target_temperature, 60.0f);
+  CHECK_EQ(heater.name.state, std::string("Bojler"));
+  CHECK_EQ(heater.version.state, std::string("fw:1.2.3, board: B, S/N: 123456"));
+  CHECK_EQ(heater.heat_on.state, false);
+  CHECK(heater.schedule.has_state());
+  CHECK_EQ(heater.sim.requests(SBPacket::SBC_PACKET_HOME_ERROR), size_t(0));
+}
+
+TEST(settings_are_confirmed) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  heater.thermostat.perform(climate::ClimateCall().set_target_temperature(55));
+  heater.mode.perform("PROG");
+  node.run_for(2000);
+  CHECK_EQ(heater.sim.state.target_temperature, 55);
+  CHECK_EQ(heater.sim.state.mode, uint8_t(Mode::PROG));
+  CHECK_EQ(heater.thermostat.target_temperature, 55.0f);
+  CHECK_EQ(heater.mode.state, std::string("PROG"));
+  CHECK_EQ(heater.boiler.snapshot_.mode, uint8_t(Mode::PROG));
+}
+
+TEST(reconnects_after_link_loss) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(3000);
+  heater.client.drop_link();
+  node.step();
+  CHECK(!heater.boiler.is_connected());
+  CHECK_EQ(heater.boiler.sent_queue_.size(), size_t(0));
+  heater.sim.state.sensor1 = 48.0f;
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 5000));
+  CHECK(node.run_until([&] { return heater.temp1.state == 48.0f; }, 5000));
+  CHECK_EQ(heater.client.connections(), size_t(2));
+}
+
+TEST(disconnect_is_handled_in_loop) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  heater.sim.latency = 200;
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  bool cancelled = false;
+  heater.boiler.read_value(SBPacket::SBC_PACKET_HOME_CAPACITY, [&](SBCompletion status, const SBProtocolResult *result) {
+    cancelled = status == SBCompletion::CANCELLED;
+  });
+  CHECK(heater.boiler.sent_queue_.size() > 0);
+  // the BLE callback itself leaves the queues alone
+  heater.client.drop_link();
+  CHECK(heater.boiler.is_connected());
+  CHECK(!cancelled);
+  heater.boiler.loop();
+  CHECK(!heater.boiler.is_connected());
+  CHECK(cancelled);
+  CHECK_EQ(heater.boiler.sent_queue_.size(), size_t(0));
+  CHECK_EQ(heater.state.state, std::string("Disconnected"));
+}
+
+TEST(reconnect_between_loops_authenticates) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  size_t authentications = heater.sim.requests(SBPacket::SBC_PACKET_RQ_GLOBAL_MAC);
+  // the link drops and comes back before loop() runs again
+  heater.client.connect_delay = 0;
+  heater.client.drop_link();
+  heater.client.host_loop();
+  heater.client.host_loop();
+  CHECK(heater.client.is_connected());
+  heater.boiler.loop();
+  CHECK_EQ(heater.sim.requests(SBPacket::SBC_PACKET_RQ_GLOBAL_MAC), authentications + 1);
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+}
+
+TEST(frames_are_captured_only_where_enabled) {
+  SBHostNode node;
+  auto &captured = node.add_heater("AA:00:00:00:00:01");
+  auto &other = node.add_heater("AA:00:00:00:00:02");
+  captured.boiler.set_capture(true);
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return captured.boiler.is_connected() && other.boiler.is_connected(); }, 2000));
+  node.run_for(2000);
+  CHECK(captured.boiler.capture_.size() > 0);
+  CHECK_EQ(other.boiler.capture_.size(), size_t(0));
+}
+
+TEST(setting_is_sent_alone) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  heater.sim.latency = 100;
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  heater.sim.reject_next(SBPacket::SBC_PACKET_HOME_SETMODE, 1);
+  heater.boiler.read_value(SBPacket::SBC_PACKET_HOME_CAPACITY, nullptr);
+  heater.boiler.read_value(SBPacket::SBC_PACKET_HOME_TIME, nullptr);
+  heater.mode.perform("PROG");
+  size_t reads_failed = 0;
+  heater.boiler.read_value(SBPacket::SBC_PACKET_HOME_BOILERNAME,
+                           [&](SBCompletion status, const SBProtocolResult *result) {
+                             reads_failed += status != SBCompletion::REPLIED;
+                           });
+  bool alone = true;
+  for (int i = 0; i < 2000; i++) {
+    node.step();
+    if (heater.boiler.sent_queue_.find_coalescable() != nullptr)
+      alone = alone && heater.boiler.sent_queue_.size() == 1;
+  }
+  CHECK(alone);
+  CHECK_EQ(reads_failed, size_t(0));
+  // the error reached the setting, which is rolled back
+  CHECK_EQ(heater.mode.state, std::string("SMART"));
+  CHECK_EQ(heater.sim.state.mode, uint8_t(Mode::SMART));
+}
+
+TEST(failed_setting_without_confirmed_value_is_read_again) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  heater.boiler.snapshot_.mode = SNAPSHOT_UNKNOWN_MODE;
+  heater.sim.reject_next(SBPacket::SBC_PACKET_HOME_SETMODE, 1);
+  size_t reads = heater.sim.requests(SBPacket::SBC_PACKET_HOME_MODE);
+  heater.mode.perform("PROG");
+  node.run_for(1000);
+  CHECK_EQ(heater.sim.requests(SBPacket::SBC_PACKET_HOME_MODE), reads + 1);
+  CHECK_EQ(heater.mode.state, std::string("SMART"));
+}
+
+TEST(duplicate_reads_share_handler_slots) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  heater.sim.reset_statistics();
+  size_t replied = 0;
+  auto count = [&](SBCompletion status, const SBProtocolResult *result) {
+    replied += status == SBCompletion::REPLIED;
+  };
+  // two handlers fit into one request, the third one needs a request of its own
+  for (size_t i = 0; i < SBCompletionHandlers::SLOTS + 1; i++)
+    heater.boiler.read_value(SBPacket::SBC_PACKET_HOME_CAPACITY, count);
+  node.run_for(1000);
+  CHECK_EQ(replied, SBCompletionHandlers::SLOTS + 1);
+  CHECK_EQ(heater.sim.requests(SBPacket::SBC_PACKET_HOME_CAPACITY), size_t(2));
+}
+
+TEST(unknown_mode_is_ignored) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  heater.sim.state.mode = 9;
+  heater.boiler.read_value(SBPacket::SBC_PACKET_HOME_MODE, nullptr);
+  node.run_for(1000);
+  CHECK_EQ(heater.mode.state, std::string("SMART"));
+  CHECK_EQ(heater.boiler.snapshot_.mode, uint8_t(Mode::SMART));
+}
+
+TEST(schedule_is_read_only_when_used) {
+  SBHostNode node;
+  auto &shown = node.add_heater("AA:00:00:00:00:01");
+  auto &unused = node.add_heater("AA:00:00:00:00:02");
+  unused.boiler.set_schedule_polling(false);
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return shown.boiler.is_connected() && unused.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  CHECK(shown.sim.requests(SBPacket::SBC_PACKET_NIGHT_GETDAYS) > 0);
+  CHECK_EQ(unused.sim.requests(SBPacket::SBC_PACKET_NIGHT_GETDAYS), size_t(0));
+  CHECK_EQ(unused.sim.requests(SBPacket::SBC_PACKET_NIGHT_GETDAYS2), size_t(0));
+}
+
+TEST(malformed_static_value_is_read_again_after_reconnect) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  heater.sim.state.fw_version = "garbage";
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  CHECK_EQ(heater.sim.requests(SBPacket::SBC_PACKET_HOME_FWVERSION), size_t(1));
+  CHECK_EQ(heater.boiler.get_value_age(SBPacket::SBC_PACKET_HOME_FWVERSION), UINT32_MAX);
+  heater.sim.state.fw_version = "1.2.3;B;123456";
+  heater.client.drop_link();
+  CHECK(node.run_until([&] { return heater.version.has_state(); }, 10000));
+  CHECK_EQ(heater.sim.requests(SBPacket::SBC_PACKET_HOME_FWVERSION), size_t(2));
+}
+
+TEST(malformed_aggregate_field_is_not_an_update) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5000);
+  CHECK(heater.boiler.get_value_age(SBPacket::SBC_PACKET_HOME_SENSOR1) != UINT32_MAX);
+  node.step(1000);
+  // mode;heating;sensor1;sensor2;temperature with a broken sensor1
+  char frame[40];
+  int length = snprintf(frame, sizeof(frame), "%02u3;0;4x.0;52.5;60\r\n", unsigned(SBPacket::SBC_PACKET_HOME_ALL));
+  heater.boiler.handle_incoming(reinterpret_cast<const uint8_t *>(frame), uint16_t(length));
+  CHECK(heater.boiler.get_value_age(SBPacket::SBC_PACKET_HOME_SENSOR1) > 0);
+  CHECK_EQ(heater.boiler.get_value_age(SBPacket::SBC_PACKET_HOME_SENSOR2), uint32_t(0));
+  CHECK_EQ(heater.temp1.state, 45.0f);
+}
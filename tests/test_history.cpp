@@ -0,0 +1,159 @@
+// Consumption history of days and months, SBConsumptionHistory
+#include <cmath>
+#include <string>
+#include <vector>
+#include "SBStatistics.h"
+#include "sb_host.h"
+#include "sb_test.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+static bool near(float actual, float expected) { return std::fabs(actual - expected) <= 0.0005f; }
+
+static std::string refresh(SBConsumptionHistory<7> &history) {
+  uint8_t indexes[7];
+  size_t count = history.start_refresh(indexes);
+  std::string text;
+  for (size_t i = 0; i < count; i++)
+    text += (i ? " " : "") + std::to_string(indexes[i]);
+  return text;
+}
+
+static std::string describe(const std::vector<std::pair<SBPacket, uint8_t>> &reads) {
+  std::string text;
+  for (const auto &read : reads)
+    text += (text.empty() ? "" : " ") + std::string(read.first == SBPacket::SBC_PACKET_STATISTICS_WEEK ? "W" : "Y") +
+            std::to_string(read.second);
+  return text;
+}
+
+// week and year buckets of the first full refresh
+static std::string full_refresh() {
+  std::string text;
+  for (int i = 0; i < 7; i++)
+    text += (text.empty() ? "W" : " W") + std::to_string(i);
+  for (int i = 0; i < 12; i++)
+    text += " Y" + std::to_string(i);
+  return text;
+}
+
+TEST(history_learns_the_current_bucket) {
+  SBConsumptionHistory<7> history;
+  CHECK_EQ(refresh(history), std::string("0 1 2 3 4 5 6"));
+  for (size_t i = 0; i < 7; i++)
+    history.update(i, 1000 + i);
+  CHECK(history.complete());
+  CHECK(!history.has_current());
+  CHECK_EQ(history.total(), uint32_t(7021));
+  // the first values are no change
+  CHECK_EQ(refresh(history), std::string("0 1 2 3 4 5 6"));
+  for (size_t i = 0; i < 7; i++)
+    history.update(i, i == 3 ? 1500 : 1000 + i);
+  CHECK(history.has_current());
+  CHECK_EQ(history.current(), uint32_t(1500));
+  CHECK_EQ(history.total(), uint32_t(7518));
+}
+
+// current bucket 5 with 1100 Wh learned, the next refresh started
+static SBConsumptionHistory<7> learned(std::string &reads) {
+  SBConsumptionHistory<7> history;
+  refresh(history);
+  for (size_t i = 0; i < 7; i++)
+    history.update(i, 1000);
+  refresh(history);
+  history.update(5, 1100);
+  reads = refresh(history);
+  return history;
+}
+
+TEST(history_partial_refresh_table) {
+  struct Case {
+    const char *name;
+    // buckets changed since the last refresh, with their new values
+    std::vector<std::pair<size_t, uint32_t>> changes;
+    const char *next_reads;
+    // consumption of the current period, -1 when it is not known anymore
+    int64_t current;
+    uint32_t total;
+  };
+  const Case cases[] = {
+      {"current bucket grew", {{5, 1200}}, "5 6", 1200, 7200},
+      {"new period started", {{5, 1250}, {6, 20}}, "6 0", 20, 6270},
+      {"new period without more in the old one", {{6, 20}}, "6 0", 20, 6120},
+      {"change found nowhere", {}, "0 1 2 3 4 5 6", -1, 7100},
+  };
+  for (const auto &test : cases) {
+    std::string reads;
+    auto history = learned(reads);
+    CHECK_EQ(reads, std::string("5 6"));
+    for (const auto &change : test.changes)
+      history.update(change.first, change.second);
+    reads = refresh(history);
+    int64_t current = history.has_current() ? int64_t(history.current()) : -1;
+    if (reads != test.next_reads || current != test.current || history.total() != test.total)
+      sb_test::fail(__FILE__, __LINE__,
+                    std::string(test.name) + ": reads " + reads + ", current " + std::to_string(current) +
+                        ", total " + std::to_string(history.total()));
+  }
+}
+
+TEST(history_refreshes_only_the_changed_buckets) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  auto &device = heater.sim.state;
+  device.week = {1100, 1200, 1300, 1400, 1500, 1600, 1700};
+  for (size_t i = 0; i < device.year.size(); i++)
+    device.year[i] = 100000 + i * 1000;
+  // the counter is read on each update
+  heater.boiler.set_update_interval(60000);
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.energy_year.has_state(); }, 120000));
+  CHECK_EQ(describe(heater.sim.bucket_reads()), full_refresh());
+  CHECK(near(heater.energy_week.state, 9.8f));
+  CHECK(near(heater.energy_year.state, 1266.0f));
+  // which bucket is the current one is not known yet
+  CHECK(!heater.energy_today.has_state());
+  CHECK(!heater.energy_month.has_state());
+
+  // all buckets of a refresh were read and handled
+  auto settled = [&](size_t reads) {
+    return node.run_until([&] { return heater.sim.bucket_reads().size() == reads; }, 120000) &&
+           node.run_until([&] { return heater.boiler.sent_queue_.size() == 0; }, 5000);
+  };
+  // energy consumed in the given day and month
+  auto consume = [&](uint32_t wh, size_t day, size_t month) {
+    heater.sim.reset_statistics();
+    device.consumption += wh;
+    device.week[day] += wh;
+    device.year[month] += wh;
+  };
+  // the second full refresh finds the current buckets
+  consume(100, 2, 9);
+  CHECK(settled(19));
+  CHECK_EQ(describe(heater.sim.bucket_reads()), full_refresh());
+  CHECK(near(heater.energy_today.state, 1.4f));
+  CHECK(near(heater.energy_month.state, 109.1f));
+
+  // from now on only the current and the next bucket are read
+  consume(50, 2, 9);
+  CHECK(settled(4));
+  CHECK_EQ(describe(heater.sim.bucket_reads()), std::string("W2 W3 Y9 Y10"));
+  CHECK(near(heater.energy_today.state, 1.45f));
+  CHECK(near(heater.energy_week.state, 9.95f));
+  CHECK(near(heater.energy_month.state, 109.15f));
+  CHECK(near(heater.energy_year.state, 1266.15f));
+
+  // a new day starts over in the next bucket
+  device.week[3] = 0;
+  consume(30, 3, 9);
+  CHECK(settled(4));
+  CHECK_EQ(describe(heater.sim.bucket_reads()), std::string("W2 W3 Y9 Y10"));
+  CHECK(near(heater.energy_today.state, 0.03f));
+  CHECK(near(heater.energy_week.state, 8.58f));
+  consume(10, 3, 9);
+  CHECK(settled(4));
+  CHECK_EQ(describe(heater.sim.bucket_reads()), std::string("W3 W4 Y9 Y10"));
+  CHECK(near(heater.energy_today.state, 0.04f));
+}
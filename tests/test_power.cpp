@@ -0,0 +1,136 @@
+// Power and heating cycle energy estimated from the energy counter, SBPowerEstimator
+#include <cmath>
+#include "SBPower.h"
+#include "sb_host.h"
+#include "sb_test.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+static bool near(float actual, float expected, float tolerance) { return std::fabs(actual - expected) <= tolerance; }
+
+TEST(power_rate_uses_the_device_clock) {
+  SBPowerEstimator estimator;
+  CHECK(!estimator.add_sample(1000, 5000, 0));
+  // the local clock is 2 s late, the counter was read 60 s apart on the device
+  CHECK(estimator.add_sample(1030, 5060, 58000));
+  CHECK_EQ(estimator.get_rate(), 1800.0f);
+  // without heating, the rated power is not measured
+  CHECK_EQ(estimator.get_rated_power(), 0.0f);
+}
+
+TEST(power_implausible_device_interval_falls_back_to_local_clock) {
+  struct Case {
+    const char *name;
+    uint32_t device_time;
+  };
+  // previous sample at device time 5000 and millis() 0, this one 60 s later
+  const Case cases[] = {
+      {"plausible", 5090},
+      {"clock set forward", 5000 + 2 * 60 + SBPowerEstimator::MIN_INTERVAL_S + 1},
+      {"clock stands still", 5000},
+      {"clock runs backwards", 4000},
+  };
+  const float expected[] = {30 * 3600.0f / 90, 1800.0f, 1800.0f, 1800.0f};
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    SBPowerEstimator estimator;
+    estimator.add_sample(1000, 5000, 0);
+    estimator.add_sample(1030, cases[i].device_time, 60000);
+    if (estimator.get_rate() != expected[i])
+      sb_test::fail(__FILE__, __LINE__,
+                    std::string(cases[i].name) + ": " + sb_test::show(estimator.get_rate()) + " W");
+  }
+  // the largest device interval still trusted
+  SBPowerEstimator estimator;
+  estimator.add_sample(1000, 5000, 0);
+  estimator.add_sample(1130, 5000 + 2 * 60 + SBPowerEstimator::MIN_INTERVAL_S, 60000);
+  CHECK_EQ(estimator.get_rate(), 3600.0f);
+}
+
+TEST(power_short_interval_is_merged_with_the_next_sample) {
+  SBPowerEstimator estimator;
+  estimator.add_sample(1000, 5000, 0);
+  CHECK(!estimator.add_sample(1005, 5005, 5000));
+  CHECK_EQ(estimator.get_rate(), 0.0f);
+  CHECK(estimator.add_sample(1020, 5020, 20000));
+  CHECK_EQ(estimator.get_rate(), 3600.0f);
+}
+
+TEST(power_counter_reset_restarts_the_measurement) {
+  SBPowerEstimator estimator;
+  estimator.add_sample(1000, 5000, 0);
+  CHECK(!estimator.add_sample(10, 5060, 60000));
+  CHECK(estimator.add_sample(40, 5120, 120000));
+  CHECK_EQ(estimator.get_rate(), 1800.0f);
+}
+
+TEST(power_heating_transitions) {
+  SBPowerEstimator estimator;
+  estimator.add_sample(1000, 5000, 0);
+  estimator.set_heating(true, 30000);
+  CHECK(estimator.is_heating());
+  CHECK_EQ(estimator.get_transition_at(), uint32_t(30000));
+  // the element was switched within the interval, the rate is not steady
+  CHECK(!estimator.add_sample(1010, 5060, 60000));
+  CHECK_EQ(estimator.get_rate(), 600.0f);
+  CHECK_EQ(estimator.get_rated_power(), 0.0f);
+  // the same state again is no transition
+  estimator.set_heating(true, 70000);
+  CHECK_EQ(estimator.get_transition_at(), uint32_t(30000));
+  CHECK(estimator.add_sample(1040, 5120, 120000));
+  CHECK_EQ(estimator.get_rated_power(), 1800.0f);
+  // averaged with the earlier measurements
+  CHECK(estimator.add_sample(1080, 5180, 180000));
+  CHECK_EQ(estimator.get_rated_power(), (3 * 1800.0f + 2400.0f) / 4);
+  estimator.set_heating(false, 200000);
+  CHECK(!estimator.add_sample(1090, 5240, 240000));
+  // steady without heating, the rated power stays
+  CHECK(estimator.add_sample(1090, 5300, 300000));
+  CHECK_EQ(estimator.get_rate(), 0.0f);
+  CHECK_EQ(estimator.get_rated_power(), (3 * 1800.0f + 2400.0f) / 4);
+}
+
+TEST(power_heating_cycle_energy) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(30000);
+  CHECK(!heater.heat_on.state);
+
+  heater.sim.state.heating = true;
+  uint32_t started_at = millis();
+  CHECK(node.run_until([&] { return heater.heat_on.state; }, 15000));
+  // rated power is not known yet, it is measured over a whole poll interval
+  CHECK(node.run_until([&] { return heater.power.has_state(); }, 150000));
+  CHECK(near(heater.power.state, 2000.0f, 60.0f));
+  node.run_for(10 * 60 * 1000);
+  heater.sim.state.heating = false;
+  float hours = (millis() - started_at) / 3600000.0f;
+  CHECK(node.run_until([&] { return heater.cycle_energy.has_state(); }, 15000));
+  CHECK_EQ(heater.power.state, 0.0f);
+  // kWh at 2 kW, the state polls shift both edges of the cycle alike
+  CHECK(near(heater.cycle_energy.state, 2.0f * hours, 0.01f));
+
+  // the next switch on publishes the measured rated power right away
+  heater.sim.state.heating = true;
+  CHECK(node.run_until([&] { return heater.heat_on.state; }, 15000));
+  CHECK(near(heater.power.state, 2000.0f, 60.0f));
+}
+
+TEST(power_cycle_in_progress_when_connecting_is_not_measured) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  heater.sim.state.heating = true;
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  node.run_for(5 * 60 * 1000);
+  CHECK(heater.heat_on.state);
+  heater.sim.state.heating = false;
+  CHECK(node.run_until([&] { return !heater.heat_on.state; }, 15000));
+  node.run_for(5000);
+  CHECK(!heater.cycle_energy.has_state());
+  CHECK_EQ(heater.power.state, 0.0f);
+}
@@ -0,0 +1,49 @@
+// Rotation mode: water heaters take turns in using a single connection. The
+// rotation is shared by all instances, so every case runs in its own process.
+#include "sb_host.h"
+#include "sb_test.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+static void add_rotation(SBHostNode &node, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    char address[32];
+    snprintf(address, sizeof(address), "AA:00:00:00:00:%02X", unsigned(i + 1));
+    node.add_heater(address).boiler.set_rotation(true);
+  }
+}
+
+TEST(rotation_connects_one_at_a_time_from_boot) {
+  SBHostNode node;
+  add_rotation(node, 4);
+  node.pair_all();
+  node.setup();
+  // BLEClient::setup() runs after the component's and enables every client
+  for (size_t i = 0; i < node.size(); i++)
+    CHECK(node.heater(i).client.enabled);
+  node.step();
+  size_t enabled = 0;
+  for (size_t i = 0; i < node.size(); i++)
+    enabled += node.heater(i).client.enabled;
+  CHECK_EQ(enabled, size_t(1));
+  node.run_for(120000);
+  CHECK_EQ(ble_client::BLEClient::peak_connected_clients(), size_t(1));
+  for (size_t i = 0; i < node.size(); i++) {
+    CHECK(node.heater(i).temp1.has_state());
+    CHECK_EQ(node.heater(i).client.failed_connections(), size_t(0));
+  }
+}
+
+TEST(rotation_beside_permanent_connections) {
+  SBHostNode node;
+  node.add_heater("AA:00:00:00:00:10");
+  node.add_heater("AA:00:00:00:00:11");
+  add_rotation(node, 3);
+  node.pair_all();
+  node.setup();
+  node.run_for(120000);
+  CHECK(ble_client::BLEClient::peak_connected_clients() <= ble_client::BLEClient::MAX_CONNECTIONS);
+  for (size_t i = 0; i < node.size(); i++)
+    CHECK(node.heater(i).temp1.has_state());
+}
@@ -0,0 +1,137 @@
+// Write planning of the PROG mode schedule, SBSchedule
+#include <string>
+#include <vector>
+#include "SBSchedule.h"
+#include "sb_test.h"
+
+using namespace esphome::sb;
+
+static const SBPacket SAVEDAY = SBPacket::SBC_PACKET_NIGHT_SAVEDAY;
+static const SBPacket SAVEDAYS = SBPacket::SBC_PACKET_NIGHT_SAVEDAYS;
+static const SBPacket SAVEDAYS2 = SBPacket::SBC_PACKET_NIGHT_SAVEDAYS2;
+
+// hours the water heater reports for a day before any change
+static uint32_t device_hours(uint8_t day) { return 0x3F << day; }
+
+// schedule with the days of the mask read from the water heater
+static SBSchedule read_days(uint8_t known) {
+  SBSchedule schedule;
+  for (uint8_t day = 0; day < SB_SCHEDULE_DAYS; day++) {
+    if (known & (1 << day))
+      schedule.on_read(day, device_hours(day));
+  }
+  return schedule;
+}
+
+static std::string describe(const SBScheduleWrite *writes, size_t count) {
+  std::string text;
+  for (size_t i = 0; i < count; i++)
+    text += std::to_string(writes[i].packet) + ":" + std::to_string(writes[i].first_day) + "+" +
+            std::to_string(writes[i].count) + " ";
+  return text;
+}
+
+struct PlanCase {
+  const char *name;
+  uint8_t known;
+  std::vector<uint8_t> changed_days;
+  std::vector<SBScheduleWrite> expected;
+};
+
+TEST(schedule_plan_table) {
+  const PlanCase cases[] = {
+      {"one changed day", 0x7F, {2}, {{SAVEDAY, 2, 1}}},
+      {"two days of the first part", 0x7F, {0, 3}, {{SAVEDAYS, 0, 4}}},
+      {"two days of the second part", 0x7F, {4, 6}, {{SAVEDAYS2, 4, 3}}},
+      {"one day in each part", 0x7F, {1, 5}, {{SAVEDAY, 1, 1}, {SAVEDAY, 5, 1}}},
+      {"single day and a whole part", 0x7F, {1, 5, 6}, {{SAVEDAY, 1, 1}, {SAVEDAYS2, 4, 3}}},
+      {"unknown neighbours", 0x03, {0, 1}, {{SAVEDAY, 0, 1}, {SAVEDAY, 1, 1}}},
+      {"changed days cover the unknown ones", 0x03, {0, 1, 2, 3}, {{SAVEDAYS, 0, 4}}},
+      {"nothing read yet", 0x00, {4, 5}, {{SAVEDAY, 4, 1}, {SAVEDAY, 5, 1}}},
+      {"no changes", 0x7F, {}, {}},
+  };
+  for (const auto &test : cases) {
+    auto schedule = read_days(test.known);
+    for (auto day : test.changed_days)
+      CHECK(schedule.set(day, device_hours(day) ^ 1));
+    SBScheduleWrite writes[SB_SCHEDULE_DAYS];
+    size_t count = schedule.plan(writes);
+    auto planned = describe(writes, count);
+    auto expected = describe(test.expected.data(), test.expected.size());
+    if (planned != expected)
+      sb_test::fail(__FILE__, __LINE__, std::string(test.name) + ": " + planned + "!= " + expected);
+    CHECK(!schedule.has_changes());
+  }
+}
+
+TEST(schedule_value_of_the_water_heater_is_not_written) {
+  auto schedule = read_days(0x7F);
+  CHECK(schedule.set(3, device_hours(3)));
+  CHECK(!schedule.has_changes());
+  // a change taken back before it was written
+  CHECK(schedule.set(3, 0));
+  CHECK(schedule.set(3, device_hours(3)));
+  CHECK(!schedule.has_changes());
+  CHECK(!schedule.set(SB_SCHEDULE_DAYS, 0));
+}
+
+TEST(schedule_read_back_confirms_or_rejects) {
+  auto schedule = read_days(0x7F);
+  schedule.set(1, 0x0F);
+  schedule.set(2, 0xF0);
+  SBScheduleWrite writes[SB_SCHEDULE_DAYS];
+  CHECK_EQ(schedule.plan(writes), size_t(1));
+  // day 1 was taken, day 2 kept its old value
+  schedule.on_read(1, 0x0F);
+  CHECK(!schedule.take_rejected());
+  schedule.on_read(2, device_hours(2));
+  CHECK(schedule.take_rejected());
+  CHECK(!schedule.take_rejected());
+  CHECK_EQ(schedule.get(1), uint32_t(0x0F));
+  CHECK_EQ(schedule.get(2), device_hours(2));
+  // a rejected value is not tried again
+  CHECK(!schedule.has_changes());
+  CHECK_EQ(schedule.plan(writes), size_t(0));
+}
+
+TEST(schedule_stale_read_keeps_pending_change) {
+  auto schedule = read_days(0x7F);
+  schedule.set(5, 0x01);
+  // a poll answered before the change was written
+  schedule.on_read(5, device_hours(5));
+  CHECK(schedule.has_changes());
+  CHECK_EQ(schedule.get(5), uint32_t(0x01));
+  // the water heater got the value by other means
+  schedule.on_read(5, 0x01);
+  CHECK(!schedule.has_changes());
+}
+
+TEST(schedule_writes_are_retried_after_link_loss) {
+  auto schedule = read_days(0x7F);
+  schedule.set(0, 0x01);
+  schedule.set(6, 0x02);
+  SBScheduleWrite first[SB_SCHEDULE_DAYS], second[SB_SCHEDULE_DAYS];
+  size_t count = schedule.plan(first);
+  CHECK(!schedule.has_changes());
+  // the connection closed before the days were read back
+  schedule.retry_writes();
+  CHECK(schedule.has_changes());
+  CHECK_EQ(schedule.plan(second), count);
+  CHECK_EQ(describe(second, count), describe(first, count));
+  schedule.on_read(0, 0x01);
+  schedule.on_read(6, 0x02);
+  CHECK(!schedule.take_rejected());
+  // nothing left to repeat
+  schedule.retry_writes();
+  CHECK(!schedule.has_changes());
+}
+
+TEST(schedule_is_complete_once_every_day_is_read) {
+  auto schedule = read_days(0x3F);
+  CHECK(!schedule.complete());
+  schedule.on_read(6, 0);
+  CHECK(schedule.complete());
+  // hours above 23 are dropped
+  schedule.on_read(6, 0xFF000001);
+  CHECK_EQ(schedule.get(6), uint32_t(1));
+}
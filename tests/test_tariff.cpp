@@ -0,0 +1,204 @@
+// Learned HDO tariff model, SBTariffModel, and how the component uses it
+#include <cstdio>
+#include <vector>
+#include "SBTariff.h"
+#include "sb_host.h"
+#include "sb_test.h"
+
+using namespace esphome;
+using namespace esphome::sb;
+
+static const SBPacket LESSEXP = SBPacket::SBC_PACKET_HDO_LESSEXPTARIFFAVAILABLENOW;
+
+static uint32_t at(uint8_t day, uint8_t hours, uint8_t minutes) { return ((day * 24 + hours) * 60 + minutes) * 60; }
+
+// low tariff from 22:00 to 6:00 every day
+static bool pattern_low(uint16_t slot) {
+  uint32_t hours = slot * SB_TARIFF_SLOT_SECONDS / 3600 % 24;
+  return hours < 6 || hours >= 22;
+}
+
+static void observe_week(SBTariffModel &model) {
+  for (uint16_t slot = 0; slot < SB_TARIFF_SLOTS; slot++)
+    model.observe(slot, slot, pattern_low(slot));
+}
+
+static std::vector<uint8_t> text(SBPacket type, const char *value) {
+  char buffer[40];
+  int length = snprintf(buffer, sizeof(buffer), "%02u%s\r\n", unsigned(type), value);
+  return std::vector<uint8_t>(buffer, buffer + length);
+}
+
+static void notify(SBHostHeater &heater, SBPacket type, const char *value) {
+  auto frame = text(type, value);
+  heater.boiler.handle_incoming(frame.data(), uint16_t(frame.size()));
+}
+
+// move the clocks of the water heater and of the component to a week time
+static void jump_to(SBHostHeater &heater, uint32_t week_s) {
+  uint32_t elapsed_s = millis() / 1000 % SB_WEEK_SECONDS;
+  heater.sim.state.week_time = (week_s + SB_WEEK_SECONDS - elapsed_s) % SB_WEEK_SECONDS;
+  heater.boiler.clock_known_ = true;
+  heater.boiler.clock_week_s_ = week_s;
+  heater.boiler.clock_ref_ms_ = millis();
+}
+
+// connected heater with the HDO receiver on and nothing left to read
+static void connect(SBHostNode &node, SBHostHeater &heater) {
+  heater.sim.state.hdo_enabled = true;
+  node.pair_all();
+  node.setup();
+  CHECK(node.run_until([&] { return heater.boiler.is_connected(); }, 2000));
+  CHECK(node.run_until(
+      [&] { return heater.boiler.sent_queue_.size() == 0 && heater.boiler.command_queue_.empty(); }, 10000));
+}
+
+TEST(tariff_model_learns_a_weekly_pattern) {
+  SBTariffModel model;
+  CHECK_EQ(model.coverage(), uint8_t(0));
+  CHECK(!model.is_known(0));
+  observe_week(model);
+  // seen once, predicted but not sure yet
+  CHECK_EQ(model.coverage(), uint8_t(0));
+  CHECK(model.is_known(0));
+  CHECK(model.predict_low(SBTariffModel::slot_of(at(0, 23, 0))));
+  CHECK(!model.predict_low(SBTariffModel::slot_of(at(0, 12, 0))));
+  observe_week(model);
+  CHECK_EQ(model.coverage(), uint8_t(100));
+  for (uint16_t slot = 0; slot < SB_TARIFF_SLOTS; slot++) {
+    CHECK(model.is_confident(slot));
+    CHECK_EQ(model.predict_low(slot), pattern_low(slot));
+  }
+  // edges of Tuesday
+  CHECK(model.predict_low(SBTariffModel::slot_of(at(1, 5, 59))));
+  CHECK(!model.predict_low(SBTariffModel::slot_of(at(1, 6, 0))));
+  CHECK(!model.predict_low(SBTariffModel::slot_of(at(1, 21, 59))));
+  CHECK(model.predict_low(SBTariffModel::slot_of(at(1, 22, 0))));
+}
+
+TEST(tariff_model_mismatch_lowers_confidence) {
+  SBTariffModel model;
+  observe_week(model);
+  observe_week(model);
+  auto slot = SBTariffModel::slot_of(at(2, 23, 0));
+  CHECK(model.take_dirty());
+  model.observe(slot, slot, false);
+  CHECK(model.take_dirty());
+  CHECK(!model.take_dirty());
+  CHECK(!model.is_confident(slot));
+  CHECK(model.predict_low(slot));
+  model.observe(slot, slot, false);
+  CHECK(!model.predict_low(slot));
+  model.observe(slot, slot, false);
+  CHECK(model.is_confident(slot));
+  CHECK(!model.predict_low(slot));
+  // the neighbours are not affected
+  CHECK(model.is_confident(slot - 1));
+  CHECK(model.predict_low(slot - 1));
+}
+
+TEST(tariff_model_wraps_around_the_week) {
+  SBTariffModel model;
+  CHECK_EQ(SBTariffModel::slot_of(SB_WEEK_SECONDS + 60), uint16_t(0));
+  CHECK_EQ(SBTariffModel::distance(SB_TARIFF_SLOTS - 2, 1), uint16_t(3));
+  model.observe(SB_TARIFF_SLOTS - 2, 1, true);
+  CHECK(model.is_known(SB_TARIFF_SLOTS - 2));
+  CHECK(model.is_known(SB_TARIFF_SLOTS - 1));
+  CHECK(model.is_known(0));
+  CHECK(model.is_known(1));
+  CHECK(!model.is_known(2));
+  CHECK(!model.is_known(SB_TARIFF_SLOTS - 3));
+}
+
+TEST(tariff_model_clear) {
+  SBTariffModel model;
+  observe_week(model);
+  observe_week(model);
+  model.take_dirty();
+  model.clear();
+  CHECK(model.take_dirty());
+  CHECK_EQ(model.coverage(), uint8_t(0));
+  CHECK(!model.is_known(SBTariffModel::slot_of(at(3, 12, 0))));
+}
+
+TEST(tariff_predicted_edge_flips_the_sensor) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  observe_week(heater.boiler.tariff_model_);
+  observe_week(heater.boiler.tariff_model_);
+  connect(node, heater);
+  CHECK(heater.hdo_low_tariff.has_state());
+  CHECK(!heater.hdo_low_tariff.state);
+  heater.sim.reset_statistics();
+  // the water heater would still report the high tariff, only the model knows about the edge
+  jump_to(heater, at(0, 21, 50));
+  node.run_for(1000);
+  CHECK(!heater.hdo_low_tariff.state);
+  jump_to(heater, at(0, 22, 5));
+  node.run_for(1000);
+  CHECK(heater.hdo_low_tariff.state);
+  jump_to(heater, at(1, 6, 1));
+  node.run_for(1000);
+  CHECK(!heater.hdo_low_tariff.state);
+  CHECK_EQ(heater.sim.requests(LESSEXP), size_t(0));
+}
+
+TEST(tariff_mismatch_publishes_the_actual_tariff) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  observe_week(heater.boiler.tariff_model_);
+  observe_week(heater.boiler.tariff_model_);
+  connect(node, heater);
+  jump_to(heater, at(0, 12, 0));
+  auto slot = SBTariffModel::slot_of(at(0, 12, 0));
+  CHECK(heater.boiler.tariff_model_.is_confident(slot));
+  heater.sim.state.low_tariff = true;
+  notify(heater, LESSEXP, "1");
+  node.run_for(1000);
+  CHECK(!heater.boiler.tariff_model_.is_confident(slot));
+  CHECK(heater.hdo_low_tariff.state);
+  // the slot is checked again once it is learned
+  heater.sim.reset_statistics();
+  node.run_for(15 * 60 * 1000);
+  CHECK(heater.sim.requests(LESSEXP) >= 1);
+}
+
+TEST(tariff_edge_is_placed_from_the_last_hdo_time) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  connect(node, heater);
+  jump_to(heater, at(0, 21, 50));
+  notify(heater, LESSEXP, "0");
+  jump_to(heater, at(0, 22, 20));
+  heater.sim.state.low_tariff = true;
+  heater.sim.state.last_hdo_time = "0.22:00:00";
+  notify(heater, LESSEXP, "1");
+  node.run_for(500);
+  auto &model = heater.boiler.tariff_model_;
+  auto edge = SBTariffModel::slot_of(at(0, 22, 0));
+  CHECK(model.is_known(edge - 1));
+  CHECK(!model.predict_low(edge - 1));
+  CHECK(model.is_known(edge));
+  CHECK(model.predict_low(edge));
+  CHECK(model.predict_low(edge + 1));
+}
+
+TEST(tariff_model_is_cleared_when_the_hdo_settings_change) {
+  SBHostNode node;
+  auto &heater = node.add_heater("AA:00:00:00:00:01");
+  connect(node, heater);
+  auto &model = heater.boiler.tariff_model_;
+  observe_week(model);
+  observe_week(model);
+  notify(heater, SBPacket::SBC_PACKET_HDO_SELECTION_A, "A1");
+  notify(heater, SBPacket::SBC_PACKET_HDO_SELECTION_A, "");
+  CHECK_EQ(model.coverage(), uint8_t(100));
+  heater.sim.state.hdo_config[0] = "A9";
+  bool replied = false;
+  heater.boiler.read_value(SBPacket::SBC_PACKET_HDO_SELECTION_A,
+                           [&](SBCompletion status, const SBProtocolResult *) {
+                             replied = status == SBCompletion::REPLIED;
+                           });
+  CHECK(node.run_until([&] { return replied; }, 2000));
+  CHECK_EQ(model.coverage(), uint8_t(0));
+}